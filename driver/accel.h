@@ -0,0 +1,746 @@
+/* Precomputed stepping motor acceleration curves.
+ * This file is auto generated by tools/mk_accel_tables.pl.
+ */
+#ifndef _ACCEL_H_
+#define _ACCEL_H_
+
+/* Unclamped acceleration curve, see build_accel_profile() */
+struct accel_curve
+{
+	uint16_t c_start;	/* Start speed [counter ticks/step] */
+	float exp;		/* Power function exponent */
+	uint16_t a[MTRTBL_SIZE];
+};
+
+static const struct accel_curve accel_curves[] = {
+	{ 24576, 1.5, {
+		24576, 24576, 15481, 11814, 9752, 8404, 7442, 6716, 6144, 5680,
+		5294, 4968, 4688, 4445, 4230, 4040, 3870, 3717, 3578, 3451,
+		3335, 3228, 3130, 3038, 2953, 2874, 2800, 2730, 2665, 2603,
+		2545, 2490, 2438, 2388, 2341, 2296, 2254, 2213, 2174, 2136,
+		2101, 2066, 2033, 2002, 1971, 1942, 1914, 1887, 1860, 1835,
+		1810, 1787, 1764, 1741, 1720, 1699, 1679, 1659, 1640, 1621,
+		1603, 1585, 1568, 1552, 1536, 1520, 1504, 1489, 1475, 1460,
+		1446, 1433, 1420, 1407, 1394, 1381, 1369, 1357, 1346, 1334,
+		1323, 1312, 1302, 1291, 1281, 1271, 1261, 1251, 1242, 1232,
+		1223, 1214, 1205, 1197, 1188, 1180, 1172, 1164, 1156, 1148,
+		1140, 1133, 1125, 1118, 1111, 1104, 1097, 1090, 1083, 1077,
+		1070, 1064, 1057, 1051, 1045, 1039, 1033, 1027, 1021, 1015,
+		1010, 1004, 999, 993, 988, 983, 977, 972, 967, 962,
+		957, 952, 947, 943, 938, 933, 929, 924, 920, 915,
+		911, 907, 902, 898, 894, 890, 886, 882, 878, 874,
+		870, 866, 862, 859, 855, 851, 848, 844, 840, 837,
+		833, 830, 826, 823, 820, 816, 813, 810, 807, 803,
+		800, 797, 794, 791, 788, 785, 782, 779, 776, 773,
+		770, 768, 765, 762, 759, 756, 754, 751, 748, 746,
+		743, 741, 738, 735, 733, 730, 728, 725, 723, 721,
+		718, 716, 713, 711, 709, 706, 704, 702, 700, 697,
+		695, 693, 691, 689, 686, 684, 682, 680, 678, 676,
+		674, 672, 670, 668, 666, 664, 662, 660, 658, 656,
+		654, 652, 650, 649, 647, 645, 643, 641, 639, 638,
+		636, 634, 632, 631, 629, 627, 625, 624, 622, 620,
+		619, 617, 615, 614, 612, 611, 609, 607, 606, 604,
+		603, 601, 600, 598, 597, 595, 594, 592, 591, 589,
+		588, 586, 585, 583, 582, 581, 579, 578, 576, 575,
+		574, 572, 571, 570, 568, 567, 566, 564, 563, 562,
+		560, 559, 558, 557, 555, 554, 553, 552, 550, 549,
+		548, 547, 545, 544, 543, 542, 541, 540, 538, 537,
+		536, 535, 534, 533, 531, 530, 529, 528, 527, 526,
+		525, 524, 523, 522, 520, 519, 518, 517, 516, 515,
+		514, 513, 512, 511, 510, 509, 508, 507, 506, 505,
+		504, 503, 502, 501, 500, 499, 498, 497, 496, 495,
+		494, 493, 492, 492, 491, 490, 489, 488, 487, 486,
+		485, 484, 483, 482, 482, 481, 480, 479, 478, 477,
+		476, 475, 475, 474, 473, 472, 471, 470, 470, 469,
+		468, 467, 466, 465, 465, 464, 463, 462, 461, 461,
+		460, 459, 458, 458, 457, 456, 455, 454, 454, 453,
+		452, 451, 451, 450, 449, 448, 448, 447, 446, 446,
+		445, 444, 443, 443, 442, 441, 441, 440, 439, 438,
+		438, 437, 436, 436, 435, 434, 434, 433, 432, 432,
+		431, 430, 430, 429, 428, 428, 427, 426, 426, 425,
+		424, 424, 423, 422, 422, 421, 421, 420, 419, 419,
+		418, 417, 417, 416, 416, 415, 414, 414, 413, 413,
+		412, 411, 411, 410, 410, 409, 408, 408, 407, 407,
+		406, 405, 405, 404, 404, 403, 403, 402, 401, 401,
+		400, 400, 399, 399, 398, 398, 397, 397, 396, 395,
+		395, 394, 394, 393, 393, 392, 392, 391, 391, 390,
+		390, 389, 389, 388, 388, 387, 387, 386, 386, 385,
+		385, 384, 384, 383, 383, 382, 382, 381, 381, 380,
+		380, 379, 379, 378, 378, 377, 377, 376, 376, 375,
+		375, 374, 374, 373, 373, 372, 372, 371, 371, 371,
+		370, 370, 369, 369, 368, 368, 367, 367, 366, 366,
+		366, 365, 365, 364, 364, 363, 363, 363, 362, 362,
+		361, 361, 360, 360, 360, 359, 359, 358, 358, 357,
+		357, 357, 356, 356, 355, 355, 355, 354, 354, 353,
+		353, 352, 352, 352, 351, 351, 350, 350, 350, 349,
+		349, 348, 348, 348, 347, 347, 347, 346, 346, 345,
+		345, 345, 344, 344, 343, 343, 343, 342, 342, 342,
+		341, 341, 340, 340, 340, 339, 339, 339, 338, 338,
+		338, 337, 337, 336, 336, 336, 335, 335, 335, 334,
+		334, 334, 333, 333, 333, 332, 332, 331, 331, 331,
+		330, 330, 330, 329, 329, 329, 328, 328, 328, 327,
+		327, 327, 326, 326, 326, 325, 325, 325, 324, 324,
+		324, 323, 323, 323, 322, 322, 322, 321, 321, 321,
+		320, 320, 320, 320, 319, 319, 319, 318, 318, 318,
+		317, 317, 317, 316, 316, 316, 315, 315, 315, 315,
+		314, 314, 314, 313, 313, 313, 312, 312, 312, 312,
+		311, 311, 311, 310, 310, 310, 309, 309, 309, 309,
+		308, 308, 308, 307, 307, 307, 307, 306, 306, 306,
+		305, 305, 305, 305, 304, 304, 304, 303, 303, 303,
+		303, 302, 302, 302, 302, 301, 301, 301, 300, 300,
+		300, 300, 299, 299, 299, 299, 298, 298, 298, 297,
+		297, 297, 297, 296, 296, 296, 296, 295, 295, 295,
+		295, 294, 294, 294, 294, 293, 293, 293, 293, 292,
+		292, 292, 292, 291, 291, 291, 291, 290, 290, 290,
+		290, 289, 289, 289, 289, 288, 288, 288, 288, 287,
+		287, 287, 287, 286, 286, 286, 286, 285, 285, 285,
+		285, 284, 284, 284, 284, 283, 283, 283, 283, 283,
+		282, 282, 282, 282, 281, 281, 281, 281, 280, 280,
+		280, 280, 280, 279, 279, 279, 279, 278, 278, 278,
+		278, 278, 277, 277, 277, 277, 276, 276, 276, 276,
+		276, 275, 275, 275, 275, 274, 274, 274, 274, 274,
+		273, 273, 273, 273, 273, 272, 272, 272, 272, 271,
+		271, 271, 271, 271, 270, 270, 270, 270, 270, 269,
+		269, 269, 269, 269, 268, 268, 268, 268, 268, 267,
+		267, 267, 267, 267, 266, 266, 266, 266, 266, 265,
+		265, 265, 265, 265, 264, 264, 264, 264, 264, 263,
+		263, 263, 263, 263, 262, 262, 262, 262, 262, 261,
+		261, 261, 261, 261, 260, 260, 260, 260, 260, 259,
+		259, 259, 259, 259, 259, 258, 258, 258, 258, 258,
+		257, 257, 257, 257, 257, 257, 256, 256, 256, 256,
+		256, 255, 255, 255, 255, 255, 255, 254, 254, 254,
+		254, 254, 253, 253, 253, 253, 253, 253, 252, 252,
+		252, 252, 252, 252, 251, 251, 251, 251, 251, 250,
+		250, 250, 250, 250, 250, 249, 249, 249, 249, 249,
+		249, 248, 248, 248, 248, 248, 248, 247, 247, 247,
+		247, 247, 247, 246, 246, 246, 246, 246, 246, 245,
+		245, 245, 245, 245, 245, 244, 244, 244, 244, 244,
+		244, 243, 243, 243, 243, 243, 243, 243, 242, 242,
+	} },
+	{ 28597, 1.5, {
+		28597, 28597, 18014, 13748, 11348, 9780, 8660, 7814, 7149, 6609,
+		6161, 5781, 5455, 5172, 4923, 4701, 4503, 4325, 4163, 4016,
+		3881, 3756, 3642, 3535, 3437, 3344, 3258, 3177, 3101, 3029,
+		2961, 2897, 2837, 2779, 2724, 2672, 2622, 2575, 2530, 2486,
+		2445, 2405, 2366, 2329, 2294, 2260, 2227, 2195, 2165, 2135,
+		2107, 2079, 2052, 2026, 2001, 1977, 1953, 1930, 1908, 1886,
+		1865, 1845, 1825, 1806, 1787, 1768, 1751, 1733, 1716, 1699,
+		1683, 1667, 1652, 1637, 1622, 1607, 1593, 1580, 1566, 1553,
+		1540, 1527, 1515, 1502, 1490, 1479, 1467, 1456, 1445, 1434,
+		1423, 1413, 1403, 1393, 1383, 1373, 1363, 1354, 1345, 1336,
+		1327, 1318, 1309, 1301, 1293, 1284, 1276, 1268, 1260, 1253,
+		1245, 1238, 1230, 1223, 1216, 1209, 1202, 1195, 1188, 1182,
+		1175, 1168, 1162, 1156, 1150, 1143, 1137, 1131, 1125, 1120,
+		1114, 1108, 1103, 1097, 1092, 1086, 1081, 1076, 1070, 1065,
+		1060, 1055, 1050, 1045, 1040, 1036, 1031, 1026, 1022, 1017,
+		1012, 1008, 1004, 999, 995, 991, 986, 982, 978, 974,
+		970, 966, 962, 958, 954, 950, 946, 942, 939, 935,
+		931, 928, 924, 921, 917, 914, 910, 907, 903, 900,
+		897, 893, 890, 887, 883, 880, 877, 874, 871, 868,
+		865, 862, 859, 856, 853, 850, 847, 844, 841, 838,
+		836, 833, 830, 827, 825, 822, 819, 817, 814, 812,
+		809, 806, 804, 801, 799, 796, 794, 791, 789, 787,
+		784, 782, 779, 777, 775, 773, 770, 768, 766, 764,
+		761, 759, 757, 755, 753, 750, 748, 746, 744, 742,
+		740, 738, 736, 734, 732, 730, 728, 726, 724, 722,
+		720, 718, 716, 714, 713, 711, 709, 707, 705, 703,
+		702, 700, 698, 696, 694, 693, 691, 689, 687, 686,
+		684, 682, 681, 679, 677, 676, 674, 672, 671, 669,
+		668, 666, 664, 663, 661, 660, 658, 657, 655, 654,
+		652, 651, 649, 648, 646, 645, 643, 642, 640, 639,
+		638, 636, 635, 633, 632, 631, 629, 628, 627, 625,
+		624, 622, 621, 620, 619, 617, 616, 615, 613, 612,
+		611, 609, 608, 607, 606, 604, 603, 602, 601, 600,
+		598, 597, 596, 595, 594, 592, 591, 590, 589, 588,
+		587, 585, 584, 583, 582, 581, 580, 579, 578, 576,
+		575, 574, 573, 572, 571, 570, 569, 568, 567, 566,
+		565, 564, 563, 561, 560, 559, 558, 557, 556, 555,
+		554, 553, 552, 551, 550, 549, 548, 547, 547, 546,
+		545, 544, 543, 542, 541, 540, 539, 538, 537, 536,
+		535, 534, 533, 532, 532, 531, 530, 529, 528, 527,
+		526, 525, 525, 524, 523, 522, 521, 520, 519, 519,
+		518, 517, 516, 515, 514, 513, 513, 512, 511, 510,
+		509, 509, 508, 507, 506, 505, 505, 504, 503, 502,
+		501, 501, 500, 499, 498, 498, 497, 496, 495, 495,
+		494, 493, 492, 492, 491, 490, 489, 489, 488, 487,
+		486, 486, 485, 484, 484, 483, 482, 481, 481, 480,
+		479, 479, 478, 477, 477, 476, 475, 475, 474, 473,
+		473, 472, 471, 471, 470, 469, 469, 468, 467, 467,
+		466, 465, 465, 464, 463, 463, 462, 461, 461, 460,
+		460, 459, 458, 458, 457, 457, 456, 455, 455, 454,
+		453, 453, 452, 452, 451, 450, 450, 449, 449, 448,
+		447, 447, 446, 446, 445, 445, 444, 443, 443, 442,
+		442, 441, 441, 440, 439, 439, 438, 438, 437, 437,
+		436, 436, 435, 435, 434, 433, 433, 432, 432, 431,
+		431, 430, 430, 429, 429, 428, 428, 427, 427, 426,
+		426, 425, 424, 424, 423, 423, 422, 422, 421, 421,
+		420, 420, 419, 419, 418, 418, 417, 417, 416, 416,
+		415, 415, 415, 414, 414, 413, 413, 412, 412, 411,
+		411, 410, 410, 409, 409, 408, 408, 407, 407, 406,
+		406, 406, 405, 405, 404, 404, 403, 403, 402, 402,
+		401, 401, 401, 400, 400, 399, 399, 398, 398, 398,
+		397, 397, 396, 396, 395, 395, 395, 394, 394, 393,
+		393, 392, 392, 392, 391, 391, 390, 390, 389, 389,
+		389, 388, 388, 387, 387, 387, 386, 386, 385, 385,
+		385, 384, 384, 383, 383, 383, 382, 382, 381, 381,
+		381, 380, 380, 379, 379, 379, 378, 378, 378, 377,
+		377, 376, 376, 376, 375, 375, 374, 374, 374, 373,
+		373, 373, 372, 372, 372, 371, 371, 370, 370, 370,
+		369, 369, 369, 368, 368, 368, 367, 367, 366, 366,
+		366, 365, 365, 365, 364, 364, 364, 363, 363, 363,
+		362, 362, 362, 361, 361, 361, 360, 360, 359, 359,
+		359, 358, 358, 358, 357, 357, 357, 356, 356, 356,
+		355, 355, 355, 355, 354, 354, 354, 353, 353, 353,
+		352, 352, 352, 351, 351, 351, 350, 350, 350, 349,
+		349, 349, 348, 348, 348, 347, 347, 347, 347, 346,
+		346, 346, 345, 345, 345, 344, 344, 344, 343, 343,
+		343, 343, 342, 342, 342, 341, 341, 341, 340, 340,
+		340, 340, 339, 339, 339, 338, 338, 338, 338, 337,
+		337, 337, 336, 336, 336, 336, 335, 335, 335, 334,
+		334, 334, 334, 333, 333, 333, 332, 332, 332, 332,
+		331, 331, 331, 331, 330, 330, 330, 329, 329, 329,
+		329, 328, 328, 328, 328, 327, 327, 327, 326, 326,
+		326, 326, 325, 325, 325, 325, 324, 324, 324, 324,
+		323, 323, 323, 323, 322, 322, 322, 321, 321, 321,
+		321, 320, 320, 320, 320, 319, 319, 319, 319, 318,
+		318, 318, 318, 317, 317, 317, 317, 316, 316, 316,
+		316, 315, 315, 315, 315, 314, 314, 314, 314, 314,
+		313, 313, 313, 313, 312, 312, 312, 312, 311, 311,
+		311, 311, 310, 310, 310, 310, 310, 309, 309, 309,
+		309, 308, 308, 308, 308, 307, 307, 307, 307, 307,
+		306, 306, 306, 306, 305, 305, 305, 305, 304, 304,
+		304, 304, 304, 303, 303, 303, 303, 302, 302, 302,
+		302, 302, 301, 301, 301, 301, 301, 300, 300, 300,
+		300, 299, 299, 299, 299, 299, 298, 298, 298, 298,
+		298, 297, 297, 297, 297, 296, 296, 296, 296, 296,
+		295, 295, 295, 295, 295, 294, 294, 294, 294, 294,
+		293, 293, 293, 293, 293, 292, 292, 292, 292, 292,
+		291, 291, 291, 291, 291, 290, 290, 290, 290, 290,
+		289, 289, 289, 289, 289, 288, 288, 288, 288, 288,
+		287, 287, 287, 287, 287, 286, 286, 286, 286, 286,
+		285, 285, 285, 285, 285, 285, 284, 284, 284, 284,
+		284, 283, 283, 283, 283, 283, 282, 282, 282, 282,
+	} },
+	{ 14298, 2.0, {
+		14298, 14298, 10110, 8254, 7149, 6394, 5837, 5404, 5055, 4766,
+		4521, 4311, 4127, 3965, 3821, 3691, 3574, 3467, 3370, 3280,
+		3197, 3120, 3048, 2981, 2918, 2859, 2804, 2751, 2702, 2655,
+		2610, 2567, 2527, 2488, 2452, 2416, 2383, 2350, 2319, 2289,
+		2260, 2232, 2206, 2180, 2155, 2131, 2108, 2085, 2063, 2042,
+		2022, 2002, 1982, 1963, 1945, 1927, 1910, 1893, 1877, 1861,
+		1845, 1830, 1815, 1801, 1787, 1773, 1759, 1746, 1733, 1721,
+		1708, 1696, 1685, 1673, 1662, 1650, 1640, 1629, 1618, 1608,
+		1598, 1588, 1578, 1569, 1560, 1550, 1541, 1532, 1524, 1515,
+		1507, 1498, 1490, 1482, 1474, 1466, 1459, 1451, 1444, 1437,
+		1429, 1422, 1415, 1408, 1402, 1395, 1388, 1382, 1375, 1369,
+		1363, 1357, 1351, 1345, 1339, 1333, 1327, 1321, 1316, 1310,
+		1305, 1299, 1294, 1289, 1283, 1278, 1273, 1268, 1263, 1258,
+		1254, 1249, 1244, 1239, 1235, 1230, 1226, 1221, 1217, 1212,
+		1208, 1204, 1199, 1195, 1191, 1187, 1183, 1179, 1175, 1171,
+		1167, 1163, 1159, 1155, 1152, 1148, 1144, 1141, 1137, 1133,
+		1130, 1126, 1123, 1119, 1116, 1113, 1109, 1106, 1103, 1099,
+		1096, 1093, 1090, 1087, 1083, 1080, 1077, 1074, 1071, 1068,
+		1065, 1062, 1059, 1056, 1054, 1051, 1048, 1045, 1042, 1040,
+		1037, 1034, 1031, 1029, 1026, 1023, 1021, 1018, 1016, 1013,
+		1011, 1008, 1006, 1003, 1001, 998, 996, 993, 991, 989,
+		986, 984, 981, 979, 977, 975, 972, 970, 968, 966,
+		963, 961, 959, 957, 955, 953, 951, 948, 946, 944,
+		942, 940, 938, 936, 934, 932, 930, 928, 926, 924,
+		922, 921, 919, 917, 915, 913, 911, 909, 907, 906,
+		904, 902, 900, 898, 897, 895, 893, 891, 890, 888,
+		886, 885, 883, 881, 879, 878, 876, 875, 873, 871,
+		870, 868, 866, 865, 863, 862, 860, 859, 857, 855,
+		854, 852, 851, 849, 848, 846, 845, 843, 842, 841,
+		839, 838, 836, 835, 833, 832, 831, 829, 828, 826,
+		825, 824, 822, 821, 820, 818, 817, 816, 814, 813,
+		812, 810, 809, 808, 806, 805, 804, 803, 801, 800,
+		799, 798, 796, 795, 794, 793, 791, 790, 789, 788,
+		787, 785, 784, 783, 782, 781, 780, 778, 777, 776,
+		775, 774, 773, 772, 770, 769, 768, 767, 766, 765,
+		764, 763, 762, 761, 759, 758, 757, 756, 755, 754,
+		753, 752, 751, 750, 749, 748, 747, 746, 745, 744,
+		743, 742, 741, 740, 739, 738, 737, 736, 735, 734,
+		733, 732, 731, 730, 729, 728, 727, 726, 725, 724,
+		724, 723, 722, 721, 720, 719, 718, 717, 716, 715,
+		714, 714, 713, 712, 711, 710, 709, 708, 707, 706,
+		706, 705, 704, 703, 702, 701, 701, 700, 699, 698,
+		697, 696, 696, 695, 694, 693, 692, 691, 691, 690,
+		689, 688, 687, 687, 686, 685, 684, 683, 683, 682,
+		681, 680, 680, 679, 678, 677, 677, 676, 675, 674,
+		674, 673, 672, 671, 671, 670, 669, 668, 668, 667,
+		666, 665, 665, 664, 663, 663, 662, 661, 660, 660,
+		659, 658, 658, 657, 656, 656, 655, 654, 653, 653,
+		652, 651, 651, 650, 649, 649, 648, 647, 647, 646,
+		645, 645, 644, 643, 643, 642, 641, 641, 640, 640,
+		639, 638, 638, 637, 636, 636, 635, 634, 634, 633,
+		633, 632, 631, 631, 630, 630, 629, 628, 628, 627,
+		627, 626, 625, 625, 624, 624, 623, 622, 622, 621,
+		621, 620, 619, 619, 618, 618, 617, 617, 616, 615,
+		615, 614, 614, 613, 613, 612, 611, 611, 610, 610,
+		609, 609, 608, 608, 607, 606, 606, 605, 605, 604,
+		604, 603, 603, 602, 602, 601, 600, 600, 599, 599,
+		598, 598, 597, 597, 596, 596, 595, 595, 594, 594,
+		593, 593, 592, 592, 591, 591, 590, 590, 589, 589,
+		588, 588, 587, 587, 586, 586, 585, 585, 584, 584,
+		583, 583, 582, 582, 581, 581, 580, 580, 579, 579,
+		578, 578, 577, 577, 577, 576, 576, 575, 575, 574,
+		574, 573, 573, 572, 572, 571, 571, 571, 570, 570,
+		569, 569, 568, 568, 567, 567, 566, 566, 566, 565,
+		565, 564, 564, 563, 563, 562, 562, 562, 561, 561,
+		560, 560, 559, 559, 559, 558, 558, 557, 557, 556,
+		556, 556, 555, 555, 554, 554, 554, 553, 553, 552,
+		552, 551, 551, 551, 550, 550, 549, 549, 549, 548,
+		548, 547, 547, 547, 546, 546, 545, 545, 545, 544,
+		544, 543, 543, 543, 542, 542, 541, 541, 541, 540,
+		540, 540, 539, 539, 538, 538, 538, 537, 537, 536,
+		536, 536, 535, 535, 535, 534, 534, 533, 533, 533,
+		532, 532, 532, 531, 531, 531, 530, 530, 529, 529,
+		529, 528, 528, 528, 527, 527, 527, 526, 526, 525,
+		525, 525, 524, 524, 524, 523, 523, 523, 522, 522,
+		522, 521, 521, 521, 520, 520, 520, 519, 519, 518,
+		518, 518, 517, 517, 517, 516, 516, 516, 515, 515,
+		515, 514, 514, 514, 513, 513, 513, 512, 512, 512,
+		511, 511, 511, 510, 510, 510, 509, 509, 509, 509,
+		508, 508, 508, 507, 507, 507, 506, 506, 506, 505,
+		505, 505, 504, 504, 504, 503, 503, 503, 503, 502,
+		502, 502, 501, 501, 501, 500, 500, 500, 499, 499,
+		499, 499, 498, 498, 498, 497, 497, 497, 496, 496,
+		496, 495, 495, 495, 495, 494, 494, 494, 493, 493,
+		493, 493, 492, 492, 492, 491, 491, 491, 490, 490,
+		490, 490, 489, 489, 489, 488, 488, 488, 488, 487,
+		487, 487, 486, 486, 486, 486, 485, 485, 485, 485,
+		484, 484, 484, 483, 483, 483, 483, 482, 482, 482,
+		481, 481, 481, 481, 480, 480, 480, 480, 479, 479,
+		479, 479, 478, 478, 478, 477, 477, 477, 477, 476,
+		476, 476, 476, 475, 475, 475, 475, 474, 474, 474,
+		473, 473, 473, 473, 472, 472, 472, 472, 471, 471,
+		471, 471, 470, 470, 470, 470, 469, 469, 469, 469,
+		468, 468, 468, 468, 467, 467, 467, 467, 466, 466,
+		466, 466, 465, 465, 465, 465, 464, 464, 464, 464,
+		463, 463, 463, 463, 462, 462, 462, 462, 461, 461,
+		461, 461, 460, 460, 460, 460, 460, 459, 459, 459,
+		459, 458, 458, 458, 458, 457, 457, 457, 457, 456,
+		456, 456, 456, 456, 455, 455, 455, 455, 454, 454,
+		454, 454, 453, 453, 453, 453, 453, 452, 452, 452,
+		452, 451, 451, 451, 451, 451, 450, 450, 450, 450,
+		449, 449, 449, 449, 449, 448, 448, 448, 448, 447,
+	} },
+	{ 11234, 2.0, {
+		11234, 11234, 7943, 6485, 5617, 5023, 4586, 4246, 3971, 3744,
+		3552, 3387, 3242, 3115, 3002, 2900, 2808, 2724, 2647, 2577,
+		2511, 2451, 2395, 2342, 2293, 2246, 2203, 2161, 2123, 2086,
+		2051, 2017, 1985, 1955, 1926, 1898, 1872, 1846, 1822, 1798,
+		1776, 1754, 1733, 1713, 1693, 1674, 1656, 1638, 1621, 1604,
+		1588, 1573, 1557, 1543, 1528, 1514, 1501, 1487, 1475, 1462,
+		1450, 1438, 1426, 1415, 1404, 1393, 1382, 1372, 1362, 1352,
+		1342, 1333, 1323, 1314, 1305, 1297, 1288, 1280, 1272, 1263,
+		1255, 1248, 1240, 1233, 1225, 1218, 1211, 1204, 1197, 1190,
+		1184, 1177, 1171, 1164, 1158, 1152, 1146, 1140, 1134, 1129,
+		1123, 1117, 1112, 1106, 1101, 1096, 1091, 1086, 1080, 1076,
+		1071, 1066, 1061, 1056, 1052, 1047, 1043, 1038, 1034, 1029,
+		1025, 1021, 1017, 1012, 1008, 1004, 1000, 996, 992, 989,
+		985, 981, 977, 974, 970, 966, 963, 959, 956, 952,
+		949, 946, 942, 939, 936, 932, 929, 926, 923, 920,
+		917, 914, 911, 908, 905, 902, 899, 896, 893, 890,
+		888, 885, 882, 879, 877, 874, 871, 869, 866, 864,
+		861, 859, 856, 854, 851, 849, 846, 844, 842, 839,
+		837, 835, 832, 830, 828, 825, 823, 821, 819, 817,
+		815, 812, 810, 808, 806, 804, 802, 800, 798, 796,
+		794, 792, 790, 788, 786, 784, 782, 780, 778, 777,
+		775, 773, 771, 769, 767, 766, 764, 762, 760, 759,
+		757, 755, 753, 752, 750, 748, 747, 745, 743, 742,
+		740, 739, 737, 735, 734, 732, 731, 729, 728, 726,
+		725, 723, 722, 720, 719, 717, 716, 714, 713, 711,
+		710, 709, 707, 706, 704, 703, 702, 700, 699, 698,
+		696, 695, 694, 692, 691, 690, 688, 687, 686, 684,
+		683, 682, 681, 679, 678, 677, 676, 674, 673, 672,
+		671, 670, 668, 667, 666, 665, 664, 663, 661, 660,
+		659, 658, 657, 656, 655, 654, 652, 651, 650, 649,
+		648, 647, 646, 645, 644, 643, 642, 641, 640, 639,
+		638, 637, 636, 634, 633, 632, 631, 630, 629, 628,
+		627, 627, 626, 625, 624, 623, 622, 621, 620, 619,
+		618, 617, 616, 615, 614, 613, 612, 611, 611, 610,
+		609, 608, 607, 606, 605, 604, 603, 603, 602, 601,
+		600, 599, 598, 597, 597, 596, 595, 594, 593, 592,
+		592, 591, 590, 589, 588, 588, 587, 586, 585, 584,
+		584, 583, 582, 581, 580, 580, 579, 578, 577, 577,
+		576, 575, 574, 574, 573, 572, 571, 571, 570, 569,
+		568, 568, 567, 566, 565, 565, 564, 563, 563, 562,
+		561, 560, 560, 559, 558, 558, 557, 556, 556, 555,
+		554, 554, 553, 552, 552, 551, 550, 550, 549, 548,
+		548, 547, 546, 546, 545, 544, 544, 543, 543, 542,
+		541, 541, 540, 539, 539, 538, 538, 537, 536, 536,
+		535, 534, 534, 533, 533, 532, 531, 531, 530, 530,
+		529, 528, 528, 527, 527, 526, 526, 525, 524, 524,
+		523, 523, 522, 522, 521, 520, 520, 519, 519, 518,
+		518, 517, 517, 516, 515, 515, 514, 514, 513, 513,
+		512, 512, 511, 511, 510, 510, 509, 509, 508, 508,
+		507, 506, 506, 505, 505, 504, 504, 503, 503, 502,
+		502, 501, 501, 500, 500, 499, 499, 498, 498, 497,
+		497, 496, 496, 495, 495, 495, 494, 494, 493, 493,
+		492, 492, 491, 491, 490, 490, 489, 489, 488, 488,
+		487, 487, 487, 486, 486, 485, 485, 484, 484, 483,
+		483, 482, 482, 482, 481, 481, 480, 480, 479, 479,
+		479, 478, 478, 477, 477, 476, 476, 475, 475, 475,
+		474, 474, 473, 473, 473, 472, 472, 471, 471, 470,
+		470, 470, 469, 469, 468, 468, 468, 467, 467, 466,
+		466, 466, 465, 465, 464, 464, 464, 463, 463, 462,
+		462, 462, 461, 461, 460, 460, 460, 459, 459, 459,
+		458, 458, 457, 457, 457, 456, 456, 455, 455, 455,
+		454, 454, 454, 453, 453, 452, 452, 452, 451, 451,
+		451, 450, 450, 450, 449, 449, 449, 448, 448, 447,
+		447, 447, 446, 446, 446, 445, 445, 445, 444, 444,
+		444, 443, 443, 443, 442, 442, 441, 441, 441, 440,
+		440, 440, 439, 439, 439, 438, 438, 438, 437, 437,
+		437, 436, 436, 436, 435, 435, 435, 434, 434, 434,
+		434, 433, 433, 433, 432, 432, 432, 431, 431, 431,
+		430, 430, 430, 429, 429, 429, 428, 428, 428, 427,
+		427, 427, 427, 426, 426, 426, 425, 425, 425, 424,
+		424, 424, 424, 423, 423, 423, 422, 422, 422, 421,
+		421, 421, 421, 420, 420, 420, 419, 419, 419, 418,
+		418, 418, 418, 417, 417, 417, 416, 416, 416, 416,
+		415, 415, 415, 414, 414, 414, 414, 413, 413, 413,
+		412, 412, 412, 412, 411, 411, 411, 411, 410, 410,
+		410, 409, 409, 409, 409, 408, 408, 408, 408, 407,
+		407, 407, 406, 406, 406, 406, 405, 405, 405, 405,
+		404, 404, 404, 404, 403, 403, 403, 403, 402, 402,
+		402, 401, 401, 401, 401, 400, 400, 400, 400, 399,
+		399, 399, 399, 398, 398, 398, 398, 397, 397, 397,
+		397, 396, 396, 396, 396, 395, 395, 395, 395, 394,
+		394, 394, 394, 393, 393, 393, 393, 393, 392, 392,
+		392, 392, 391, 391, 391, 391, 390, 390, 390, 390,
+		389, 389, 389, 389, 389, 388, 388, 388, 388, 387,
+		387, 387, 387, 386, 386, 386, 386, 386, 385, 385,
+		385, 385, 384, 384, 384, 384, 383, 383, 383, 383,
+		383, 382, 382, 382, 382, 381, 381, 381, 381, 381,
+		380, 380, 380, 380, 379, 379, 379, 379, 379, 378,
+		378, 378, 378, 378, 377, 377, 377, 377, 376, 376,
+		376, 376, 376, 375, 375, 375, 375, 375, 374, 374,
+		374, 374, 374, 373, 373, 373, 373, 373, 372, 372,
+		372, 372, 371, 371, 371, 371, 371, 370, 370, 370,
+		370, 370, 369, 369, 369, 369, 369, 368, 368, 368,
+		368, 368, 367, 367, 367, 367, 367, 366, 366, 366,
+		366, 366, 366, 365, 365, 365, 365, 365, 364, 364,
+		364, 364, 364, 363, 363, 363, 363, 363, 362, 362,
+		362, 362, 362, 362, 361, 361, 361, 361, 361, 360,
+		360, 360, 360, 360, 359, 359, 359, 359, 359, 359,
+		358, 358, 358, 358, 358, 357, 357, 357, 357, 357,
+		357, 356, 356, 356, 356, 356, 355, 355, 355, 355,
+		355, 355, 354, 354, 354, 354, 354, 354, 353, 353,
+		353, 353, 353, 352, 352, 352, 352, 352, 352, 351,
+	} },
+	{ 5617, 2.0, {
+		5617, 5617, 3971, 3242, 2808, 2511, 2293, 2123, 1985, 1872,
+		1776, 1693, 1621, 1557, 1501, 1450, 1404, 1362, 1323, 1288,
+		1255, 1225, 1197, 1171, 1146, 1123, 1101, 1080, 1061, 1043,
+		1025, 1008, 992, 977, 963, 949, 936, 923, 911, 899,
+		888, 877, 866, 856, 846, 837, 828, 819, 810, 802,
+		794, 786, 778, 771, 764, 757, 750, 743, 737, 731,
+		725, 719, 713, 707, 702, 696, 691, 686, 681, 676,
+		671, 666, 661, 657, 652, 648, 644, 640, 636, 631,
+		627, 624, 620, 616, 612, 609, 605, 602, 598, 595,
+		592, 588, 585, 582, 579, 576, 573, 570, 567, 564,
+		561, 558, 556, 553, 550, 548, 545, 543, 540, 538,
+		535, 533, 530, 528, 526, 523, 521, 519, 517, 514,
+		512, 510, 508, 506, 504, 502, 500, 498, 496, 494,
+		492, 490, 488, 487, 485, 483, 481, 479, 478, 476,
+		474, 473, 471, 469, 468, 466, 464, 463, 461, 460,
+		458, 457, 455, 454, 452, 451, 449, 448, 446, 445,
+		444, 442, 441, 439, 438, 437, 435, 434, 433, 432,
+		430, 429, 428, 427, 425, 424, 423, 422, 421, 419,
+		418, 417, 416, 415, 414, 412, 411, 410, 409, 408,
+		407, 406, 405, 404, 403, 402, 401, 400, 399, 398,
+		397, 396, 395, 394, 393, 392, 391, 390, 389, 388,
+		387, 386, 385, 384, 383, 383, 382, 381, 380, 379,
+		378, 377, 376, 376, 375, 374, 373, 372, 371, 371,
+		370, 369, 368, 367, 367, 366, 365, 364, 364, 363,
+		362, 361, 361, 360, 359, 358, 358, 357, 356, 355,
+		355, 354, 353, 353, 352, 351, 351, 350, 349, 349,
+		348, 347, 347, 346, 345, 345, 344, 343, 343, 342,
+		341, 341, 340, 339, 339, 338, 338, 337, 336, 336,
+		335, 335, 334, 333, 333, 332, 332, 331, 330, 330,
+		329, 329, 328, 328, 327, 327, 326, 325, 325, 324,
+		324, 323, 323, 322, 322, 321, 321, 320, 320, 319,
+		319, 318, 318, 317, 316, 316, 315, 315, 314, 314,
+		313, 313, 313, 312, 312, 311, 311, 310, 310, 309,
+		309, 308, 308, 307, 307, 306, 306, 305, 305, 305,
+		304, 304, 303, 303, 302, 302, 301, 301, 301, 300,
+		300, 299, 299, 298, 298, 298, 297, 297, 296, 296,
+		296, 295, 295, 294, 294, 294, 293, 293, 292, 292,
+		292, 291, 291, 290, 290, 290, 289, 289, 288, 288,
+		288, 287, 287, 287, 286, 286, 285, 285, 285, 284,
+		284, 284, 283, 283, 282, 282, 282, 281, 281, 281,
+		280, 280, 280, 279, 279, 279, 278, 278, 278, 277,
+		277, 277, 276, 276, 276, 275, 275, 275, 274, 274,
+		274, 273, 273, 273, 272, 272, 272, 271, 271, 271,
+		270, 270, 270, 269, 269, 269, 269, 268, 268, 268,
+		267, 267, 267, 266, 266, 266, 265, 265, 265, 265,
+		264, 264, 264, 263, 263, 263, 263, 262, 262, 262,
+		261, 261, 261, 261, 260, 260, 260, 259, 259, 259,
+		259, 258, 258, 258, 257, 257, 257, 257, 256, 256,
+		256, 256, 255, 255, 255, 255, 254, 254, 254, 254,
+		253, 253, 253, 252, 252, 252, 252, 251, 251, 251,
+		251, 250, 250, 250, 250, 249, 249, 249, 249, 248,
+		248, 248, 248, 247, 247, 247, 247, 247, 246, 246,
+		246, 246, 245, 245, 245, 245, 244, 244, 244, 244,
+		243, 243, 243, 243, 243, 242, 242, 242, 242, 241,
+		241, 241, 241, 241, 240, 240, 240, 240, 239, 239,
+		239, 239, 239, 238, 238, 238, 238, 237, 237, 237,
+		237, 237, 236, 236, 236, 236, 236, 235, 235, 235,
+		235, 235, 234, 234, 234, 234, 234, 233, 233, 233,
+		233, 233, 232, 232, 232, 232, 232, 231, 231, 231,
+		231, 231, 230, 230, 230, 230, 230, 229, 229, 229,
+		229, 229, 228, 228, 228, 228, 228, 227, 227, 227,
+		227, 227, 227, 226, 226, 226, 226, 226, 225, 225,
+		225, 225, 225, 225, 224, 224, 224, 224, 224, 223,
+		223, 223, 223, 223, 223, 222, 222, 222, 222, 222,
+		222, 221, 221, 221, 221, 221, 220, 220, 220, 220,
+		220, 220, 219, 219, 219, 219, 219, 219, 218, 218,
+		218, 218, 218, 218, 217, 217, 217, 217, 217, 217,
+		217, 216, 216, 216, 216, 216, 216, 215, 215, 215,
+		215, 215, 215, 214, 214, 214, 214, 214, 214, 213,
+		213, 213, 213, 213, 213, 213, 212, 212, 212, 212,
+		212, 212, 212, 211, 211, 211, 211, 211, 211, 210,
+		210, 210, 210, 210, 210, 210, 209, 209, 209, 209,
+		209, 209, 209, 208, 208, 208, 208, 208, 208, 208,
+		207, 207, 207, 207, 207, 207, 207, 206, 206, 206,
+		206, 206, 206, 206, 205, 205, 205, 205, 205, 205,
+		205, 204, 204, 204, 204, 204, 204, 204, 204, 203,
+		203, 203, 203, 203, 203, 203, 202, 202, 202, 202,
+		202, 202, 202, 202, 201, 201, 201, 201, 201, 201,
+		201, 200, 200, 200, 200, 200, 200, 200, 200, 199,
+		199, 199, 199, 199, 199, 199, 199, 198, 198, 198,
+		198, 198, 198, 198, 198, 197, 197, 197, 197, 197,
+		197, 197, 197, 196, 196, 196, 196, 196, 196, 196,
+		196, 196, 195, 195, 195, 195, 195, 195, 195, 195,
+		194, 194, 194, 194, 194, 194, 194, 194, 194, 193,
+		193, 193, 193, 193, 193, 193, 193, 193, 192, 192,
+		192, 192, 192, 192, 192, 192, 191, 191, 191, 191,
+		191, 191, 191, 191, 191, 190, 190, 190, 190, 190,
+		190, 190, 190, 190, 189, 189, 189, 189, 189, 189,
+		189, 189, 189, 189, 188, 188, 188, 188, 188, 188,
+		188, 188, 188, 187, 187, 187, 187, 187, 187, 187,
+		187, 187, 187, 186, 186, 186, 186, 186, 186, 186,
+		186, 186, 185, 185, 185, 185, 185, 185, 185, 185,
+		185, 185, 184, 184, 184, 184, 184, 184, 184, 184,
+		184, 184, 183, 183, 183, 183, 183, 183, 183, 183,
+		183, 183, 183, 182, 182, 182, 182, 182, 182, 182,
+		182, 182, 182, 181, 181, 181, 181, 181, 181, 181,
+		181, 181, 181, 181, 180, 180, 180, 180, 180, 180,
+		180, 180, 180, 180, 179, 179, 179, 179, 179, 179,
+		179, 179, 179, 179, 179, 178, 178, 178, 178, 178,
+		178, 178, 178, 178, 178, 178, 177, 177, 177, 177,
+		177, 177, 177, 177, 177, 177, 177, 177, 176, 176,
+		176, 176, 176, 176, 176, 176, 176, 176, 176, 175,
+	} },
+	{ 12000, 1.5, {
+		12000, 12000, 7559, 5768, 4762, 4103, 3634, 3279, 3000, 2773,
+		2585, 2426, 2289, 2170, 2065, 1972, 1889, 1815, 1747, 1685,
+		1628, 1576, 1528, 1483, 1442, 1403, 1367, 1333, 1301, 1271,
+		1242, 1216, 1190, 1166, 1143, 1121, 1100, 1080, 1061, 1043,
+		1025, 1009, 993, 977, 962, 948, 934, 921, 908, 896,
+		884, 872, 861, 850, 839, 829, 819, 810, 800, 791,
+		782, 774, 766, 757, 750, 742, 734, 727, 720, 713,
+		706, 699, 693, 687, 680, 674, 668, 663, 657, 651,
+		646, 640, 635, 630, 625, 620, 615, 611, 606, 601,
+		597, 593, 588, 584, 580, 576, 572, 568, 564, 560,
+		556, 553, 549, 546, 542, 539, 535, 532, 529, 525,
+		522, 519, 516, 513, 510, 507, 504, 501, 498, 496,
+		493, 490, 487, 485, 482, 480, 477, 474, 472, 470,
+		467, 465, 462, 460, 458, 455, 453, 451, 449, 447,
+		445, 442, 440, 438, 436, 434, 432, 430, 428, 426,
+		425, 423, 421, 419, 417, 415, 414, 412, 410, 408,
+		407, 405, 403, 402, 400, 398, 397, 395, 394, 392,
+		391, 389, 387, 386, 385, 383, 382, 380, 379, 377,
+		376, 375, 373, 372, 370, 369, 368, 366, 365, 364,
+		363, 361, 360, 359, 358, 356, 355, 354, 353, 352,
+		350, 349, 348, 347, 346, 345, 344, 342, 341, 340,
+		339, 338, 337, 336, 335, 334, 333, 332, 331, 330,
+		329, 328, 327, 326, 325, 324, 323, 322, 321, 320,
+		319, 318, 317, 316, 316, 315, 314, 313, 312, 311,
+		310, 309, 309, 308, 307, 306, 305, 304, 304, 303,
+		302, 301, 300, 299, 299, 298, 297, 296, 296, 295,
+		294, 293, 293, 292, 291, 290, 290, 289, 288, 287,
+		287, 286, 285, 285, 284, 283, 283, 282, 281, 281,
+		280, 279, 279, 278, 277, 277, 276, 275, 275, 274,
+		273, 273, 272, 272, 271, 270, 270, 269, 268, 268,
+		267, 267, 266, 266, 265, 264, 264, 263, 263, 262,
+		261, 261, 260, 260, 259, 259, 258, 258, 257, 257,
+		256, 255, 255, 254, 254, 253, 253, 252, 252, 251,
+		251, 250, 250, 249, 249, 248, 248, 247, 247, 246,
+		246, 245, 245, 244, 244, 243, 243, 243, 242, 242,
+		241, 241, 240, 240, 239, 239, 238, 238, 238, 237,
+		237, 236, 236, 235, 235, 234, 234, 234, 233, 233,
+		232, 232, 231, 231, 231, 230, 230, 229, 229, 229,
+		228, 228, 227, 227, 227, 226, 226, 225, 225, 225,
+		224, 224, 224, 223, 223, 222, 222, 222, 221, 221,
+		221, 220, 220, 219, 219, 219, 218, 218, 218, 217,
+		217, 217, 216, 216, 216, 215, 215, 214, 214, 214,
+		213, 213, 213, 212, 212, 212, 211, 211, 211, 210,
+		210, 210, 209, 209, 209, 209, 208, 208, 208, 207,
+		207, 207, 206, 206, 206, 205, 205, 205, 204, 204,
+		204, 204, 203, 203, 203, 202, 202, 202, 201, 201,
+		201, 201, 200, 200, 200, 199, 199, 199, 199, 198,
+		198, 198, 197, 197, 197, 197, 196, 196, 196, 196,
+		195, 195, 195, 194, 194, 194, 194, 193, 193, 193,
+		193, 192, 192, 192, 192, 191, 191, 191, 190, 190,
+		190, 190, 189, 189, 189, 189, 188, 188, 188, 188,
+		187, 187, 187, 187, 187, 186, 186, 186, 186, 185,
+		185, 185, 185, 184, 184, 184, 184, 183, 183, 183,
+		183, 183, 182, 182, 182, 182, 181, 181, 181, 181,
+		180, 180, 180, 180, 180, 179, 179, 179, 179, 178,
+		178, 178, 178, 178, 177, 177, 177, 177, 177, 176,
+		176, 176, 176, 175, 175, 175, 175, 175, 174, 174,
+		174, 174, 174, 173, 173, 173, 173, 173, 172, 172,
+		172, 172, 172, 171, 171, 171, 171, 171, 170, 170,
+		170, 170, 170, 170, 169, 169, 169, 169, 169, 168,
+		168, 168, 168, 168, 167, 167, 167, 167, 167, 167,
+		166, 166, 166, 166, 166, 165, 165, 165, 165, 165,
+		165, 164, 164, 164, 164, 164, 163, 163, 163, 163,
+		163, 163, 162, 162, 162, 162, 162, 162, 161, 161,
+		161, 161, 161, 161, 160, 160, 160, 160, 160, 160,
+		159, 159, 159, 159, 159, 159, 158, 158, 158, 158,
+		158, 158, 157, 157, 157, 157, 157, 157, 157, 156,
+		156, 156, 156, 156, 156, 155, 155, 155, 155, 155,
+		155, 155, 154, 154, 154, 154, 154, 154, 153, 153,
+		153, 153, 153, 153, 153, 152, 152, 152, 152, 152,
+		152, 152, 151, 151, 151, 151, 151, 151, 151, 150,
+		150, 150, 150, 150, 150, 150, 149, 149, 149, 149,
+		149, 149, 149, 148, 148, 148, 148, 148, 148, 148,
+		148, 147, 147, 147, 147, 147, 147, 147, 146, 146,
+		146, 146, 146, 146, 146, 146, 145, 145, 145, 145,
+		145, 145, 145, 144, 144, 144, 144, 144, 144, 144,
+		144, 143, 143, 143, 143, 143, 143, 143, 143, 142,
+		142, 142, 142, 142, 142, 142, 142, 141, 141, 141,
+		141, 141, 141, 141, 141, 141, 140, 140, 140, 140,
+		140, 140, 140, 140, 139, 139, 139, 139, 139, 139,
+		139, 139, 139, 138, 138, 138, 138, 138, 138, 138,
+		138, 137, 137, 137, 137, 137, 137, 137, 137, 137,
+		136, 136, 136, 136, 136, 136, 136, 136, 136, 135,
+		135, 135, 135, 135, 135, 135, 135, 135, 135, 134,
+		134, 134, 134, 134, 134, 134, 134, 134, 133, 133,
+		133, 133, 133, 133, 133, 133, 133, 133, 132, 132,
+		132, 132, 132, 132, 132, 132, 132, 131, 131, 131,
+		131, 131, 131, 131, 131, 131, 131, 130, 130, 130,
+		130, 130, 130, 130, 130, 130, 130, 129, 129, 129,
+		129, 129, 129, 129, 129, 129, 129, 129, 128, 128,
+		128, 128, 128, 128, 128, 128, 128, 128, 127, 127,
+		127, 127, 127, 127, 127, 127, 127, 127, 127, 126,
+		126, 126, 126, 126, 126, 126, 126, 126, 126, 126,
+		125, 125, 125, 125, 125, 125, 125, 125, 125, 125,
+		125, 124, 124, 124, 124, 124, 124, 124, 124, 124,
+		124, 124, 124, 123, 123, 123, 123, 123, 123, 123,
+		123, 123, 123, 123, 122, 122, 122, 122, 122, 122,
+		122, 122, 122, 122, 122, 122, 121, 121, 121, 121,
+		121, 121, 121, 121, 121, 121, 121, 121, 120, 120,
+		120, 120, 120, 120, 120, 120, 120, 120, 120, 120,
+		120, 119, 119, 119, 119, 119, 119, 119, 119, 119,
+		119, 119, 119, 118, 118, 118, 118, 118, 118, 118,
+	} },
+	{ 5600, 2.0, {
+		5600, 5600, 3959, 3233, 2800, 2504, 2286, 2116, 1979, 1866,
+		1770, 1688, 1616, 1553, 1496, 1445, 1400, 1358, 1319, 1284,
+		1252, 1222, 1193, 1167, 1143, 1120, 1098, 1077, 1058, 1039,
+		1022, 1005, 989, 974, 960, 946, 933, 920, 908, 896,
+		885, 874, 864, 853, 844, 834, 825, 816, 808, 800,
+		791, 784, 776, 769, 762, 755, 748, 741, 735, 729,
+		722, 717, 711, 705, 700, 694, 689, 684, 679, 674,
+		669, 664, 659, 655, 650, 646, 642, 638, 634, 630,
+		626, 622, 618, 614, 611, 607, 603, 600, 596, 593,
+		590, 587, 583, 580, 577, 574, 571, 568, 565, 562,
+		560, 557, 554, 551, 549, 546, 543, 541, 538, 536,
+		533, 531, 529, 526, 524, 522, 519, 517, 515, 513,
+		511, 509, 507, 504, 502, 500, 498, 496, 494, 493,
+		491, 489, 487, 485, 483, 481, 480, 478, 476, 474,
+		473, 471, 469, 468, 466, 465, 463, 461, 460, 458,
+		457, 455, 454, 452, 451, 449, 448, 446, 445, 444,
+		442, 441, 439, 438, 437, 435, 434, 433, 432, 430,
+		429, 428, 426, 425, 424, 423, 422, 420, 419, 418,
+		417, 416, 415, 413, 412, 411, 410, 409, 408, 407,
+		406, 405, 404, 403, 402, 401, 400, 398, 397, 396,
+		395, 394, 394, 393, 392, 391, 390, 389, 388, 387,
+		386, 385, 384, 383, 382, 381, 381, 380, 379, 378,
+		377, 376, 375, 375, 374, 373, 372, 371, 370, 370,
+		369, 368, 367, 366, 366, 365, 364, 363, 362, 362,
+		361, 360, 359, 359, 358, 357, 357, 356, 355, 354,
+		354, 353, 352, 352, 351, 350, 350, 349, 348, 347,
+		347, 346, 345, 345, 344, 344, 343, 342, 342, 341,
+		340, 340, 339, 338, 338, 337, 337, 336, 335, 335,
+		334, 334, 333, 332, 332, 331, 331, 330, 329, 329,
+		328, 328, 327, 327, 326, 326, 325, 324, 324, 323,
+		323, 322, 322, 321, 321, 320, 320, 319, 319, 318,
+		318, 317, 317, 316, 316, 315, 315, 314, 314, 313,
+		313, 312, 312, 311, 311, 310, 310, 309, 309, 308,
+		308, 307, 307, 306, 306, 305, 305, 305, 304, 304,
+		303, 303, 302, 302, 301, 301, 301, 300, 300, 299,
+		299, 298, 298, 298, 297, 297, 296, 296, 295, 295,
+		295, 294, 294, 293, 293, 293, 292, 292, 291, 291,
+		291, 290, 290, 289, 289, 289, 288, 288, 288, 287,
+		287, 286, 286, 286, 285, 285, 285, 284, 284, 283,
+		283, 283, 282, 282, 282, 281, 281, 281, 280, 280,
+		280, 279, 279, 278, 278, 278, 277, 277, 277, 276,
+		276, 276, 275, 275, 275, 274, 274, 274, 273, 273,
+		273, 272, 272, 272, 271, 271, 271, 271, 270, 270,
+		270, 269, 269, 269, 268, 268, 268, 267, 267, 267,
+		266, 266, 266, 266, 265, 265, 265, 264, 264, 264,
+		263, 263, 263, 263, 262, 262, 262, 261, 261, 261,
+		261, 260, 260, 260, 259, 259, 259, 259, 258, 258,
+		258, 258, 257, 257, 257, 256, 256, 256, 256, 255,
+		255, 255, 255, 254, 254, 254, 254, 253, 253, 253,
+		252, 252, 252, 252, 251, 251, 251, 251, 250, 250,
+		250, 250, 249, 249, 249, 249, 248, 248, 248, 248,
+		247, 247, 247, 247, 247, 246, 246, 246, 246, 245,
+		245, 245, 245, 244, 244, 244, 244, 243, 243, 243,
+		243, 243, 242, 242, 242, 242, 241, 241, 241, 241,
+		240, 240, 240, 240, 240, 239, 239, 239, 239, 239,
+		238, 238, 238, 238, 237, 237, 237, 237, 237, 236,
+		236, 236, 236, 236, 235, 235, 235, 235, 234, 234,
+		234, 234, 234, 233, 233, 233, 233, 233, 232, 232,
+		232, 232, 232, 231, 231, 231, 231, 231, 230, 230,
+		230, 230, 230, 229, 229, 229, 229, 229, 229, 228,
+		228, 228, 228, 228, 227, 227, 227, 227, 227, 226,
+		226, 226, 226, 226, 225, 225, 225, 225, 225, 225,
+		224, 224, 224, 224, 224, 224, 223, 223, 223, 223,
+		223, 222, 222, 222, 222, 222, 222, 221, 221, 221,
+		221, 221, 221, 220, 220, 220, 220, 220, 219, 219,
+		219, 219, 219, 219, 218, 218, 218, 218, 218, 218,
+		217, 217, 217, 217, 217, 217, 216, 216, 216, 216,
+		216, 216, 216, 215, 215, 215, 215, 215, 215, 214,
+		214, 214, 214, 214, 214, 213, 213, 213, 213, 213,
+		213, 213, 212, 212, 212, 212, 212, 212, 211, 211,
+		211, 211, 211, 211, 211, 210, 210, 210, 210, 210,
+		210, 210, 209, 209, 209, 209, 209, 209, 208, 208,
+		208, 208, 208, 208, 208, 207, 207, 207, 207, 207,
+		207, 207, 206, 206, 206, 206, 206, 206, 206, 205,
+		205, 205, 205, 205, 205, 205, 205, 204, 204, 204,
+		204, 204, 204, 204, 203, 203, 203, 203, 203, 203,
+		203, 202, 202, 202, 202, 202, 202, 202, 202, 201,
+		201, 201, 201, 201, 201, 201, 201, 200, 200, 200,
+		200, 200, 200, 200, 200, 199, 199, 199, 199, 199,
+		199, 199, 198, 198, 198, 198, 198, 198, 198, 198,
+		197, 197, 197, 197, 197, 197, 197, 197, 197, 196,
+		196, 196, 196, 196, 196, 196, 196, 195, 195, 195,
+		195, 195, 195, 195, 195, 194, 194, 194, 194, 194,
+		194, 194, 194, 194, 193, 193, 193, 193, 193, 193,
+		193, 193, 192, 192, 192, 192, 192, 192, 192, 192,
+		192, 191, 191, 191, 191, 191, 191, 191, 191, 191,
+		190, 190, 190, 190, 190, 190, 190, 190, 190, 189,
+		189, 189, 189, 189, 189, 189, 189, 189, 188, 188,
+		188, 188, 188, 188, 188, 188, 188, 188, 187, 187,
+		187, 187, 187, 187, 187, 187, 187, 186, 186, 186,
+		186, 186, 186, 186, 186, 186, 186, 185, 185, 185,
+		185, 185, 185, 185, 185, 185, 185, 184, 184, 184,
+		184, 184, 184, 184, 184, 184, 184, 183, 183, 183,
+		183, 183, 183, 183, 183, 183, 183, 182, 182, 182,
+		182, 182, 182, 182, 182, 182, 182, 181, 181, 181,
+		181, 181, 181, 181, 181, 181, 181, 181, 180, 180,
+		180, 180, 180, 180, 180, 180, 180, 180, 179, 179,
+		179, 179, 179, 179, 179, 179, 179, 179, 179, 178,
+		178, 178, 178, 178, 178, 178, 178, 178, 178, 178,
+		177, 177, 177, 177, 177, 177, 177, 177, 177, 177,
+		177, 176, 176, 176, 176, 176, 176, 176, 176, 176,
+		176, 176, 176, 175, 175, 175, 175, 175, 175, 175,
+	} },
+};
+
+#endif /* _ACCEL_H_ */
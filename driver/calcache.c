@@ -0,0 +1,309 @@
+/* Persistent calibration cache
+ *
+ * Copyright (C) 2010 Andreas Robinson <andr345 at gmail dot com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+/* Calibration results are kept in a memory-mapped file, so that they
+ * survive sane_close() and can be shared between processes.
+ *
+ * The file is a header followed by CAL_CACHE_SLOTS fixed-size slots.
+ * Each slot holds one calibration_info key and data, followed by room
+ * for CAL_CACHE_MAX_SC bytes of shading correction. The file is sparse
+ * until the slots are used.
+ *
+ * A calibration is valid for CAL_MAX_AGE seconds, and for
+ * CAL_MAX_LAMP_TIME seconds of lamp time. The header counts the lamp
+ * time; each slot records the count when it was stored.
+ *
+ * Updates are serialized with flock().
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <libusb-1.0/libusb.h>
+#include <sane/sane.h>
+
+#include "low.h"
+#include "util.h"
+#include "calcache.h"
+
+#define CAL_MAGIC "GL843CAL"
+
+struct cal_file_header
+{
+	char magic[8];		/* CAL_MAGIC */
+	uint32_t version;	/* CAL_CACHE_VERSION */
+	uint32_t nslots;	/* CAL_CACHE_SLOTS */
+	uint32_t slot_size;	/* Bytes per slot */
+	uint32_t reserved;
+	uint64_t lamp_time;	/* Accumulated lamp time [s] */
+};
+
+struct cal_file_slot
+{
+	uint32_t used;
+
+	/* Key */
+
+	int32_t source;
+	float cal_y_pos;
+	int32_t start_x;
+	int32_t width;
+	int32_t dpi;
+
+	/* Validity */
+
+	int64_t time;		/* When stored [s since the epoch] */
+	uint64_t lamp_time;	/* Header lamp_time when stored */
+
+	/* Data */
+
+	uint8_t offset[3];
+	uint8_t sc_valid;
+	float gain[3];
+	uint32_t sc_len;	/* Bytes of shading correction after this */
+};
+
+#define SLOT_SIZE (sizeof(struct cal_file_slot) + CAL_CACHE_MAX_SC)
+
+struct cal_cache
+{
+	int fd;
+	uint8_t *map;
+	size_t size;
+	struct cal_file_header *hdr;
+};
+
+static struct cal_file_slot *get_slot(struct cal_cache *cc, int i)
+{
+	return (struct cal_file_slot *) (cc->map + sizeof(*cc->hdr)
+		+ (size_t) i * SLOT_SIZE);
+}
+
+static int same_key(const struct cal_file_slot *s,
+		    const struct calibration_info *cal)
+{
+	return s->used
+		&& s->source == (int32_t) cal->source
+		&& s->cal_y_pos == cal->cal_y_pos
+		&& s->start_x == cal->start_x
+		&& s->width == cal->width
+		&& s->dpi == cal->dpi;
+}
+
+/* Get the cache file name. Returns a malloc'ed string, or NULL. */
+static char *get_cache_path(const char *name)
+{
+	const char *s;
+	char *path = NULL;
+
+	s = getenv("GL843_CALIBRATION_FILE");
+	if (s)
+		return strdup(s);
+
+	s = getenv("HOME");
+	if (!s)
+		return NULL;
+	if (asprintf(&path, "%s/.sane", s) < 0)
+		return NULL;
+	mkdir(path, 0755);	/* Ok if it exists */
+	free(path);
+	if (asprintf(&path, "%s/.sane/gl843-%s.cal", s, name) < 0)
+		return NULL;
+	return path;
+}
+
+struct cal_cache *open_cal_cache(const char *name)
+{
+	struct cal_cache *cc;
+	struct stat st;
+	char *path;
+	void *p;
+
+	CHK_MEM(cc = calloc(sizeof(*cc), 1));
+	cc->fd = -1;
+	cc->size = sizeof(*cc->hdr) + CAL_CACHE_SLOTS * SLOT_SIZE;
+
+	path = get_cache_path(name);
+	if (!path)
+		goto chk_mem_failed;
+	cc->fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (cc->fd < 0) {
+		DBG(DBG_warn, "Can't open %s. Calibrations won't be "
+			"saved.\n", path);
+		free(path);
+		goto chk_mem_failed;
+	}
+	DBG(DBG_info, "calibration cache: %s\n", path);
+	free(path);
+
+	flock(cc->fd, LOCK_EX);
+	if (fstat(cc->fd, &st) < 0 || (size_t) st.st_size != cc->size) {
+		if (ftruncate(cc->fd, 0) < 0
+				|| ftruncate(cc->fd, cc->size) < 0)
+			goto unlock;
+	}
+	p = mmap(NULL, cc->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		cc->fd, 0);
+	if (p == MAP_FAILED)
+		goto unlock;
+	cc->map = p;
+	cc->hdr = p;
+
+	/* Start over if the file is new, or of another version */
+	if (memcmp(cc->hdr->magic, CAL_MAGIC, 8) != 0
+			|| cc->hdr->version != CAL_CACHE_VERSION
+			|| cc->hdr->nslots != CAL_CACHE_SLOTS
+			|| cc->hdr->slot_size != SLOT_SIZE) {
+		DBG(DBG_info, "initializing calibration cache.\n");
+		memset(cc->map, 0, cc->size);
+		memcpy(cc->hdr->magic, CAL_MAGIC, 8);
+		cc->hdr->version = CAL_CACHE_VERSION;
+		cc->hdr->nslots = CAL_CACHE_SLOTS;
+		cc->hdr->slot_size = SLOT_SIZE;
+		msync(cc->map, cc->size, MS_ASYNC);
+	}
+	flock(cc->fd, LOCK_UN);
+	return cc;
+
+unlock:
+	DBG(DBG_warn, "Can't map the calibration cache.\n");
+	flock(cc->fd, LOCK_UN);
+chk_mem_failed:
+	close_cal_cache(cc);
+	return NULL;
+}
+
+void close_cal_cache(struct cal_cache *cc)
+{
+	if (!cc)
+		return;
+	if (cc->map)
+		munmap(cc->map, cc->size);
+	if (cc->fd >= 0)
+		close(cc->fd);
+	free(cc);
+}
+
+int load_calibration(struct cal_cache *cc, struct calibration_info *cal)
+{
+	int i, found = 0;
+	int64_t age;
+	uint64_t lamp;
+	struct cal_file_slot *s = NULL;
+
+	if (!cc)
+		return 0;
+
+	flock(cc->fd, LOCK_SH);
+	for (i = 0; i < CAL_CACHE_SLOTS; i++) {
+		s = get_slot(cc, i);
+		if (same_key(s, cal))
+			break;
+	}
+	if (i == CAL_CACHE_SLOTS)
+		goto done;
+
+	age = (int64_t) time(NULL) - s->time;
+	lamp = cc->hdr->lamp_time - s->lamp_time;
+	if (age < 0 || age > CAL_MAX_AGE) {
+		DBG(DBG_info, "cached calibration is too old (%lld s).\n",
+			(long long) age);
+		goto done;
+	}
+	if (lamp > CAL_MAX_LAMP_TIME) {
+		DBG(DBG_info, "cached calibration is too old (%llu s lamp "
+			"time).\n", (unsigned long long) lamp);
+		goto done;
+	}
+
+	memcpy(cal->offset, s->offset, sizeof(cal->offset));
+	memcpy(cal->gain, s->gain, sizeof(cal->gain));
+	cal->sc_valid = 0;
+	if (s->sc_valid && s->sc_len == cal->sc_len) {
+		memcpy(cal->sc, s + 1, cal->sc_len);
+		cal->sc_valid = 1;
+	}
+	found = 1;
+	DBG(DBG_msg, "Using calibration from %lld s ago.\n", (long long) age);
+done:
+	flock(cc->fd, LOCK_UN);
+	return found;
+}
+
+void store_calibration(struct cal_cache *cc,
+		       const struct calibration_info *cal)
+{
+	int i, victim = 0;
+	struct cal_file_slot *s;
+
+	if (!cc)
+		return;
+
+	flock(cc->fd, LOCK_EX);
+
+	/* Same key, or else an unused slot, or else the oldest */
+	for (i = 0; i < CAL_CACHE_SLOTS; i++) {
+		s = get_slot(cc, i);
+		if (same_key(s, cal)) {
+			victim = i;
+			break;
+		}
+		if (!s->used)
+			victim = i;
+		else if (get_slot(cc, victim)->used
+				&& s->time < get_slot(cc, victim)->time)
+			victim = i;
+	}
+
+	s = get_slot(cc, victim);
+	memset(s, 0, sizeof(*s));
+	s->source = cal->source;
+	s->cal_y_pos = cal->cal_y_pos;
+	s->start_x = cal->start_x;
+	s->width = cal->width;
+	s->dpi = cal->dpi;
+	s->time = time(NULL);
+	s->lamp_time = cc->hdr->lamp_time;
+	memcpy(s->offset, cal->offset, sizeof(s->offset));
+	memcpy(s->gain, cal->gain, sizeof(s->gain));
+	if (cal->sc_valid && cal->sc_len <= CAL_CACHE_MAX_SC) {
+		memcpy(s + 1, cal->sc, cal->sc_len);
+		s->sc_len = cal->sc_len;
+		s->sc_valid = 1;
+	}
+	s->used = 1;
+	msync(cc->map, cc->size, MS_ASYNC);
+
+	flock(cc->fd, LOCK_UN);
+	DBG(DBG_info, "stored calibration in slot %d.\n", victim);
+}
+
+void add_lamp_time(struct cal_cache *cc, unsigned int seconds)
+{
+	if (!cc)
+		return;
+	flock(cc->fd, LOCK_EX);
+	cc->hdr->lamp_time += seconds;
+	flock(cc->fd, LOCK_UN);
+}
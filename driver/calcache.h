@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2010 Andreas Robinson <andr345 at gmail dot com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#ifndef _CALCACHE_H_
+#define _CALCACHE_H_
+
+#include "scan.h"
+
+#define CAL_CACHE_VERSION 2
+#define CAL_CACHE_SLOTS 16		/* Calibrations in the file */
+#define CAL_CACHE_MAX_SC (128 << 10)	/* Max shading bytes per slot */
+#define CAL_MAX_AGE (7 * 24 * 3600)	/* Max calibration age [s] */
+#define CAL_MAX_LAMP_TIME (20 * 3600)	/* Max lamp time since [s] */
+
+struct cal_cache;
+
+/* Open or create the calibration cache file for a scanner model.
+ *
+ * The file is $GL843_CALIBRATION_FILE if set, otherwise
+ * ~/.sane/gl843-<name>.cal. A file of another version is discarded.
+ *
+ * Returns NULL if the file can't be opened. Calibration works without
+ * the cache, so callers can ignore this.
+ */
+struct cal_cache *open_cal_cache(const char *name);
+void close_cal_cache(struct cal_cache *cc);
+
+/* Look up the calibration with the key in cal, and fill in the data.
+ * Returns 1 if a valid calibration was found, 0 if not.
+ */
+int load_calibration(struct cal_cache *cc, struct calibration_info *cal);
+
+/* Store cal, replacing any calibration with the same key,
+ * or else the oldest one.
+ */
+void store_calibration(struct cal_cache *cc,
+		       const struct calibration_info *cal);
+
+/* Add to the lamp time. Calibrations older than CAL_MAX_LAMP_TIME
+ * in lamp time are not used. */
+void add_lamp_time(struct cal_cache *cc, unsigned int seconds);
+
+#endif /* _CALCACHE_H_ */
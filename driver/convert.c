@@ -22,29 +22,433 @@
 #include "util.h"
 #include "convert.h"
 
-#define CONVERT_INTERNAL
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+/* Converter kernels. There is a scalar set, and SIMD sets that are
+ * selected at runtime if the CPU supports them. The SIMD kernels only
+ * handle 3-component (RGB) pixels and must give bit-exact results.
+ */
+struct convert_kernels
+{
+	const char *name;
+
+	/* Swap the byte order of n 16-bit components. dst may equal src. */
+	void (*swap16)(uint8_t *dst, const uint8_t *src, size_t n);
+
+	/* Assemble 3-component pixels: byte i of component c is taken
+	 * from src[c]. nbytes is a whole number of pixels.
+	 * bps: bytes per component, 1 or 2. */
+	void (*blend3)(uint8_t *dst, const uint8_t *const *src,
+		       size_t nbytes, int bps);
+
+	/* Move component c of each pixel to position pconv->order[c],
+	 * in place. */
+	void (*reorder3)(struct pixel_converter *pconv,
+			 uint8_t *buf, size_t npixels);
+
+	/* Look up n 16-bit components of 3-component pixels in lut,
+	 * in place. n is a whole number of pixels. See create_gamma_lut(). */
+	void (*lut3)(uint8_t *buf, size_t n, const uint16_t *lut);
+};
+
+static void swap16_c(uint8_t *dst, const uint8_t *src, size_t n)
+{
+	size_t i;
+	uint8_t lo;
 
-static uint16_t my_bswap_16(uint16_t x) {
-	return (x >> 8) | (x << 8);
+	for (i = 0; i < 2*n; i += 2) {
+		lo = src[i];
+		dst[i] = src[i+1];
+		dst[i+1] = lo;
+	}
 }
 
-/* define convert8() */
-#define CONVERT convert8
-#define CTYPE uint8_t
-#define BSWAP(x) (x)
-#include "convert.h"
+static void blend_c(uint8_t *dst, const uint8_t *const *src,
+		    size_t nbytes, int bps, int ncomp)
+{
+	size_t i;
+	int b = 0, c = 0;
 
-/* define convert16() */
-#define CONVERT convert16
-#define CTYPE uint16_t
-#define BSWAP(x) (x)
-#include "convert.h"
+	for (i = 0; i < nbytes; i++) {
+		dst[i] = src[c][i];
+		if (++b == bps) {
+			b = 0;
+			if (++c == ncomp)
+				c = 0;
+		}
+	}
+}
 
-/* define convert16_swap() */
-#define CONVERT convert16_swap
-#define CTYPE uint16_t
-#define BSWAP(x) my_bswap_16(x)
-#include "convert.h"
+static void blend3_c(uint8_t *dst, const uint8_t *const *src,
+		     size_t nbytes, int bps)
+{
+	blend_c(dst, src, nbytes, bps, 3);
+}
+
+static void reorder_c(struct pixel_converter *pconv,
+		      uint8_t *buf, size_t npixels)
+{
+	size_t i;
+	int c;
+	int bps = pconv->depth / 8;
+	int psize = pconv->ncomp * bps;
+	uint8_t tmp[CONVERT_MAX_COMP * 2];
+
+	for (i = 0; i < npixels; i++, buf += psize) {
+		memcpy(tmp, buf, psize);
+		for (c = 0; c < pconv->ncomp; c++)
+			memcpy(buf + pconv->order[c] * bps, tmp + c * bps, bps);
+	}
+}
+
+static void lut_c(uint8_t *buf, size_t n, const uint16_t *lut, int ncomp)
+{
+	size_t i;
+	int c = 0;
+	uint16_t v;
+
+	for (i = 0; i < 2*n; i += 2) {
+		memcpy(&v, buf + i, 2);
+		v = lut[(c << 16) + v];
+		memcpy(buf + i, &v, 2);
+		if (++c == ncomp)
+			c = 0;
+	}
+}
+
+static void lut3_c(uint8_t *buf, size_t n, const uint16_t *lut)
+{
+	lut_c(buf, n, lut, 3);
+}
+
+static const struct convert_kernels kernels_c = {
+	"scalar", swap16_c, blend3_c, reorder_c, lut3_c
+};
+
+#ifdef HAVE_X86_KERNELS
+
+/* blend_mask[bps-1][c][i] is 0xff if byte i belongs to component c.
+ * The pattern repeats every 96 bytes, i.e every three AVX2 vectors
+ * and every six SSE2 vectors. */
+static uint8_t blend_mask[2][3][96] __attribute__ ((aligned(32)));
+
+static void init_blend_masks(void)
+{
+	int bps, c, i;
+
+	for (bps = 1; bps <= 2; bps++) {
+		for (c = 0; c < 3; c++) {
+			for (i = 0; i < 96; i++) {
+				blend_mask[bps-1][c][i] =
+					((i / bps) % 3 == c) ? 0xff : 0;
+			}
+		}
+	}
+}
+
+__attribute__ ((target("sse2")))
+static void swap16_sse2(uint8_t *dst, const uint8_t *src, size_t n)
+{
+	size_t i;
+	__m128i v;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		v = _mm_loadu_si128((const __m128i *) (src + 2*i));
+		v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+		_mm_storeu_si128((__m128i *) (dst + 2*i), v);
+	}
+	swap16_c(dst + 2*i, src + 2*i, n - i);
+}
+
+__attribute__ ((target("sse2")))
+static void blend3_sse2(uint8_t *dst, const uint8_t *const *src,
+			size_t nbytes, int bps)
+{
+	size_t i, j;
+	const uint8_t *m0 = blend_mask[bps-1][0];
+	const uint8_t *m1 = blend_mask[bps-1][1];
+	const uint8_t *m2 = blend_mask[bps-1][2];
+	const uint8_t *tail[3];
+	__m128i a, b, c;
+
+	for (i = 0; i + 48 <= nbytes; i += 48) {
+		for (j = 0; j < 48; j += 16) {
+			a = _mm_and_si128(
+				_mm_loadu_si128((const __m128i *) (src[0] + i + j)),
+				_mm_load_si128((const __m128i *) (m0 + j)));
+			b = _mm_and_si128(
+				_mm_loadu_si128((const __m128i *) (src[1] + i + j)),
+				_mm_load_si128((const __m128i *) (m1 + j)));
+			c = _mm_and_si128(
+				_mm_loadu_si128((const __m128i *) (src[2] + i + j)),
+				_mm_load_si128((const __m128i *) (m2 + j)));
+			_mm_storeu_si128((__m128i *) (dst + i + j),
+				_mm_or_si128(_mm_or_si128(a, b), c));
+		}
+	}
+	tail[0] = src[0] + i;
+	tail[1] = src[1] + i;
+	tail[2] = src[2] + i;
+	blend3_c(dst + i, tail, nbytes - i, bps);
+}
+
+__attribute__ ((target("avx2")))
+static void swap16_avx2(uint8_t *dst, const uint8_t *src, size_t n)
+{
+	size_t i;
+	__m256i v;
+
+	for (i = 0; i + 16 <= n; i += 16) {
+		v = _mm256_loadu_si256((const __m256i *) (src + 2*i));
+		v = _mm256_or_si256(_mm256_slli_epi16(v, 8),
+				    _mm256_srli_epi16(v, 8));
+		_mm256_storeu_si256((__m256i *) (dst + 2*i), v);
+	}
+	swap16_c(dst + 2*i, src + 2*i, n - i);
+}
+
+__attribute__ ((target("avx2")))
+static void blend3_avx2(uint8_t *dst, const uint8_t *const *src,
+			size_t nbytes, int bps)
+{
+	size_t i, j;
+	const uint8_t *m0 = blend_mask[bps-1][0];
+	const uint8_t *m1 = blend_mask[bps-1][1];
+	const uint8_t *m2 = blend_mask[bps-1][2];
+	const uint8_t *tail[3];
+	__m256i a, b, c;
+
+	for (i = 0; i + 96 <= nbytes; i += 96) {
+		for (j = 0; j < 96; j += 32) {
+			a = _mm256_and_si256(
+				_mm256_loadu_si256((const __m256i *) (src[0] + i + j)),
+				_mm256_load_si256((const __m256i *) (m0 + j)));
+			b = _mm256_and_si256(
+				_mm256_loadu_si256((const __m256i *) (src[1] + i + j)),
+				_mm256_load_si256((const __m256i *) (m1 + j)));
+			c = _mm256_and_si256(
+				_mm256_loadu_si256((const __m256i *) (src[2] + i + j)),
+				_mm256_load_si256((const __m256i *) (m2 + j)));
+			_mm256_storeu_si256((__m256i *) (dst + i + j),
+				_mm256_or_si256(_mm256_or_si256(a, b), c));
+		}
+	}
+	tail[0] = src[0] + i;
+	tail[1] = src[1] + i;
+	tail[2] = src[2] + i;
+	blend3_c(dst + i, tail, nbytes - i, bps);
+}
+
+/* Reorder 5 (8-bit) or 2 (16-bit) pixels per 128-bit lane, with the
+ * lanes loaded 15 or 12 bytes apart. The last bytes of each lane are
+ * passed through unchanged, and are rewritten by the following lane. */
+__attribute__ ((target("avx2")))
+static void reorder3_avx2(struct pixel_converter *pconv,
+			  uint8_t *buf, size_t npixels)
+{
+	size_t i;
+	int bps = pconv->depth / 8;
+	size_t step = (bps == 1) ? 15 : 12;
+	size_t nbytes = npixels * 3 * bps;
+	__m128i lo, hi;
+	__m256i v, shuf;
+
+	shuf = _mm256_broadcastsi128_si256(
+		_mm_loadu_si128((const __m128i *) pconv->shuf));
+
+	for (i = 0; i + step + 16 <= nbytes; i += 2 * step) {
+		lo = _mm_loadu_si128((const __m128i *) (buf + i));
+		hi = _mm_loadu_si128((const __m128i *) (buf + i + step));
+		v = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+		v = _mm256_shuffle_epi8(v, shuf);
+		_mm_storeu_si128((__m128i *) (buf + i),
+			_mm256_castsi256_si128(v));
+		_mm_storeu_si128((__m128i *) (buf + i + step),
+			_mm256_extracti128_si256(v, 1));
+	}
+	reorder_c(pconv, buf + i, (nbytes - i) / (3 * bps));
+}
+
+/* Gather 8 components at a time. The component pattern repeats every
+ * 24 components, i.e every three vectors. The gather reads 32 bits, so
+ * the lut must have one entry of padding at the end. */
+__attribute__ ((target("avx2")))
+static void lut3_avx2(uint8_t *buf, size_t n, const uint16_t *lut)
+{
+	size_t i;
+	int j;
+	int32_t base[24];
+	__m256i v, off[3];
+	const __m256i mask = _mm256_set1_epi32(0xffff);
+
+	for (j = 0; j < 24; j++)
+		base[j] = (j % 3) << 16;
+	for (j = 0; j < 3; j++)
+		off[j] = _mm256_loadu_si256((const __m256i *) (base + 8*j));
+
+	for (i = 0; i + 24 <= n; i += 24) {
+		for (j = 0; j < 3; j++) {
+			v = _mm256_cvtepu16_epi32(_mm_loadu_si128(
+				(const __m128i *) (buf + 2*(i + 8*j))));
+			v = _mm256_i32gather_epi32((const int *) lut,
+				_mm256_add_epi32(v, off[j]), 2);
+			v = _mm256_and_si256(v, mask);
+			v = _mm256_permute4x64_epi64(
+				_mm256_packus_epi32(v, v), 0x08);
+			_mm_storeu_si128((__m128i *) (buf + 2*(i + 8*j)),
+				_mm256_castsi256_si128(v));
+		}
+	}
+	lut_c(buf + 2*i, n - i, lut, 3);
+}
+
+static const struct convert_kernels kernels_sse2 = {
+	"sse2", swap16_sse2, blend3_sse2, reorder_c, lut3_c
+};
+
+static const struct convert_kernels kernels_avx2 = {
+	"avx2", swap16_avx2, blend3_avx2, reorder3_avx2, lut3_avx2
+};
+
+#endif /* HAVE_X86_KERNELS */
+
+/* Pick the fastest kernels the CPU supports */
+static const struct convert_kernels *select_kernels(void)
+{
+#ifdef HAVE_X86_KERNELS
+	init_blend_masks();
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return &kernels_avx2;
+	if (__builtin_cpu_supports("sse2"))
+		return &kernels_sse2;
+#endif
+	return &kernels_c;
+}
+
+/* Advance the converter to the next line in the ring */
+static void next_line(struct pixel_converter *pconv)
+{
+	int c;
+
+	if (++pconv->wr == pconv->nlines)
+		pconv->wr = 0;
+	for (c = 0; c < pconv->ncomp; c++) {
+		if (++pconv->rd[c] == pconv->nlines)
+			pconv->rd[c] = 0;
+	}
+	if (pconv->skip > 0)
+		pconv->skip--;
+	pconv->x = 0;
+}
+
+static size_t convert_to(struct pixel_converter *pconv,
+			 uint8_t *dst,
+			 const uint8_t *src,
+			 size_t count)
+{
+	int c;
+	size_t seg, N = 0;
+	uint8_t *wp;
+	const uint8_t *line[CONVERT_MAX_COMP];
+	const struct convert_kernels *k = pconv->k;
+	const int ncomp = pconv->ncomp;
+	const int bps = pconv->depth / 8;
+	const size_t psize = ncomp * bps;		/* Bytes per pixel */
+	const size_t stride = pconv->width * psize;	/* Bytes per line */
+
+	/* Nothing to delay or reorder */
+	if (ncomp == 1) {
+		if (pconv->swap)
+			k->swap16(dst, src, count);
+		else if (dst != src)
+			memcpy(dst, src, count * psize);
+		if (pconv->lut)
+			lut_c(dst, count, pconv->lut, 1);
+		return count;
+	}
+
+	while (count > 0) {
+
+		/* Process up to the end of the current line */
+
+		seg = pconv->width - pconv->x;
+		if (seg > count)
+			seg = count;
+
+		/* Store the pixels in the ring, swapping byte order if needed */
+
+		wp = pconv->buf + pconv->wr * stride + pconv->x * psize;
+		if (pconv->swap)
+			k->swap16(wp, src, seg * ncomp);
+		else
+			memcpy(wp, src, seg * psize);
+		src += seg * psize;
+
+		/* Assemble pixels from the delayed lines, once the
+		 * delay has passed. */
+
+		if (pconv->skip == 0) {
+			for (c = 0; c < ncomp; c++) {
+				line[c] = pconv->buf + pconv->rd[c] * stride
+					+ pconv->x * psize;
+			}
+			if (ncomp == 3)
+				k->blend3(dst, line, seg * psize, bps);
+			else
+				blend_c(dst, line, seg * psize, bps, ncomp);
+
+			if (pconv->reorder && ncomp == 3)
+				k->reorder3(pconv, dst, seg);
+			else if (pconv->reorder)
+				reorder_c(pconv, dst, seg);
+
+			if (pconv->lut && ncomp == 3)
+				k->lut3(dst, seg * ncomp, pconv->lut);
+			else if (pconv->lut)
+				lut_c(dst, seg * ncomp, pconv->lut, ncomp);
+
+			dst += seg * psize;
+			N += seg;
+		}
+
+		pconv->x += seg;
+		count -= seg;
+		if (pconv->x == pconv->width)
+			next_line(pconv);
+	}
+
+	return N;
+}
+
+static size_t convert(struct pixel_converter *pconv,
+		      uint8_t *pixels,
+		      size_t count)
+{
+	return convert_to(pconv, pixels, pixels, count);
+}
+
+/* Build the byte shuffle for reorder3_avx2() */
+static void build_shuffle(struct pixel_converter *pconv)
+{
+	int i, p, c, b;
+	int bps = pconv->depth / 8;
+	int npx = (bps == 1) ? 5 : 2;	/* Pixels per 16 bytes */
+
+	for (i = 0; i < 16; i++)
+		pconv->shuf[i] = i;
+	for (p = 0; p < npx; p++) {
+		for (c = 0; c < 3; c++) {
+			for (b = 0; b < bps; b++) {
+				pconv->shuf[(p*3 + pconv->order[c]) * bps + b]
+					= (p*3 + c) * bps + b;
+			}
+		}
+	}
+}
 
 /* Convert between host and scanner endianness,
  * reorder pixel color components (e.g BGR to RGB),
@@ -52,132 +456,130 @@ static uint16_t my_bswap_16(uint16_t x) {
  *
  * depth:  Number of bits per pixel component (a.k.a channel), 8 or 16.
  * ncomp:  Number of components per pixel, e.g 3 for RGB.
+ *         At most CONVERT_MAX_COMP.
+ * width:  Number of pixels per line.
  * shift:  List of pixel component shifts. List length is given by ncomp.
- *         Incoming pixel component i will be delayed for shift[i] pixels.
- *         The unit of the offset values are "number of components".
+ *         Incoming pixel component i will be delayed for shift[i] lines.
  * order:  List of pixel component ordering.
  *         {2,1,0} will reorder BGR to RGB (or vice versa), {0,1,2} does nothing.
  * se:     scanner endianness: 1 = little endian, 2 = big endian
+ *
+ * The converter keeps a ring of max(shift) + 1 lines. Output line n is
+ * assembled from component i of input line n - shift[i], so the first
+ * max(shift) lines are consumed without returning any pixels.
  */
 struct pixel_converter *create_pixel_converter(int depth,
 					       int ncomp,
+					       int width,
 					       int *shift,
 					       int *order,
 					       int se)
 {
 	int i;
-	int numpixels;	/* Number of pixels in buffer */
+	int nlines;	/* Number of lines in the ring */
 	struct pixel_converter *pconv;
 
 	CHK_MEM(pconv = calloc(sizeof(*pconv), 1));
-	CHK_MEM(pconv->wr = calloc(sizeof(*(pconv->wr)) * ncomp, 1));
-
-	if (depth == 8) {
-		pconv->convert = convert8;
-	} else if (depth == 16) {
-		pconv->convert = (native_endianness() != se)
-			? convert16_swap : convert16;
-	} else {
+
+	if (depth != 8 && depth != 16) {
 		DBG(DBG_error0, "BUG: unsupported pixel depth\n");
 		goto chk_mem_failed;
 	}
+	if (ncomp < 1 || ncomp > CONVERT_MAX_COMP) {
+		DBG(DBG_error0, "BUG: unsupported number of components\n");
+		goto chk_mem_failed;
+	}
+
+	pconv->convert = convert;
+	pconv->convert_to = convert_to;
+	pconv->k = select_kernels();
+	pconv->swap = (depth == 16 && native_endianness() != se);
 
-	numpixels = 1;
-	pconv->wr[0] = 0; /* Ignore shift[] and order[] when ncomp == 1 */
+	nlines = 1;
+	pconv->rd[0] = 0; /* Ignore shift[] and order[] when ncomp == 1 */
+	pconv->order[0] = 0;
 	if (ncomp > 1) {
 		for (i = 0; i < ncomp; i++) {
-			if (shift[i] > numpixels)
-				numpixels = shift[i];
+			if (shift[i] + 1 > nlines)
+				nlines = shift[i] + 1;
 		}
-		numpixels++;
 		for (i = 0; i < ncomp; i++) {
-			pconv->wr[i] = (ncomp * shift[i] + order[i]) % (numpixels * ncomp);
+			pconv->rd[i] = (nlines - shift[i]) % nlines;
+			pconv->order[i] = order[i];
+			if (order[i] != i)
+				pconv->reorder = 1;
 		}
 	}
-	DBG(DBG_msg, "numpixels = %d, ncomp = %d, depth = %d\n",
-		numpixels, ncomp, depth);
-	for (i = 0; i < ncomp; i++) {
-		DBG(DBG_msg, "wr[%d] = %d\n", i, pconv->wr[i]);
-	}
 
-	pconv->sdelay = -numpixels + 1;
-	pconv->rd = (numpixels - 1) * ncomp;
+	pconv->skip = nlines - 1;
+	pconv->wr = 0;
+	pconv->x = 0;
 
 	pconv->ncomp = ncomp;
 	pconv->depth = depth;
-	pconv->numpixels = numpixels;
+	pconv->width = width;
+	pconv->nlines = nlines;
+
+	if (ncomp == 3)
+		build_shuffle(pconv);
 
-	CHK_MEM(pconv->buf = calloc(numpixels * ncomp * depth / 8, 1));
+	DBG(DBG_msg, "nlines = %d, width = %d, ncomp = %d, depth = %d, "
+		"kernels = %s\n", nlines, width, ncomp, depth, pconv->k->name);
+	for (i = 0; i < ncomp; i++) {
+		DBG(DBG_msg, "rd[%d] = %d\n", i, pconv->rd[i]);
+	}
+
+	if (ncomp > 1) {
+		CHK_MEM(pconv->buf = calloc((size_t) nlines * width
+			* ncomp * depth / 8, 1));
+	}
 
 	return pconv;
 
 chk_mem_failed:
 	destroy_pixel_converter(pconv);
 	return NULL;
-}	
+}
 
 void destroy_pixel_converter(struct pixel_converter *pconv)
 {
 	if (pconv) {
-		free(pconv->wr);
 		free(pconv->buf);
+		free(pconv->lut);
 	}
 	free (pconv);
 }
 
-#if 0
-
-/* Converter unit test */
-
-#include <stdio.h>
-
-void dump_buf(void *p, int n)
-{
-	int i, j = 0;
-	uint16_t *buf = p;
-	for (i = 0; i < n; i += 3) {
-		printf("%04x %04x %04x    ", buf[i], buf[i+1], buf[i+2]);
-		j++;
-		if (j == 5) {
-			j = 0;
-			printf("\n");
-		}
-	}
-	printf("\n");
-}
-
-int main()
+/* Expand gamma tables to 16-bit lookup tables, for pixel_converter.lut.
+ *
+ * gamma: one table per component, len entries in the range 0 - 65535
+ * ncomp: number of components
+ * len:   number of entries per table, at least 2
+ *
+ * Values between the table entries are interpolated linearly.
+ * Returns a malloc'ed table with 65536 entries per component,
+ * plus padding for the SIMD kernels, or NULL if out of memory.
+ */
+uint16_t *create_gamma_lut(const int *const *gamma, int ncomp, int len)
 {
-	const int N = 85;
-	int i,j,m;
-	uint16_t buf[N*3];
-	int shift[3] = {20, 10, 0};
-	int order[3] = {0, 1, 2};
-	struct pixel_converter *pconv;
+	int c;
+	uint32_t v, i, f;
+	int64_t a, b, y;
+	uint16_t *lut;
 
-	memset(buf, 0xff, N*3);
+	lut = calloc((size_t) ncomp * 65536 + 2, sizeof(*lut));
+	if (!lut)
+		return NULL;
 
-	for (i = 0, j = 0; i < N*3; i += 3) {
-		if (i % 15 == 0)
-			j += 0x10;
-		buf[i] = j+1;
-	}
-	for (i = 30, j = 0; i < N*3; i += 3) {
-		if (i % 15 == 0)
-			j += 0x10;
-		buf[i+1] = j+2;
-	}
-	for (i = 60, j = 0; i < N*3; i += 3) {
-		if (i % 15 == 0)
-			j += 0x10;
-		buf[i+2] = j+3;
+	for (c = 0; c < ncomp; c++) {
+		for (v = 0; v < 65536; v++) {
+			i = (uint64_t) v * (len - 1) / 65535;
+			f = (uint64_t) v * (len - 1) % 65535;
+			a = gamma[c][i];
+			b = gamma[c][(int) i + 1 < len ? i + 1 : i];
+			y = (a * (65535 - f) + b * f + 32767) / 65535;
+			lut[(c << 16) + v] = min(max(y, 0), 65535);
+		}
 	}
-
-	dump_buf(buf, N*3);
-	pconv = create_pixel_converter(16, 3, shift, order, 1);
-	m = pconv->convert(pconv, (uint8_t *)buf, N);
-	dump_buf(buf, m*3);
-	return 0;
+	return lut;
 }
-#endif
-
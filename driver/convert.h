@@ -13,20 +13,32 @@
  * Lesser General Public License for more details.
  */
 
-#ifndef CONVERT_INTERNAL
-
 #ifndef _CONVERT_H_
 #define _CONVERT_H_
 
+/* Max number of color components per pixel */
+#define CONVERT_MAX_COMP 4
+
+struct convert_kernels;
+
 struct pixel_converter
 {
-	uint8_t *buf;	/* Circular pixel buffer */
-	int numpixels;	/* Buffer capacity [number pixels] */
+	uint8_t *buf;	/* Ring of scan lines */
+	int width;	/* Pixels per line */
+	int nlines;	/* Ring capacity [lines] */
 	int depth;	/* Number of bits per color component */
 	int ncomp;	/* Number of color components per pixel, */
-	int *wr;	/* List of write offsets. Has ncomp elements. */
-	int rd;		/* Read offset  */
-	int sdelay;	/* Number of pixels to wait before returning data */
+	int swap;	/* 1 = swap the byte order of 16-bit components */
+	int wr;		/* Ring line being written */
+	int rd[CONVERT_MAX_COMP];	/* Ring line each component is read from */
+	int order[CONVERT_MAX_COMP];	/* Output position of each component */
+	int reorder;	/* 1 = order[] is not the identity */
+	uint8_t shuf[16];	/* order[] as a byte shuffle, for SIMD kernels */
+	int x;		/* Pixel position in the current line */
+	int skip;	/* Number of lines to wait before returning data */
+	const struct convert_kernels *k;	/* Kernels used by convert() */
+	uint16_t *lut;	/* 16-bit gamma lookup table, or NULL. Freed with
+			 * the converter. See create_gamma_lut(). */
 
 	/* Pixel converter method. Convert given pixels in-place.
 	 * buf:   pixels to convert
@@ -35,60 +47,17 @@ struct pixel_converter
 	 * Note: may return less than 'count' pixels, including none.
 	 */
 	size_t (*convert)(struct pixel_converter *, uint8_t *buf, size_t count);
+
+	/* Like convert(), but reads the pixels from src and writes the
+	 * result to dst. dst may equal src, otherwise they must not overlap.
+	 */
+	size_t (*convert_to)(struct pixel_converter *, uint8_t *dst,
+		const uint8_t *src, size_t count);
 };
 
-struct pixel_converter *create_pixel_converter(
-	int depth, int ncomp, int *shift, int *order, int scanner_endianness);
+struct pixel_converter *create_pixel_converter(int depth, int ncomp,
+	int width, int *shift, int *order, int scanner_endianness);
 void destroy_pixel_converter(struct pixel_converter *pconv);
+uint16_t *create_gamma_lut(const int *const *gamma, int ncomp, int len);
 
 #endif /* _CONVERT_H_ */
-
-#else /* CONVERT_INTERNAL */
-
-static size_t CONVERT(struct pixel_converter *pconv,
-		      uint8_t* pixels,
-		      size_t count)
-{
-	int i, j;
-	CTYPE *src = (CTYPE *) pixels;
-	CTYPE *dst = (CTYPE *) pixels;
-	CTYPE *buf = (CTYPE *) pconv->buf;
-	int numpixels = pconv->numpixels;
-	int ncomp = pconv->ncomp;
-	int rd = pconv->rd;
-	int *wr = pconv->wr;
-	size_t N = 0;
-
-	for (i = 0; i < count; i++) {
-
-		/* Store a pixel, possibly swapping the endianness. */
-
-		for (j = 0; j < ncomp; j++) {
-			//DBG(DBG_info, "wr: buf[%d] = *(0x%x)\n", wr[j], (int)((uint8_t*)src-pixels));
-			//buf[wr[j]] = BSWAP(*src++);
-			buf[wr[j]] = *src++;
-			wr[j] = (wr[j] + ncomp) % (ncomp*numpixels);
-		}
-
-		/* Return a pixel, if any are available. */
-		if (pconv->sdelay >= 0) {
-			for (j = 0; j < ncomp; j++) {
-				//DBG(DBG_info, "rd: *(0x%x) = buf[%d]\n", (int)((uint8_t*)dst-pixels), rd + j);
-				*dst++ = buf[rd + j];
-			}
-			rd = (rd + ncomp) % (ncomp*numpixels);
-			N++;
-		} else {
-			pconv->sdelay += 1;
-		}
-	}
-
-	pconv->rd = rd;
-	return N;
-}
-
-#undef CONVERT
-#undef CTYPE
-#undef BSWAP
-
-#endif /* CONVERT_INTERNAL */
@@ -17,12 +17,14 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <math.h>
+#include <pthread.h>
 #include <sane/sane.h>
 #include "util.h"
 #include "convert.h"
 #include "low.h"
 #include "scan.h"
 #include "cs4400f.h"
+#include "accel.h"
 
 /* Device-specific settings and functions for Canon Canoscan 4400F */
 
@@ -50,6 +52,17 @@ int write_afe_gain(struct gl843_device *dev, int i, float g)
 	return write_afe(dev, 40 + i, afe_gain_to_val(g));
 }
 
+/* Set the red, green and blue AFE gains in one batch */
+int write_afe_gains(struct gl843_device *dev, float r, float g, float b)
+{
+	const struct afe_ent afe[3] = {
+		{ 40, afe_gain_to_val(r) },
+		{ 41, afe_gain_to_val(g) },
+		{ 42, afe_gain_to_val(b) },
+	};
+	return write_afe_regs(dev, afe, 3);
+}
+
 /* Build an acceleration speed profile for the scanner's
  * stepping motor.
  *
@@ -96,16 +109,29 @@ void build_accel_profile(struct motor_accel *m,
 			 uint16_t c_end,
 			 float exp)
 {
-	double K;
+	double K = 0;
 	int n;
 	unsigned int i;
+	const struct accel_curve *curve = NULL;
+
+	/* Use a precomputed curve if there is one (see accel.h) */
+	for (i = 0; i < ARRAY_SIZE(accel_curves); i++) {
+		if (accel_curves[i].c_start == c_start
+				&& accel_curves[i].exp == exp) {
+			curve = &accel_curves[i];
+			break;
+		}
+	}
+	if (!curve)
+		K = pow(c_start, exp);
 
-	K = pow(c_start, exp);
+	m->c_start = c_start;
+	m->c_end = c_end;
 	m->a[0] = c_start;
 	m->a[1] = c_start; /* Two steps at c_start may reduce stalling risk.  */
 	n = -1;
 	for (i = 2; i < MTRTBL_SIZE; i++) {
-		uint16_t c = pow(K / (double)i, 1/exp);
+		uint16_t c = curve ? curve->a[i] : pow(K / (double)i, 1/exp);
 		if (c <= c_end) {
 			m->a[i] = c_end;
 			if (n < 0)
@@ -131,11 +157,66 @@ void build_accel_profile(struct motor_accel *m,
 		m->t_max += m->a[i];
 }
 
+/* Cache of acceleration profiles built by get_accel_profile() */
+struct accel_profile
+{
+	struct accel_profile *next;
+	float exp;
+	struct motor_accel m;
+};
+
+static struct accel_profile *g_accel_profiles;
+static pthread_mutex_t g_accel_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Get an acceleration profile. See build_accel_profile().
+ *
+ * Profiles are built once and then cached. The returned profile is
+ * shared, don't modify it. Returns NULL if out of memory.
+ */
+const struct motor_accel *get_accel_profile(uint16_t c_start,
+					    uint16_t c_end,
+					    float exp)
+{
+	struct accel_profile *p;
+
+	/* Scanners warm up in their own threads */
+	pthread_mutex_lock(&g_accel_lock);
+	for (p = g_accel_profiles; p != NULL; p = p->next) {
+		if (p->m.c_start == c_start && p->m.c_end == c_end
+				&& p->exp == exp)
+			goto done;
+	}
+
+	p = malloc(sizeof(*p));
+	if (!p)
+		goto done;
+	build_accel_profile(&p->m, c_start, c_end, exp);
+	p->exp = exp;
+	p->next = g_accel_profiles;
+	g_accel_profiles = p;
+done:
+	pthread_mutex_unlock(&g_accel_lock);
+	return p ? &p->m : NULL;
+}
+
+/* Free all cached acceleration profiles */
+void free_accel_profiles()
+{
+	struct accel_profile *p;
+
+	pthread_mutex_lock(&g_accel_lock);
+	while (g_accel_profiles) {
+		p = g_accel_profiles;
+		g_accel_profiles = p->next;
+		free(p);
+	}
+	pthread_mutex_unlock(&g_accel_lock);
+}
+
 /* Set basic hardware configuration */
 int setup_static(struct gl843_device *dev)
 {
 	int ret;
-	int i;
 
 	CHK(write_reg(dev, GL843_LAMPPWR, 0));
 
@@ -154,6 +235,7 @@ int setup_static(struct gl843_device *dev)
 		{ GL843_RFHSET, 31 },  /* refresh time [2µs] */
 	};
 	CHK(write_regs(dev, sdram, ARRAY_SIZE(sdram)));
+	dev->bufsize = 2 << 20;	/* 16 Mbit */
 
 	struct regset_ent gpio1[] = {
 
@@ -377,15 +459,19 @@ int setup_static(struct gl843_device *dev)
 
 	/* Init the AFE, a WM8196 */
 
-	CHK(write_afe(dev, 4, 0));
-	CHK(write_afe(dev, 1, 0x23));
-	CHK(write_afe(dev, 2, 0x24));
-	CHK(write_afe(dev, 3, 0x2f)); /* Can be 0x1f or 0x2f */
-
-	for (i = 0; i < 3; i++) {
-		CHK(write_afe(dev, 32 + i, 112)); /* Startup RGB offset */ // 96
-		CHK(write_afe(dev, 41 + i, 216)); /* Startup RGB gain */   // 75
-	}
+	const struct afe_ent afe_init[] = {
+		{ GL843_AFE_RESET, 0 },
+		{ 1, 0x23 },
+		{ 2, 0x24 },
+		{ 3, 0x2f },	/* Can be 0x1f or 0x2f */
+		{ 32, 112 },	/* Startup RGB offset */ // 96
+		{ 41, 216 },	/* Startup RGB gain */   // 75
+		{ 33, 112 },
+		{ 42, 216 },
+		{ 34, 112 },
+		{ 43, 216 },
+	};
+	CHK(write_afe_regs(dev, afe_init, ARRAY_SIZE(afe_init)));
 
 	CHK(flush_regs(dev));
 
@@ -437,17 +523,17 @@ struct pixel_converter *setup_pixel_converter(struct scan_setup *ss)
 	case PXFMT_RGB8:
 		depth = 8;
 		ncomp = 3;
-		shift[0] = 0 * line_distance * ss->width;
-		shift[1] = 1 * line_distance * ss->width;
-		shift[2] = 2 * line_distance * ss->width;
+		shift[0] = 0 * line_distance;
+		shift[1] = 1 * line_distance;
+		shift[2] = 2 * line_distance;
 		ss->overscan = 2 * line_distance;
 		break;
 	case PXFMT_RGB16:
 		depth = 16;
 		ncomp = 3;
-		shift[0] = 0 * line_distance * ss->width;
-		shift[1] = 1 * line_distance * ss->width;
-		shift[2] = 2 * line_distance * ss->width;
+		shift[0] = 0 * line_distance;
+		shift[1] = 1 * line_distance;
+		shift[2] = 2 * line_distance;
 		ss->overscan = 2 * line_distance;
 		break;
 	default:
@@ -455,7 +541,8 @@ struct pixel_converter *setup_pixel_converter(struct scan_setup *ss)
 		return NULL; /* No converter needed */
 	}
 
-	return create_pixel_converter(depth, ncomp, shift, order, 1);
+	return create_pixel_converter(depth, ncomp, ss->width,
+		shift, order, 1);
 }
 
 /* Ref: gl843 datasheet, FMOVNO register
@@ -541,8 +628,8 @@ int setup_vertical(struct gl843_device *dev, struct scan_setup *ss, int calibrat
 {
 	int ret;
 
-	struct motor_accel move; /* for moving out and home */
-	struct motor_accel scan; /* for scanning and backtracking */
+	const struct motor_accel *move; /* for moving out and home */
+	const struct motor_accel *scan; /* for scanning and backtracking */
 	int c_move, c_scan; /* Move/scan speed [clock ticks per step] */
 
 	const int scanfeed = 1020;
@@ -611,11 +698,11 @@ int setup_vertical(struct gl843_device *dev, struct scan_setup *ss, int calibrat
 		 ss->dpi, ss->lperiod, ss->linesel, ss->steptype);
 
 	if (!calibrate) {
-		build_accel_profile(&move, 12000, c_move, 1.5);
-		build_accel_profile(&scan, 12000, c_scan, 1.5);
+		CHK_MEM(move = get_accel_profile(12000, c_move, 1.5));
+		CHK_MEM(scan = get_accel_profile(12000, c_scan, 1.5));
 	} else {
-		build_accel_profile(&move, c_move, c_move, 1.5);
-		build_accel_profile(&scan, c_scan, c_scan, 1.5);
+		CHK_MEM(move = get_accel_profile(c_move, c_move, 1.5));
+		CHK_MEM(scan = get_accel_profile(c_scan, c_scan, 1.5));
 	}
 
 	struct regset_ent motor[] = {
@@ -632,13 +719,13 @@ int setup_vertical(struct gl843_device *dev, struct scan_setup *ss, int calibrat
 		/* Scanning (table 1, 2 and 3) */
 		{ GL843_STOPTIM, 31 },
 		{ GL843_STEPSEL, ss->steptype },
-		{ GL843_STEPNO, scan.alen >> STEPTIM },
-		{ GL843_FSHDEC, scan.alen >> STEPTIM },
-		{ GL843_FASTNO, scan.alen >> STEPTIM },
+		{ GL843_STEPNO, scan->alen >> STEPTIM },
+		{ GL843_FSHDEC, scan->alen >> STEPTIM },
+		{ GL843_FASTNO, scan->alen >> STEPTIM },
 		/* Fast moving (table 4) */
 		{ GL843_FSTPSEL, ss->steptype },
-		{ GL843_FMOVNO, move.alen >> STEPTIM },
-		{ GL843_FMOVDEC, move.alen >> STEPTIM },
+		{ GL843_FMOVNO, move->alen >> STEPTIM },
+		{ GL843_FMOVDEC, move->alen >> STEPTIM },
 		/* Vref */
 		{ GL843_VRHOME, vref[0] },
 		{ GL843_VRMOVE, vref[1] },
@@ -648,7 +735,7 @@ int setup_vertical(struct gl843_device *dev, struct scan_setup *ss, int calibrat
 	CHK(write_regs(dev, motor, ARRAY_SIZE(motor)));
 
 	feedl = start_y; /* Assume scanner head is at home */
-	feedl = feedl - (2*move.alen + scan.alen + scanfeed);
+	feedl = feedl - (2*move->alen + scan->alen + scanfeed);
 
 	if (feedl > 0 && !calibrate) {
 		/* Set up fast moving before scanning. */
@@ -657,16 +744,16 @@ int setup_vertical(struct gl843_device *dev, struct scan_setup *ss, int calibrat
 		n = scanfeed;
 
 		DBG(DBG_info, "   fast move: accel=%d + feed=%d + decel=%d\n",
-			move.alen, feedl, move.alen);
+			move->alen, feedl, move->alen);
 		DBG(DBG_info, "+ scan start: accel=%d + feed=%d = %d steps\n",
-			scan.alen, scanfeed,
-			move.alen + feedl + move.alen + scan.alen + scanfeed);
+			scan->alen, scanfeed,
+			move->alen + feedl + move->alen + scan->alen + scanfeed);
 
 	} else if (feedl <= 0 && !calibrate) {
 		/* Don't use fast moving before scanning - not enough room. */
 		set_reg(dev, GL843_FASTFED, 0);
 		feedl = start_y;
-		feedl -= scan.alen;
+		feedl -= scan->alen;
 		if (feedl < 1) {
 			/* TODO: Mark this as a scanner-setup bug instead */
 			DBG(DBG_warn, "Cannot start scan early enough.\n");
@@ -680,7 +767,7 @@ int setup_vertical(struct gl843_device *dev, struct scan_setup *ss, int calibrat
 		n = feedl;
 
 		DBG(DBG_info, "scan start: accel=%d + feed=%d = %d steps\n",
-			scan.alen, feedl, scan.alen + feedl);
+			scan->alen, feedl, scan->alen + feedl);
 
 	} else { /* calibrate */
 		backtrack = 0;
@@ -688,7 +775,7 @@ int setup_vertical(struct gl843_device *dev, struct scan_setup *ss, int calibrat
 		n = feedl;
 	}
 
-	z2mod = (scan.t_max + scan.a[scan.alen - 1] * n) % lperiod;
+	z2mod = (scan->t_max + scan->a[scan->alen - 1] * n) % lperiod;
 
 	set_reg(dev, GL843_FEEDL, feedl);
 	set_reg(dev, GL843_LINCNT, ss->height + ss->overscan);
@@ -696,7 +783,7 @@ int setup_vertical(struct gl843_device *dev, struct scan_setup *ss, int calibrat
 
 	if (backtrack > 0) {
 		backtrack = ALIGN(backtrack, 1 << STEPTIM);
-		z1mod = (scan.t_max + scan.a[scan.alen - 1] * backtrack) % lperiod;
+		z1mod = (scan->t_max + scan->a[scan->alen - 1] * backtrack) % lperiod;
 		set_reg(dev, GL843_FWDSTEP, backtrack >> STEPTIM);
 		set_reg(dev, GL843_BWDSTEP, backtrack >> STEPTIM);
 		set_reg(dev, GL843_Z1MOD, z1mod);
@@ -707,14 +794,16 @@ int setup_vertical(struct gl843_device *dev, struct scan_setup *ss, int calibrat
 
 	CHK(flush_regs(dev));
 
-	CHK(send_motor_accel(dev, 1, scan.a, 1020));
-	CHK(send_motor_accel(dev, 2, scan.a, 1020));
-	CHK(send_motor_accel(dev, 3, scan.a, 1020));
-	CHK(send_motor_accel(dev, 4, move.a, 1020));
+	CHK(send_motor_accel(dev, 1, scan->a, 1020));
+	CHK(send_motor_accel(dev, 2, scan->a, 1020));
+	CHK(send_motor_accel(dev, 3, scan->a, 1020));
+	CHK(send_motor_accel(dev, 4, move->a, 1020));
 
 	ret = 0;
 chk_failed:
 	return ret;
+chk_mem_failed:
+	return LIBUSB_ERROR_NO_MEM;
 }
 
 int setup_horizontal(struct gl843_device *dev, struct scan_setup *ss)
@@ -854,7 +943,7 @@ int setup_horizontal(struct gl843_device *dev, struct scan_setup *ss)
 	}
 
 	deep_color = (ss->fmt == PXFMT_GRAY16 || ss->fmt == PXFMT_RGB16);
-	use_gamma = (ss->fmt != PXFMT_GRAY16 && ss->fmt != PXFMT_RGB16);
+	use_gamma = ss->use_gamma && !deep_color;
 
 	bwhi = (int) satf(ss->bwthr + (ss->bwhys / 2) + 0.5, 0, 255);
 	bwlo = (int) satf(ss->bwthr - (ss->bwhys / 2) + 0.5, 0, 255);
@@ -866,12 +955,19 @@ int setup_horizontal(struct gl843_device *dev, struct scan_setup *ss)
 		tgtime++;
 	}
 
+	/* Expected line period, for polling the scanner buffer.
+	 * One line takes LPERIOD * 2^LINESEL pixel periods, and a pixel
+	 * period is 12 or 16 system clocks (SCANMOD) at 60 MHz. */
+	dev->line_time = (unsigned int) ((double)ss->lperiod
+		* (1 << ss->linesel) * (scanmod == 7 ? 16 : 12) / 60);
+
 	DBG(DBG_info, "strpixel = %d, endpixel = %d\n", strpixel, endpixel);
 	DBG(DBG_info, "lperiod = %d, tgtime = %d\n", lperiod, tgtime);
 	DBG(DBG_info, "maxwd = %d, monochrome = %d, deep_color = %d, "
 		"use_gamma = %d, dpi = %d\n", maxwd, mono, deep_color,
 		use_gamma, ss->dpi);
 	DBG(DBG_info, "bwhi = %d, bwlo = %d\n", bwhi, bwlo);
+	DBG(DBG_info, "line time = %u us\n", dev->line_time);
 
 	/* CCD and AFE settings */
 	struct regset_ent frontend[] = {
@@ -948,6 +1044,120 @@ chk_failed:
 	return ret;
 }
 
+/* Cached result of setup_horizontal() and setup_vertical() */
+struct setup_snapshot
+{
+	struct setup_snapshot *next;
+	struct scan_setup key;		/* Setup passed to setup_scan() */
+	int calibrate;
+	struct scan_setup result;	/* Setup after setup_scan() */
+	unsigned int line_time;
+	struct reg_snapshot *regs;
+};
+
+#define SETUP_CACHE_SIZE 8	/* Cached setups per device */
+
+static int same_scan_setup(const struct scan_setup *a,
+			   const struct scan_setup *b)
+{
+	return a->source == b->source
+		&& a->fmt == b->fmt
+		&& a->dpi == b->dpi
+		&& a->start_x == b->start_x
+		&& a->width == b->width
+		&& a->start_y == b->start_y
+		&& a->height == b->height
+		&& a->overscan == b->overscan
+		&& a->bwthr == b->bwthr
+		&& a->bwhys == b->bwhys
+		&& a->use_backtracking == b->use_backtracking
+		&& a->use_gamma == b->use_gamma
+		&& a->steptype == b->steptype
+		&& a->step_dpi == b->step_dpi
+		&& a->lperiod == b->lperiod
+		&& a->linesel == b->linesel;
+}
+
+static void free_setup_snapshot(struct setup_snapshot *p)
+{
+	if (p) {
+		free_reg_snapshot(p->regs);
+		free(p);
+	}
+}
+
+/* Set up the scanner for a scan, i.e setup_horizontal() followed by
+ * setup_vertical(). Call setup_common() and setup_pixel_converter() first.
+ *
+ * The resulting registers and motor tables are cached in the device,
+ * dev->setup_cache. If the same setup
+ * is requested again, the cached snapshot is replayed instead, and only
+ * what differs from the scanner's current state is sent.
+ */
+int setup_scan(struct gl843_device *dev, struct scan_setup *ss, int calibrate)
+{
+	int ret, n;
+	struct setup_snapshot *snap, **pp;
+
+	for (pp = &dev->setup_cache; *pp != NULL; pp = &(*pp)->next) {
+		snap = *pp;
+		if (snap->calibrate != calibrate
+				|| !same_scan_setup(&snap->key, ss))
+			continue;
+		DBG(DBG_info, "replaying cached scan setup\n");
+		/* Move to front */
+		*pp = snap->next;
+		snap->next = dev->setup_cache;
+		dev->setup_cache = snap;
+
+		*ss = snap->result;
+		dev->line_time = snap->line_time;
+		return replay_reg_snapshot(dev, snap->regs);
+	}
+
+	CHK_MEM(snap = calloc(1, sizeof(*snap)));
+	snap->key = *ss;
+	snap->calibrate = calibrate;
+
+	CHK(begin_reg_snapshot(dev));
+	CHK(setup_horizontal(dev, ss));
+	CHK(setup_vertical(dev, ss, calibrate));
+	snap->regs = end_reg_snapshot(dev);
+	snap->result = *ss;
+	snap->line_time = dev->line_time;
+
+	/* Insert first, and drop the least recently used entry */
+	snap->next = dev->setup_cache;
+	dev->setup_cache = snap;
+	for (n = 1, pp = &dev->setup_cache; *pp != NULL; pp = &(*pp)->next, n++) {
+		if (n > SETUP_CACHE_SIZE) {
+			free_setup_snapshot(*pp);
+			*pp = NULL;
+			break;
+		}
+	}
+	return 0;
+
+chk_failed:
+	free_reg_snapshot(end_reg_snapshot(dev));
+	free_setup_snapshot(snap);
+	return ret;
+chk_mem_failed:
+	return LIBUSB_ERROR_NO_MEM;
+}
+
+/* Free the scan setups cached in dev */
+void free_setup_cache(struct gl843_device *dev)
+{
+	struct setup_snapshot *p;
+
+	while (dev->setup_cache) {
+		p = dev->setup_cache;
+		dev->setup_cache = p->next;
+		free_setup_snapshot(p);
+	}
+}
+
 int select_shading(struct gl843_device *dev, enum gl843_shading mode)
 {
 	int ret;
@@ -1011,27 +1221,25 @@ chk_failed:
 int move_scanner_head(struct gl843_device *dev, float d)
 {
 	int ret;
-	int feedl;
-	struct motor_accel move;
+	int feedl, alen;
+	const struct motor_accel *move;
 
 	/* Get direction and distance to move in steps. */
 
-	feedl = (int)(4800 * d / 25.4 + 0.5);
-	if (feedl >= 0) {
-		set_reg(dev, GL843_MTRREV, 0);
-	} else {
-		set_reg(dev, GL843_MTRREV, 1);
-		feedl = -feedl;
-	}
+	/* Round the distance, not d, so moving back by the same d
+	 * returns to the same position. */
+	feedl = (int)(4800 * fabsf(d) / 25.4 + 0.5);
+	set_reg(dev, GL843_MTRREV, d < 0);
 
-	build_accel_profile(&move, 5600, 300, 2.0);
+	CHK_MEM(move = get_accel_profile(5600, 300, 2.0));
+	alen = move->alen;
 
-	feedl = feedl - 2 * move.alen;
+	feedl = feedl - 2 * alen;
 	if (feedl < 0) {
 		/* The acceleration/deceleration curves are longer than
 		 * the distance we wish to move. Set feedl = 1 (minimum)
 		 * and trim the curves to desired lengths. */
-		move.alen = (feedl + 2 * move.alen) / 2;
+		alen = (feedl + 2 * alen) / 2;
 		feedl = 1;
 	}
 
@@ -1053,8 +1261,8 @@ int move_scanner_head(struct gl843_device *dev, float d)
 		{ GL843_ACDCDIS, 1 }, /* Disable backtracking. */
 		/* Fast feeding  */
 		{ GL843_FSTPSEL, HALF_STEP },
-		{ GL843_FMOVNO, move.alen >> STEPTIM },
-		{ GL843_FMOVDEC, move.alen >> STEPTIM },
+		{ GL843_FMOVNO, alen >> STEPTIM },
+		{ GL843_FMOVDEC, alen >> STEPTIM },
 		{ GL843_DECSEL, 1 },
 		{ GL843_FASTFED, 1 },
 		{ GL843_SCANFED, 0 },
@@ -1070,10 +1278,10 @@ int move_scanner_head(struct gl843_device *dev, float d)
 	};
 	CHK(write_regs(dev, motor1, ARRAY_SIZE(motor1)));
 
-	CHK(send_motor_accel(dev, 1, move.a, 1020));
-	CHK(send_motor_accel(dev, 2, move.a, 1020));
-	CHK(send_motor_accel(dev, 3, move.a, 1020));
-	CHK(send_motor_accel(dev, 4, move.a, 1020));
+	CHK(send_motor_accel(dev, 1, move->a, 1020));
+	CHK(send_motor_accel(dev, 2, move->a, 1020));
+	CHK(send_motor_accel(dev, 3, move->a, 1020));
+	CHK(send_motor_accel(dev, 4, move->a, 1020));
 
 	/* Start moving */
 
@@ -1084,6 +1292,8 @@ int move_scanner_head(struct gl843_device *dev, float d)
 	ret = 0;
 chk_failed:
 	return ret;
+chk_mem_failed:
+	return LIBUSB_ERROR_NO_MEM;
 }
 
 #if 0
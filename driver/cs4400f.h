@@ -7,12 +7,19 @@ float __attribute__ ((pure)) max_afe_gain();
 float __attribute__ ((pure)) min_afe_gain();
 int __attribute__ ((pure)) afe_gain_to_val(float g);
 int write_afe_gain(struct gl843_device *dev, int i, float g);
+int write_afe_gains(struct gl843_device *dev, float r, float g, float b);
+
+const struct motor_accel *get_accel_profile(uint16_t c_start, uint16_t c_end,
+	float exp);
+void free_accel_profiles();
 
 int setup_static(struct gl843_device *dev);
 int setup_common(struct gl843_device *dev, struct scan_setup *ss);
 struct pixel_converter *setup_pixel_converter(struct scan_setup *ss);
 int setup_vertical(struct gl843_device *dev, struct scan_setup *ss, int calibrate);
 int setup_horizontal(struct gl843_device *dev, struct scan_setup *ss);
+int setup_scan(struct gl843_device *dev, struct scan_setup *ss, int calibrate);
+void free_setup_cache(struct gl843_device *dev);
 
 int select_shading(struct gl843_device *dev, enum gl843_shading mode);
 int set_lamp(struct gl843_device *dev, enum gl843_lamp state, int timeout);
@@ -76,6 +76,8 @@ struct scan_setup {
 	float bwthr;		/* Black/white threshold (0.0 - 1.0) */
 	float bwhys;		/* Black/white hysteresis (0.0 - 1.0) */
 	int use_backtracking;
+	int use_gamma;		/* 1 = apply the gamma tables in the scanner.
+				 * Ignored for 16-bit scans. */
 
 	/* Hardware-specific parameters */
 
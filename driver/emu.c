@@ -0,0 +1,567 @@
+/* GL843 emulator
+ *
+ * Copyright (C) 2010 Andreas Robinson <andr345 at gmail dot com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+/* A software model of a GL843 in a CanoScan 4400F, good enough to run
+ * the whole driver without hardware. It models:
+ *
+ * - the IO register file and the control requests that access it,
+ * - the bulk setup packet and bulk transfers to the motor, gamma and
+ *   shading RAM,
+ * - the analog frontend (AFE) registers, written through FEWRA/FEWRDATA,
+ * - the motor: moves, the home sensor, scanning and auto-go-home,
+ *   and scanning in place with the motor power (MTRPWR) off,
+ * - a synthetic pixel stream, produced at a fixed line rate, with
+ *   VALIDWORD, BUFEMPTY and the other status registers.
+ *
+ * The pixels come from a simple light model: A lamp that warms up
+ * exponentially, slight vignetting, and WM8196-like AFE offset and gain.
+ * It is not bit-accurate; the aim is that calibration converges and
+ * scans produce sensible data at a realistic rate.
+ */
+
+#define _BSD_SOURCE
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+#include <libusb-1.0/libusb.h>
+#include <sane/sane.h>
+
+#include "low.h"
+#include "util.h"
+#include "emu.h"
+
+#define EMU_RAM_SIZE	(1 << 21)	/* Shading RAM [bytes] */
+#define EMU_TBL_SIZE	16384		/* Motor table and gamma RAM [bytes] */
+#define EMU_BUF_SIZE	(2 << 20)	/* Scanned image buffer, 16 Mbit [bytes] */
+#define EMU_STEP_TIME	20		/* Motor step time [µs] */
+#define EMU_LAMP_TAU	1.0		/* Lamp warm-up time constant [s] */
+#define EMU_WHITE	20000.0		/* Lamp intensity, before gain */
+
+struct gl843_emu
+{
+	struct gl843_transport xport;	/* Must be first */
+
+	uint8_t reg[GL843_MAX_IOREG + 1];	/* IO register file */
+	uint8_t afe[64];	/* AFE registers */
+	int sel;		/* Selected IO register */
+	int bulk_port;		/* Data port of the current bulk transfer */
+	size_t bulk_left;	/* Bytes left in the current bulk transfer */
+	unsigned int addr;	/* RAM address, advances with bulk transfers */
+
+	uint8_t mtr[EMU_TBL_SIZE];	/* Motor table RAM */
+	uint8_t gmm[EMU_TBL_SIZE];	/* Gamma RAM */
+	uint8_t *ram;			/* Shading RAM */
+
+	unsigned int line_time;	/* Configured line time [µs], 0 = auto */
+	uint64_t lamp_on;	/* When the lamp was turned on [µs], 0 = off */
+
+	/* Motor */
+
+	int pos;		/* Head position [steps from home] */
+	int target;		/* Position when the motor stops */
+	int moving;
+	int still;		/* MTRPWR was off: time passes, the head stays */
+	uint64_t t_start;	/* Motor start [µs] */
+	uint64_t t_feed;	/* End of feeding, start of scanning [µs] */
+	uint64_t t_stop;	/* Motor stop [µs] */
+
+	/* Pixel stream */
+
+	int scanning;		/* SCAN was set when the motor started */
+	int scan_done;		/* All lines scanned, or stopped early */
+	int scan_pos;		/* Head position at the first line */
+	unsigned int lines;	/* Lines to scan */
+	unsigned int t_line;	/* Line time [µs] */
+	size_t bpl;		/* Bytes per line */
+	size_t sent;		/* Bytes read by the host */
+	uint8_t *line;		/* Pixels of every line in this scan */
+};
+
+static uint64_t now_us(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static unsigned int reg16(struct gl843_emu *e, int a)
+{
+	return (e->reg[a] << 8) | e->reg[a+1];
+}
+
+static unsigned int reg20(struct gl843_emu *e, int a)
+{
+	return ((e->reg[a] & 0x0f) << 16) | (e->reg[a+1] << 8) | e->reg[a+2];
+}
+
+static void set_reg24(struct gl843_emu *e, int a, unsigned int val)
+{
+	e->reg[a] = (val >> 16) & 0xff;
+	e->reg[a+1] = (val >> 8) & 0xff;
+	e->reg[a+2] = val & 0xff;
+}
+
+/* Line time [µs], as the scanner would compute it */
+static unsigned int get_line_time(struct gl843_emu *e)
+{
+	unsigned int lperiod = reg16(e, 0x38) << (e->reg[0x1c] & 0x07);
+	unsigned int linesel = e->reg[0x1e] & 0x0f;
+	unsigned int clks = ((e->reg[0x06] >> 5) == 7) ? 16 : 12;
+	uint64_t t;
+
+	if (e->line_time)
+		return e->line_time;
+	t = (uint64_t) lperiod * (1 << linesel) * clks / 60;
+	return (t > 0) ? t : 1;
+}
+
+/* Lamp intensity at time t, relative to a warm lamp */
+static double lamp_level(struct gl843_emu *e, uint64_t t)
+{
+	double dt;
+
+	if (!e->lamp_on)
+		return 0;
+	dt = (t > e->lamp_on) ? (double) (t - e->lamp_on) : 0;
+	return 1.0 - 0.3 * exp(-dt / (EMU_LAMP_TAU * 1e6));
+}
+
+/* 16-bit sample value of color c in pixel x of a line of n pixels */
+static unsigned int sample(struct gl843_emu *e, int c, int x, int n,
+			   double lamp)
+{
+	double u = (2.0 * x / n) - 1.0;
+	double light = EMU_WHITE * lamp * (1.0 - 0.1 * u * u);
+	double gain = 208.0 / (283 - e->afe[40 + c]);	/* WM8196 */
+	double black = 4000.0 - 40.0 * e->afe[32 + c];
+
+	return (unsigned int) satf(black + light * gain, 0, 65535);
+}
+
+/* Build the line that every line in the scan will contain */
+static int build_scan_line(struct gl843_emu *e, uint64_t t)
+{
+	int x, c, n, ncomp, depth;
+	unsigned int v;
+	uint8_t *p;
+	double lamp = lamp_level(e, t);
+
+	/* Pixels per line is the CCD window scaled by DPISET.
+	 * This matches how the driver sets up the platen. */
+	n = (reg16(e, 0x32) - reg16(e, 0x30))
+		* (reg16(e, 0x2c) & 0x3fff) / 4800;
+	if (n < 1)
+		n = 1;
+	ncomp = ((e->reg[0x04] >> 2) & 3) ? 1 : 3;	/* FILTER */
+	depth = (e->reg[0x04] & 0x40) ? 16 : 8;		/* BITSET */
+	if (e->reg[0x04] & 0x80)			/* LINEART */
+		depth = 1;
+
+	e->bpl = (depth == 1) ? (n + 7) / 8 : n * ncomp * depth / 8;
+	free(e->line);
+	e->line = calloc(e->bpl, 1);
+	if (!e->line)
+		return LIBUSB_ERROR_NO_MEM;
+
+	p = e->line;
+	for (x = 0; x < n; x++) {
+		for (c = 0; c < ncomp; c++) {
+			v = sample(e, (ncomp == 1) ? 1 : c, x, n, lamp);
+			if (depth == 16) {
+				*p++ = v & 0xff;	/* Little endian */
+				*p++ = v >> 8;
+			} else if (depth == 8) {
+				*p++ = v >> 8;
+			} else if (v < 0x8000) {
+				p[x / 8] |= 0x80 >> (x % 8);
+			}
+		}
+	}
+	return 0;
+}
+
+/* Number of lines scanned at time t */
+static unsigned int lines_scanned(struct gl843_emu *e, uint64_t t)
+{
+	uint64_t n;
+
+	if (!e->scanning || t < e->t_feed)
+		return 0;
+	if (e->scan_done)
+		return e->lines;
+	n = (t - e->t_feed) / e->t_line;
+	return (n < e->lines) ? n : e->lines;
+}
+
+/* Bytes waiting in the scanner buffer at time t */
+static size_t bytes_valid(struct gl843_emu *e, uint64_t t)
+{
+	size_t n = (size_t) lines_scanned(e, t) * e->bpl - e->sent;
+	return (n < EMU_BUF_SIZE) ? n : EMU_BUF_SIZE;
+}
+
+/* Bring the motor and status registers up to date */
+static void update(struct gl843_emu *e)
+{
+	uint64_t t = now_us();
+	unsigned int scanned, valid, fed;
+	uint8_t st = 0;
+
+	if (e->moving && t >= e->t_stop) {
+		e->moving = 0;
+		e->pos = e->target;
+	}
+	if (e->scanning && !e->scan_done && t >= e->t_feed
+			+ (uint64_t) e->lines * e->t_line) {
+		e->scan_done = 1;
+	}
+
+	scanned = lines_scanned(e, t);
+	valid = bytes_valid(e, t);
+	fed = e->moving ? (t - e->t_start) / EMU_STEP_TIME : 0;
+
+	if (e->moving)
+		st |= 0x01;				/* MOTORENB */
+	if (e->reg[0x03] & 0x10)
+		st |= 0x04;				/* LAMPSTS */
+	if (!e->moving && e->pos == 0)
+		st |= 0x08;				/* HOMESNR */
+	if (e->scanning && e->scan_done)
+		st |= 0x10;				/* SCANFSH */
+	if (!e->moving || t >= e->t_feed)
+		st |= 0x20;				/* FEEDFSH */
+	if (valid == 0)
+		st |= 0x40;				/* BUFEMPTY */
+	if (e->reg[0x06] & 0x10)
+		st |= 0x80;				/* PWRBIT */
+	e->reg[0x41] = st;
+
+	set_reg24(e, 0x42, valid / 2);			/* VALIDWORD */
+	set_reg24(e, 0x48, min(fed, 0xfffff));		/* FEDCNT */
+	set_reg24(e, 0x4b, min(scanned, 0xfffff));	/* SCANCNT */
+}
+
+/* Start the motor: feed, and scan if SCAN is set */
+static int start_motor(struct gl843_emu *e)
+{
+	int ret;
+	uint64_t t = now_us();
+	int feedl = reg20(e, 0x3d);
+	int agohome = e->reg[0x02] & 0x20;
+	int reverse = e->reg[0x02] & 0x04;
+
+	e->moving = 1;
+	e->still = !(e->reg[0x02] & 0x10);	/* MTRPWR */
+	e->t_start = t;
+	e->t_feed = t + (uint64_t) feedl * EMU_STEP_TIME;
+	e->scanning = e->reg[0x01] & 0x01;
+	e->scan_done = 0;
+	e->sent = 0;
+
+	if (e->scanning) {
+		e->lines = reg20(e, 0x25);
+		e->t_line = get_line_time(e);
+		CHK(build_scan_line(e, t));
+		e->scan_pos = e->pos + feedl;
+		e->target = e->scan_pos + e->lines;
+		e->t_stop = e->t_feed + (uint64_t) e->lines * e->t_line;
+		if (agohome) {
+			e->t_stop += (uint64_t) e->target * EMU_STEP_TIME;
+			e->target = 0;
+		}
+		DBG(DBG_io2, "emu: scanning %u lines of %zu bytes, "
+			"%u us/line\n", e->lines, e->bpl, e->t_line);
+	} else {
+		e->target = reverse ? max(0, e->pos - feedl) : e->pos + feedl;
+		e->t_stop = e->t_feed;
+		DBG(DBG_io2, "emu: moving from %d to %d\n", e->pos, e->target);
+	}
+	if (e->still)
+		e->target = e->pos;
+	ret = 0;
+chk_failed:
+	return ret;
+}
+
+/* The host cleared SCAN. Stop scanning and go home if AGOHOME is set. */
+static void stop_scan(struct gl843_emu *e)
+{
+	uint64_t t = now_us();
+
+	update(e);
+	if (!e->scanning || e->scan_done)
+		return;
+
+	e->lines = lines_scanned(e, t);
+	e->scan_done = 1;
+	if (e->moving) {
+		e->t_stop = t;
+		if (e->still)
+			return;
+		e->target = e->scan_pos + e->lines;
+		if (e->reg[0x02] & 0x20) {	/* AGOHOME */
+			e->t_stop += (uint64_t) e->target * EMU_STEP_TIME;
+			e->target = 0;
+		}
+	}
+}
+
+static void reset(struct gl843_emu *e)
+{
+	update(e);
+	e->pos = e->moving ? e->target : e->pos;
+	memset(e->reg, 0, sizeof(e->reg));
+	e->moving = 0;
+	e->scanning = 0;
+	e->scan_done = 0;
+	e->lamp_on = 0;
+}
+
+static int write_ioreg(struct gl843_emu *e, int a, uint8_t val)
+{
+	uint8_t old = e->reg[a];
+
+	if (a >= 0x40 && a <= 0x4f)
+		return 0;	/* Read-only status */
+
+	e->reg[a] = val;
+
+	switch (a) {
+	case 0x01:	/* SCAN */
+		if ((old & 0x01) && !(val & 0x01))
+			stop_scan(e);
+		break;
+	case 0x03:	/* LAMPPWR */
+		if (!(old & 0x10) && (val & 0x10))
+			e->lamp_on = now_us();
+		else if (!(val & 0x10))
+			e->lamp_on = 0;
+		break;
+	case 0x0d:	/* Self-clearing commands */
+		e->reg[a] = 0;
+		break;
+	case 0x0e:	/* SCANRESET */
+		reset(e);
+		break;
+	case 0x0f:	/* MOVE */
+		if (val != 0)
+			return start_motor(e);
+		break;
+	case 0x2b:	/* RAMADDR, low byte */
+		e->addr = reg20(e, 0x29) & 0x1fffff;
+		break;
+	case 0x3b:	/* FEWRDATA, low byte. Writes the AFE register. */
+		e->afe[e->reg[0x51] & 0x3f] = val;
+		break;
+	case 0x5c:	/* GMMADDR, low byte */
+		e->addr = reg16(e, 0x5b) & 0x3fff;
+		break;
+	}
+	return 0;
+}
+
+/* Host to scanner bulk data */
+static int write_bulk(struct gl843_emu *e, uint8_t *data, int len)
+{
+	uint8_t *mem;
+	size_t size;
+
+	switch (e->bulk_port) {
+	case 0x28:	/* _GMMWRDATA_ */
+		mem = (e->reg[0x5b] & 0x40) ? e->mtr : e->gmm;
+		size = EMU_TBL_SIZE;
+		break;
+	case 0x3c:	/* _RAMWRDATA_ */
+		mem = e->ram;
+		size = EMU_RAM_SIZE;
+		break;
+	default:
+		DBG(DBG_error, "emu: bulk write to port 0x%x\n", e->bulk_port);
+		return LIBUSB_ERROR_IO;
+	}
+	if (e->addr + len > size) {
+		DBG(DBG_error, "emu: RAM overflow at 0x%x\n", e->addr);
+		return LIBUSB_ERROR_OVERFLOW;
+	}
+	memcpy(mem + e->addr, data, len);
+	e->addr += len;
+	return 0;
+}
+
+/* Scanner to host bulk data. Blocks until the data is scanned, like the
+ * real scanner does. */
+static int read_bulk(struct gl843_emu *e, uint8_t *data, int len,
+		     int *transferred, unsigned int timeout)
+{
+	int n;
+	size_t pos, valid;
+	uint64_t t_end = now_us() + (uint64_t) timeout * 1000;
+
+	*transferred = 0;
+
+	if (e->bulk_port != 0x45) {
+		DBG(DBG_error, "emu: bulk read from port 0x%x\n", e->bulk_port);
+		return LIBUSB_ERROR_IO;
+	}
+	if (!e->scanning) {
+		/* RAM read-back */
+		n = min(len, EMU_RAM_SIZE - e->addr);
+		memcpy(data, e->ram + e->addr, n);
+		e->addr += n;
+		*transferred = n;
+		return 0;
+	}
+
+	while (1) {
+		update(e);
+		valid = bytes_valid(e, now_us());
+		if (valid >= (size_t) len || (e->scan_done && valid > 0))
+			break;
+		if (e->scan_done || (timeout && now_us() >= t_end))
+			return LIBUSB_ERROR_TIMEOUT;
+		usleep(min(e->t_line, 100000));
+	}
+
+	n = ((size_t) len < valid) ? len : (int) valid;
+	for (pos = 0; pos < n; ) {
+		size_t off = (e->sent + pos) % e->bpl;
+		size_t k = min(n - pos, e->bpl - off);
+		memcpy(data + pos, e->line + off, k);
+		pos += k;
+	}
+	e->sent += n;
+	*transferred = n;
+	return 0;
+}
+
+static int emu_ctrl_xfer(struct gl843_transport *t,
+			 uint8_t bmRequestType,
+			 uint8_t bRequest,
+			 uint16_t wValue,
+			 uint16_t wIndex,
+			 unsigned char *data,
+			 uint16_t wLength,
+			 unsigned int timeout)
+{
+	int ret, i;
+	struct gl843_emu *e = (struct gl843_emu *) t;
+
+	if (bmRequestType == REQ_OUT && bRequest == REQ_REG
+			&& wValue == VAL_SET_REG && wLength == 1) {
+		/* Select register */
+		e->sel = data[0];
+
+	} else if (bmRequestType == REQ_OUT && bRequest == REQ_BUF
+			&& wValue == VAL_SET_REG) {
+		/* Address/value pairs */
+		for (i = 0; i + 1 < wLength; i += 2) {
+			if (data[i] > GL843_MAX_IOREG)
+				return LIBUSB_ERROR_INVALID_PARAM;
+			CHK(write_ioreg(e, data[i], data[i+1]));
+		}
+
+	} else if (bmRequestType == REQ_IN && bRequest == REQ_REG
+			&& wValue == VAL_READ_REG) {
+		/* Read, starting at the selected register */
+		update(e);
+		for (i = 0; i < wLength; i++) {
+			if (e->sel + i > GL843_MAX_IOREG)
+				return LIBUSB_ERROR_INVALID_PARAM;
+			data[i] = e->reg[e->sel + i];
+		}
+
+	} else if (bmRequestType == REQ_OUT && bRequest == REQ_BUF
+			&& wValue == VAL_BUF && wLength == 8) {
+		/* Bulk setup packet. The size is in bytes 4 - 7. */
+		e->bulk_port = e->sel;
+		e->bulk_left = data[4] | (data[5] << 8)
+			| (data[6] << 16) | ((size_t) data[7] << 24);
+
+	} else {
+		DBG(DBG_error, "emu: unknown control request "
+			"0x%02x 0x%02x 0x%04x\n", bmRequestType, bRequest, wValue);
+		return LIBUSB_ERROR_PIPE;
+	}
+	return wLength;
+chk_failed:
+	return ret;
+}
+
+static int emu_bulk_xfer(struct gl843_transport *t,
+			 unsigned char endpoint,
+			 unsigned char *data,
+			 int length,
+			 int *transferred,
+			 unsigned int timeout)
+{
+	int ret;
+	struct gl843_emu *e = (struct gl843_emu *) t;
+
+	if ((size_t) length > e->bulk_left) {
+		DBG(DBG_warn, "emu: bulk transfer of %d bytes, but only "
+			"%zu were set up\n", length, e->bulk_left);
+	}
+
+	if (endpoint == 0x81) {
+		CHK(read_bulk(e, data, length, transferred, timeout));
+	} else {
+		CHK(write_bulk(e, data, length));
+		*transferred = length;
+	}
+	if (e->bulk_left > (size_t) *transferred)
+		e->bulk_left -= *transferred;
+	else
+		e->bulk_left = 0;
+	ret = 0;
+chk_failed:
+	return ret;
+}
+
+static void emu_destroy(struct gl843_transport *t)
+{
+	struct gl843_emu *e = (struct gl843_emu *) t;
+
+	if (e) {
+		free(e->ram);
+		free(e->line);
+	}
+	free(e);
+}
+
+struct gl843_transport *create_gl843_emulator(unsigned int line_time)
+{
+	struct gl843_emu *e;
+
+	CHK_MEM(e = calloc(sizeof(*e), 1));
+	CHK_MEM(e->ram = calloc(EMU_RAM_SIZE, 1));
+
+	e->xport.name = "emulator";
+	e->xport.ctrl_xfer = emu_ctrl_xfer;
+	e->xport.bulk_xfer = emu_bulk_xfer;
+	e->xport.destroy = emu_destroy;
+	e->line_time = line_time;
+	e->pos = 0;	/* Start at home */
+
+	DBG(DBG_msg, "Using GL843 emulator, line time = %u us%s\n",
+		line_time, line_time ? "" : " (auto)");
+	return &e->xport;
+
+chk_mem_failed:
+	emu_destroy((struct gl843_transport *) e);
+	return NULL;
+}
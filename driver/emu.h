@@ -0,0 +1,30 @@
+/*
+ * Copyright (C) 2010 Andreas Robinson <andr345 at gmail dot com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#ifndef _EMU_H_
+#define _EMU_H_
+
+#include "low.h"
+
+/* Create a GL843 emulator transport. Assign it to dev->xport.
+ *
+ * line_time: time to scan one line [µs].
+ *            0 = derive it from LPERIOD, LINESEL, SCANMOD and TGTIME,
+ *            like the real scanner.
+ *
+ * Returns NULL if out of memory.
+ */
+struct gl843_transport *create_gl843_emulator(unsigned int line_time);
+
+#endif /* _EMU_H_ */
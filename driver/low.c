@@ -18,6 +18,7 @@
 #include <stdint.h>
 #include <string.h>
 #include <unistd.h>
+#include <time.h>
 #include <libusb-1.0/libusb.h>
 #include <sane/sane.h>
 
@@ -27,19 +28,120 @@
 #include "low.h"
 #include "util.h"
 
-#define REQ_IN		0xc0
-#define REQ_OUT		0x40
-#define REQ_REG		0x0c
-#define REQ_BUF		0x04
-#define VAL_BUF		0x82
-#define VAL_SET_REG	0x83
-#define VAL_READ_REG	0x84
+/* libusb_dev_mem_alloc() appeared in libusb 1.0.21 */
+#if defined(LIBUSB_API_VERSION) && (LIBUSB_API_VERSION >= 0x01000105)
+#define HAVE_LIBUSB_DEV_MEM
+#endif
+
+static const char *usb_site_names[USB_SITE_COUNT] = {
+	"other", "flush_regs", "read_regs", "write_afe", "send_motor_accel",
+	"send_gamma", "send_shading", "recv_pixels", "wait_for_pixels"
+};
+
+static uint64_t now_us(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Count transfers under 'site' from now on, unless an outer function
+ * already counts them under its own site. Returns the site to restore
+ * with leave_site(). */
+static enum usb_site enter_site(struct gl843_device *dev, enum usb_site site)
+{
+	enum usb_site prev = dev->usb_site;
+	if (prev == USB_SITE_OTHER)
+		dev->usb_site = site;
+	return prev;
+}
+
+static void leave_site(struct gl843_device *dev, enum usb_site prev)
+{
+	dev->usb_site = prev;
+}
+
+/* Add a transfer to the statistics. Atomic, so get_usb_stats() can
+ * be called from another thread without locking. */
+static void count_xfer(struct gl843_device *dev,
+		       enum usb_site site,
+		       int bytes,
+		       int retries,
+		       int failed,
+		       uint64_t usec)
+{
+	struct usb_stats *st = dev->usb_stats + site;
+	int b = usec ? 63 - __builtin_clzll(usec) : 0;	/* log2(usec) */
+
+	if (b >= USB_HIST_BUCKETS)
+		b = USB_HIST_BUCKETS - 1;
+	__atomic_add_fetch(&st->xfers, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&st->bytes, max(bytes, 0), __ATOMIC_RELAXED);
+	__atomic_add_fetch(&st->retries, retries, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&st->errors, failed, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&st->usec, usec, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&st->hist[b], 1, __ATOMIC_RELAXED);
+}
+
+const char *usb_site_name(enum usb_site site)
+{
+	return (site < USB_SITE_COUNT) ? usb_site_names[site] : "?";
+}
+
+void get_usb_stats(struct gl843_device *dev, enum usb_site site,
+		   struct usb_stats *st)
+{
+	int i;
+	struct usb_stats *src = dev->usb_stats + site;
+
+	st->xfers = __atomic_load_n(&src->xfers, __ATOMIC_RELAXED);
+	st->bytes = __atomic_load_n(&src->bytes, __ATOMIC_RELAXED);
+	st->retries = __atomic_load_n(&src->retries, __ATOMIC_RELAXED);
+	st->errors = __atomic_load_n(&src->errors, __ATOMIC_RELAXED);
+	st->usec = __atomic_load_n(&src->usec, __ATOMIC_RELAXED);
+	for (i = 0; i < USB_HIST_BUCKETS; i++)
+		st->hist[i] = __atomic_load_n(&src->hist[i], __ATOMIC_RELAXED);
+}
 
-#define BULK_IN		0
-#define BULK_OUT	1
+void dump_usb_stats(struct gl843_device *dev)
+{
+	int site;
+	size_t i, n;
+	char buf[512];
+	struct usb_stats st;
+
+	DBG(DBG_msg, "usb: %-18s %8s %12s %7s %6s %10s %8s\n", "", "xfers",
+		"bytes", "retries", "errors", "time [ms]", "avg [us]");
+	for (site = 0; site < USB_SITE_COUNT; site++) {
+		get_usb_stats(dev, site, &st);
+		if (st.xfers == 0)
+			continue;
+		DBG(DBG_msg, "usb: %-18s %8llu %12llu %7llu %6llu %10llu "
+			"%8llu\n", usb_site_name(site),
+			(unsigned long long) st.xfers,
+			(unsigned long long) st.bytes,
+			(unsigned long long) st.retries,
+			(unsigned long long) st.errors,
+			(unsigned long long) st.usec / 1000,
+			(unsigned long long) st.usec / st.xfers);
+
+		/* Non-empty latency buckets, as "min us: count" */
+		n = 0;
+		buf[0] = '\0';
+		for (i = 0; i < USB_HIST_BUCKETS; i++) {
+			if (st.hist[i] == 0 || n >= sizeof(buf) - 32)
+				continue;
+			n += snprintf(buf + n, sizeof(buf) - n, " %lu:%llu",
+				i ? 1UL << i : 0UL,
+				(unsigned long long) st.hist[i]);
+		}
+		DBG(DBG_msg, "usb: %-18s latency [us]:%s\n", "", buf);
+	}
+}
 
-/* libusb_control_transfer wrapper that retries on interrupted system calls. */
-static int usb_ctrl_xfer(libusb_device_handle *dev_handle,
+/* libusb_control_transfer wrapper that retries on interrupted system calls.
+ * Goes through dev->xport instead, if set. */
+static int usb_ctrl_xfer(struct gl843_device *dev,
 			 uint8_t bmRequestType,
 			 uint8_t bRequest,
 			 uint16_t wValue,
@@ -48,39 +150,109 @@ static int usb_ctrl_xfer(libusb_device_handle *dev_handle,
 			 uint16_t wLength,
 			 unsigned int timeout)
 {
-	int i, ret;
+	int i = 0, ret;
+	uint64_t t = now_us();
 
-	for (i = 0; i < 100; i++) {
-		ret = libusb_control_transfer(dev_handle, bmRequestType,
+	if (dev->xport) {
+		ret = dev->xport->ctrl_xfer(dev->xport, bmRequestType,
 			bRequest, wValue, wIndex, data, wLength, timeout);
-		if (ret != LIBUSB_ERROR_INTERRUPTED)
-			break;
-		usleep(1000);
+	} else {
+		for (i = 0; i < 100; i++) {
+			ret = libusb_control_transfer(dev->usbdev,
+				bmRequestType, bRequest, wValue, wIndex,
+				data, wLength, timeout);
+			if (ret != LIBUSB_ERROR_INTERRUPTED)
+				break;
+			usleep(1000);
+		}
 	}
+	count_xfer(dev, dev->usb_site, ret, min(i, 99), ret < 0,
+		now_us() - t);
 	return ret;
 }
 
-/* libusb_bulk_transfer wrapper that retries on interrupted system calls. */
-static int usb_bulk_xfer(struct libusb_device_handle *dev_handle,
+/* libusb_bulk_transfer wrapper that retries on interrupted system calls.
+ * Goes through dev->xport instead, if set. */
+static int usb_bulk_xfer(struct gl843_device *dev,
 			 unsigned char endpoint,
 			 unsigned char *data,
 			 int length,
 			 int *transferred,
 			 unsigned int timeout)
 {
-	int i, ret;
+	int i = 0, ret;
+	uint64_t t = now_us();
 
-	for (i = 0; i < 100; i++) {
-		ret = libusb_bulk_transfer(dev_handle, endpoint, data,
+	*transferred = 0;
+	if (dev->xport) {
+		ret = dev->xport->bulk_xfer(dev->xport, endpoint, data,
 			length, transferred, timeout);
-		if (ret != LIBUSB_ERROR_INTERRUPTED)
-			break;
+	} else {
+		for (i = 0; i < 100; i++) {
+			ret = libusb_bulk_transfer(dev->usbdev, endpoint, data,
+				length, transferred, timeout);
+			if (ret != LIBUSB_ERROR_INTERRUPTED)
+				break;
+		}
 	}
+	count_xfer(dev, dev->usb_site, *transferred, min(i, 99), ret < 0,
+		now_us() - t);
 	return ret;
 }
 
+/* Allocate a buffer for bulk transfers.
+ *
+ * The buffer is USB device memory from libusb_dev_mem_alloc() when the
+ * kernel supports it. usbfs then transfers directly to and from it,
+ * without copying through a kernel buffer. Otherwise it is page-aligned
+ * heap memory.
+ *
+ * devmem: Set to 1 if the buffer is device memory, else 0.
+ *         Pass it on to free_xfer_buf().
+ */
+static uint8_t *alloc_xfer_buf(struct gl843_device *dev,
+			       size_t len,
+			       int *devmem)
+{
+	void *buf = NULL;
+
+	*devmem = 0;
+#ifdef HAVE_LIBUSB_DEV_MEM
+	if (dev->usbdev && !dev->xport && !dev->no_devmem) {
+		buf = libusb_dev_mem_alloc(dev->usbdev, len);
+		if (buf) {
+			*devmem = 1;
+			return buf;
+		}
+		DBG(DBG_info, "USB device memory is unsupported, "
+			"using heap memory.\n");
+		dev->no_devmem = 1;
+	}
+#endif
+	if (posix_memalign(&buf, sysconf(_SC_PAGESIZE), len) != 0)
+		return NULL;
+	return buf;
+}
+
+static void free_xfer_buf(struct gl843_device *dev,
+			  uint8_t *buf,
+			  size_t len,
+			  int devmem)
+{
+	if (!buf)
+		return;
+#ifdef HAVE_LIBUSB_DEV_MEM
+	if (devmem) {
+		libusb_dev_mem_free(dev->usbdev, buf, len);
+		return;
+	}
+#endif
+	free(buf);
+}
+
 /* Construct gl843 device and register cache */
-struct gl843_device *create_gl843dev(libusb_device_handle *h)
+struct gl843_device *create_gl843dev(libusb_context *ctx,
+				     libusb_device_handle *h)
 {
 	int i;
 	struct gl843_device *dev;
@@ -90,13 +262,18 @@ struct gl843_device *create_gl843dev(libusb_device_handle *h)
 	if (!dev)
 		return NULL;
 
+	dev->usbctx = ctx;
 	dev->usbdev = h;
 
 	dev->lbuf = NULL;
 	dev->lbuf_size = 0;
 	dev->lbuf_capacity = 0;
+	dev->lbuf_devmem = 0;
+	dev->no_devmem = 0;
 
 	dev->pconv = NULL;
+	dev->stream = NULL;
+	dev->xport = NULL;
 
 	dev->regmap = gl843_regmap;
 	dev->devreg_names = gl843_devreg_names;
@@ -106,9 +283,15 @@ struct gl843_device *create_gl843dev(libusb_device_handle *h)
 	dev->max_devreg = GL843_MAX_DEVREG - 1;
 	dev->max_dirty = -1;
 	dev->min_dirty = dev->max_ioreg;
+	dev->flush_saved = 0;
+	dev->burst_read = 1;
+	dev->burst_write = MAX_REG_BURST;
+	dev->line_time = 0;
 
-	for (i = 0; i < GL843_MAX_IOREG; i++)
+	for (i = 0; i <= GL843_MAX_IOREG; i++) {
 		dev->ioregs[i].ioreg = i;
+		dev->ioregs[i].devval = -1;
+	}
 
 	return dev;
 }
@@ -117,7 +300,12 @@ struct gl843_device *create_gl843dev(libusb_device_handle *h)
 void destroy_gl843dev(struct gl843_device *dev)
 {
 	if (dev) {
-		free(dev->lbuf);
+		stop_pixel_stream(dev);
+		free_reg_snapshot(dev->rec);
+		if (dev->xport)
+			dev->xport->destroy(dev->xport);
+		free_xfer_buf(dev, dev->lbuf, dev->lbuf_capacity,
+			dev->lbuf_devmem);
 		dev->lbuf = NULL;
 		dev->lbuf_capacity = 0;
 	}
@@ -216,6 +404,8 @@ void set_reg(struct gl843_device *dev, enum gl843_reg reg, unsigned int val)
 			? (val <<  shift) & mask
 			: (val >> -shift) & mask;
 		mark_ioreg_dirty(dev, rmap->ioreg, mask);
+		if (dev->rec)
+			dev->rec->touched[rmap->ioreg] |= mask;
 	}
 }
 
@@ -228,6 +418,54 @@ void set_regs(struct gl843_device *dev, struct regset_ent *regset, size_t len)
 	}
 }
 
+/* IO registers that can change on their own, or have side effects when
+ * written or read. The driver never assumes it knows what is in them, so
+ * they are always sent to the scanner when dirty.
+ */
+static int is_volatile_ioreg(int ioreg)
+{
+	switch (ioreg) {
+	case 0x01:	/* SCAN */
+	case 0x02:	/* MTRPWR */
+	case 0x03:	/* LAMPPWR, cleared by the lamp timer */
+	case 0x0d:	/* CLRLNCNT, CLRMCNT, FULLSTP etc. Self-clearing. */
+	case 0x0e:	/* SCANRESET */
+	case 0x0f:	/* MOVE */
+	case 0x28:	/* GMMWRDATA */
+	case 0x29: case 0x2a: case 0x2b:	/* RAMADDR, auto-increments */
+	case 0x3a: case 0x3b:	/* FEWRDATA, writes the AFE register */
+	case 0x3c:	/* RAMWRDATA */
+	case 0x5b: case 0x5c:	/* MTRTBL, GMMADDR, auto-increments */
+	case 0x6c: case 0x6d:	/* GPIO1-16, inputs read the pins */
+	case 0xa6:		/* GPIO17-24 */
+	case 0xa8:		/* GPIO25-27 */
+		return 1;
+	default:	/* Status registers 0x40 - 0x4F */
+		return ioreg >= GL843_STATUS_IOREG
+			&& ioreg < GL843_STATUS_IOREG + GL843_STATUS_IOREG_COUNT;
+	}
+}
+
+/* Remember that the device holds 'val' in IO register 'ioreg'. */
+static void set_devval(struct gl843_device *dev, int ioreg, int val)
+{
+	int i;
+	const struct regmap_ent *fe =
+		dev->regmap + dev->regmap_index[GL843_FEBUSY];
+
+	/* The AFE is idle, so the last AFE write is done */
+	if (ioreg == fe->ioreg && !(val & fe->mask))
+		dev->afe_pending = 0;
+
+	if (ioreg == 0x0e) {
+		/* SCANRESET resets the registers to unknown defaults */
+		for (i = 0; i <= (int) dev->max_ioreg; i++)
+			dev->ioregs[i].devval = -1;
+	} else if (!is_volatile_ioreg(ioreg)) {
+		dev->ioregs[ioreg].devval = val;
+	}
+}
+
 /* Read an IO-register from the scanner.
  * See regs.h
  */
@@ -235,13 +473,13 @@ static int read_ioreg(struct gl843_device *dev, uint8_t ioreg)
 {
 	int ret;
 	uint8_t buf[2] = { ioreg, 0 };
-	libusb_device_handle *h = dev->usbdev;
 	const int to = 500;	/* USB timeout [ms] */
 
-	CHK(usb_ctrl_xfer(h, REQ_OUT, REQ_REG, VAL_SET_REG, 0, buf, 1, to));
-	CHK(usb_ctrl_xfer(h, REQ_IN, REQ_REG, VAL_READ_REG, 0, buf, 1, to));
+	CHK(usb_ctrl_xfer(dev, REQ_OUT, REQ_REG, VAL_SET_REG, 0, buf, 1, to));
+	CHK(usb_ctrl_xfer(dev, REQ_IN, REQ_REG, VAL_READ_REG, 0, buf, 1, to));
 	dev->ioregs[ioreg].val = buf[0];
 	dev->ioregs[ioreg].dirty = 0;
+	set_devval(dev, ioreg, buf[0]);
 
 	DBG(DBG_io2, "IOREG(0x%02x) = %u (0x%02x)\n", ioreg, buf[0], buf[0]);
 	return buf[0];
@@ -249,21 +487,165 @@ chk_failed:
 	return ret;
 }
 
-/* Write to an IO-register in the scanner.
+/* Read a range of consecutive IO-registers from the scanner.
+ *
+ * Selects the first register and reads all of them in a single
+ * IN transfer, relying on the address auto-increment in the GL843.
+ * If the scanner returns fewer bytes than requested, the rest are
+ * read one register at a time.
+ *
+ * first: first IO register address
+ * n:     number of registers
+ */
+static int read_ioreg_range(struct gl843_device *dev, int first, int n)
+{
+	int ret, i;
+	uint8_t buf[GL843_MAX_IOREG + 1];
+	uint8_t ioreg = first;
+	const int to = 500;	/* USB timeout [ms] */
+
+	if (n == 1 || !dev->burst_read) {
+		for (i = first; i < first + n; i++)
+			CHK(read_ioreg(dev, i));
+		return 0;
+	}
+
+	CHK(usb_ctrl_xfer(dev, REQ_OUT, REQ_REG, VAL_SET_REG, 0, &ioreg, 1, to));
+	CHK(usb_ctrl_xfer(dev, REQ_IN, REQ_REG, VAL_READ_REG, 0, buf, n, to));
+
+	for (i = 0; i < ret; i++) {
+		dev->ioregs[first + i].val = buf[i];
+		dev->ioregs[first + i].dirty = 0;
+		set_devval(dev, first + i, buf[i]);
+		DBG(DBG_io2, "IOREG(0x%02x) = %u (0x%02x)\n",
+			first + i, buf[i], buf[i]);
+	}
+	if (ret < n) {
+		DBG(DBG_warn, "short read at IOREG(0x%02x), got %d of %d. "
+			"Reading registers one at a time from now on.\n",
+			first, ret, n);
+		dev->burst_read = 0;
+		for (i = first + ret; i < first + n; i++)
+			CHK(read_ioreg(dev, i));
+	}
+	return 0;
+chk_failed:
+	return ret;
+}
+
+/* Write to several IO-registers in the scanner, dev->burst_write
+ * registers per control transfer, in order.
+ * buf: IO register address and value pairs
+ * n:   number of pairs, at most MAX_REG_BURST
  * See regs.h
  */
-static int write_ioreg(struct gl843_device *dev, uint8_t ioreg, int val)
+static int write_ioregs(struct gl843_device *dev, uint8_t *buf, int n)
 {
-	int ret;
-	uint8_t buf[2] = { ioreg, val };
-	libusb_device_handle *h = dev->usbdev;
+	int ret, i, len;
 	const int to = 500;	/* USB timeout [ms] */
 
-	DBG(DBG_io2, "IOREG(0x%02x) = %u (0x%02x)\n", ioreg, val, val);
+	for (i = 0; i < 2*n; i += 2) {
+		DBG(DBG_io2, "IOREG(0x%02x) = %u (0x%02x)\n",
+			buf[i], buf[i+1], buf[i+1]);
+	}
+	for (i = 0; i < n; i += len) {
+		len = min(n - i, dev->burst_write);
+		CHK(usb_ctrl_xfer(dev, REQ_OUT, REQ_BUF, VAL_SET_REG, 0,
+			buf + 2*i, 2*len, to));
+	}
+	for (i = 0; i < 2*n; i += 2)
+		set_devval(dev, buf[i], buf[i+1]);
+chk_failed:
+	return ret;
+}
 
-	ret = usb_ctrl_xfer(h, REQ_OUT, REQ_BUF, VAL_SET_REG, 0, buf, 2, to);
-	dev->ioregs[ioreg].val = val;
-	dev->ioregs[ioreg].dirty = 0;
+int probe_burst_write(struct gl843_device *dev)
+{
+	int ret, i;
+	const int first = 0x10, n = 6;	/* EXPR, EXPG, EXPB */
+	uint8_t save[24], test[12];
+	int bad = 0;
+
+	/* The emulator and replays take any number of pairs */
+	if (dev->burst_write == 1 || dev->xport)
+		return 0;
+
+	/* Save twice as many registers as are written, in case the
+	 * scanner takes the pairs as a run of values. */
+	for (i = 0; i < 2*n; i++) {
+		CHK(read_ioreg(dev, first + i));
+		save[2*i] = first + i;
+		save[2*i+1] = ret;
+	}
+	for (i = 0; i < n; i++) {
+		test[2*i] = first + i;
+		test[2*i+1] = 0x5a ^ (i * 0x11);	/* All different */
+	}
+	CHK(write_ioregs(dev, test, n));
+
+	for (i = 0; i < n; i++) {
+		CHK(read_ioreg(dev, first + i));
+		if (ret != test[2*i+1])
+			bad = 1;
+	}
+	if (bad) {
+		DBG(DBG_warn, "The scanner doesn't support burst register "
+			"writes. Writing registers one at a time.\n");
+		dev->burst_write = 1;
+	} else {
+		DBG(DBG_info, "burst register writes work.\n");
+	}
+
+	/* Restore the registers */
+	CHK(write_ioregs(dev, save, bad ? 2*n : n));
+	for (i = 0; i < 2*n; i++)
+		dev->ioregs[first + i].val = save[2*i+1];
+	ret = 0;
+chk_failed:
+	return ret;
+}
+
+int probe_burst_read(struct gl843_device *dev)
+{
+	int ret, i;
+	const int first = 0x10, n = 6;	/* EXPR, EXPG, EXPB */
+	const int to = 500;	/* USB timeout [ms] */
+	uint8_t ioreg = first;
+	uint8_t save[12], test[12], single[6], burst[6];
+
+	/* The emulator and replays do the auto-increment themselves */
+	if (!dev->burst_read || dev->xport)
+		return 0;
+
+	for (i = 0; i < n; i++) {
+		CHK(read_ioreg(dev, first + i));
+		save[2*i] = test[2*i] = first + i;
+		save[2*i+1] = ret;
+		test[2*i+1] = 0xa5 ^ (i * 0x11);	/* All different */
+	}
+	CHK(write_ioregs(dev, test, n));
+
+	for (i = 0; i < n; i++) {
+		CHK(read_ioreg(dev, first + i));
+		single[i] = ret;
+	}
+	CHK(usb_ctrl_xfer(dev, REQ_OUT, REQ_REG, VAL_SET_REG, 0, &ioreg, 1, to));
+	CHK(usb_ctrl_xfer(dev, REQ_IN, REQ_REG, VAL_READ_REG, 0, burst, n, to));
+
+	if (ret != n || memcmp(single, burst, n) != 0) {
+		DBG(DBG_warn, "The scanner doesn't support burst register "
+			"reads. Reading registers one at a time.\n");
+		dev->burst_read = 0;
+	} else {
+		DBG(DBG_info, "burst register reads work.\n");
+	}
+
+	/* Restore the registers */
+	CHK(write_ioregs(dev, save, n));
+	for (i = 0; i < n; i++)
+		dev->ioregs[first + i].val = save[2*i+1];
+	ret = 0;
+chk_failed:
 	return ret;
 }
 
@@ -273,6 +655,7 @@ int read_regs(struct gl843_device *dev, ...)
 	int ret;
 	int reg = 0;
 	va_list ap;
+	enum usb_site prev = enter_site(dev, USB_SITE_READ_REGS);
 
 	va_start(ap, dev);
 	/* Mark the listed registers as dirty. */
@@ -281,16 +664,25 @@ int read_regs(struct gl843_device *dev, ...)
 	}
 	va_end(ap);
 
-	/* Read dirty IO registers, and mark them as clean. */
-	for (reg = dev->min_dirty; reg <= dev->max_dirty; reg++) {
-		if (dev->ioregs[reg].dirty == 0)
+	/* Read dirty IO registers, and mark them as clean.
+	 * Consecutive registers are read in one batch. */
+	reg = dev->min_dirty;
+	while (reg <= dev->max_dirty) {
+		int last = reg;
+		if (dev->ioregs[reg].dirty == 0) {
+			reg++;
 			continue;
-		CHK(read_ioreg(dev, reg));
+		}
+		while (last < dev->max_dirty && dev->ioregs[last + 1].dirty)
+			last++;
+		CHK(read_ioreg_range(dev, reg, last - reg + 1));
+		reg = last + 1;
 	}
 	dev->min_dirty = dev->max_ioreg + 1;
 	dev->max_dirty = 0;
-	return 0;
+	ret = 0;
 chk_failed:
+	leave_site(dev, prev);
 	return ret;
 }
 
@@ -304,20 +696,67 @@ chk_failed:
 	return ret;
 }
 
-/* Send dirty registers in the cache to the scanner */
+/* Read all status registers in one go */
+int read_status_snapshot(struct gl843_device *dev)
+{
+	int ret;
+	enum usb_site prev = enter_site(dev, USB_SITE_READ_REGS);
+
+	ret = read_ioreg_range(dev, GL843_STATUS_IOREG,
+		GL843_STATUS_IOREG_COUNT);
+	leave_site(dev, prev);
+	return ret;
+}
+
+/* Send dirty registers in the cache to the scanner.
+ * Registers the device is known to hold already are skipped, and the
+ * rest are packed into as few control transfers as possible.
+ */
 int flush_regs(struct gl843_device *dev)
 {
 	int i, ret;
+	int n = 0;		/* Registers in buf */
+	int nregs = 0;		/* Registers written */
+	int nxfers = 0;		/* Control transfers used */
+	int nsame = 0;		/* Registers already up to date */
+	uint8_t buf[2 * MAX_REG_BURST];
+	enum usb_site prev = enter_site(dev, USB_SITE_FLUSH_REGS);
 
 	for (i = dev->min_dirty; i <= dev->max_dirty; i++) {
-		if (dev->ioregs[i].dirty != 0) {
-			CHK(write_ioreg(dev, i, dev->ioregs[i].val));
+		struct ioregister *r = dev->ioregs + i;
+		if (r->dirty == 0)
+			continue;
+		r->dirty = 0;
+		if (r->val == r->devval) {
+			nsame++;
+			continue;
 		}
+		buf[2*n] = i;
+		buf[2*n+1] = r->val;
+		n++;
+		if (n == dev->burst_write) {
+			CHK(write_ioregs(dev, buf, n));
+			nregs += n;
+			nxfers++;
+			n = 0;
+		}
+	}
+	if (n > 0) {
+		CHK(write_ioregs(dev, buf, n));
+		nregs += n;
+		nxfers++;
 	}
+	if (nregs > 1 || nsame > 0) {
+		DBG(DBG_io, "wrote %d registers in %d transfers, "
+			"%d unchanged.\n", nregs, nxfers, nsame);
+	}
+	dev->flush_saved += nregs - nxfers;
+
 	dev->min_dirty = dev->max_ioreg + 1;
 	dev->max_dirty = 0;
-	return 0;
+	ret = 0;
 chk_failed:
+	leave_site(dev, prev);
 	return ret;
 }
 
@@ -335,6 +774,79 @@ int write_regs(struct gl843_device *dev, struct regset_ent *regset, size_t len)
 	return flush_regs(dev);
 }
 
+int begin_reg_snapshot(struct gl843_device *dev)
+{
+	free_reg_snapshot(dev->rec);
+	dev->rec = calloc(1, sizeof(*dev->rec));
+	return dev->rec ? 0 : LIBUSB_ERROR_NO_MEM;
+}
+
+struct reg_snapshot *end_reg_snapshot(struct gl843_device *dev)
+{
+	int i;
+	struct reg_snapshot *snap = dev->rec;
+
+	dev->rec = NULL;
+	if (!snap)
+		return NULL;
+	for (i = 0; i <= GL843_MAX_IOREG; i++) {
+		snap->val[i] = dev->ioregs[i].val & snap->touched[i];
+	}
+	return snap;
+}
+
+void free_reg_snapshot(struct reg_snapshot *snap)
+{
+	int i;
+
+	if (!snap)
+		return;
+	for (i = 0; i < GL843_MTRTBL_SLOTS; i++)
+		free(snap->mtrtbl[i]);
+	free(snap);
+}
+
+int replay_reg_snapshot(struct gl843_device *dev,
+			const struct reg_snapshot *snap)
+{
+	int ret, i;
+
+	for (i = 0; i <= GL843_MAX_IOREG; i++) {
+		int mask = snap->touched[i];
+		if (!mask)
+			continue;
+		dev->ioregs[i].val &= ~mask;
+		dev->ioregs[i].val |= snap->val[i];
+		mark_ioreg_dirty(dev, i, mask);
+	}
+	CHK(flush_regs(dev));
+
+	for (i = 0; i < GL843_MTRTBL_SLOTS; i++) {
+		if (snap->mtrtbl_len[i] == 0)
+			continue;
+		CHK(send_motor_accel(dev, i + 1,
+			snap->mtrtbl[i], snap->mtrtbl_len[i]));
+	}
+	ret = 0;
+chk_failed:
+	return ret;
+}
+
+/* Save a copy of a motor table in the snapshot being recorded */
+static int record_motor_table(struct reg_snapshot *snap,
+			      int table, const uint16_t *tbl, size_t len)
+{
+	uint16_t *copy;
+
+	copy = realloc(snap->mtrtbl[table-1], len * sizeof(*tbl));
+	if (!copy)
+		return LIBUSB_ERROR_NO_MEM;
+	memcpy(copy, tbl, len * sizeof(*tbl));
+	snap->mtrtbl[table-1] = copy;
+	snap->mtrtbl_len[table-1] = len;
+	return 0;
+}
+
 /* Prepare the scanner for a bulk transfer */
 static int write_bulk_setup(struct gl843_device *dev,
 			    enum gl843_reg port, size_t size, int dir)
@@ -342,7 +854,6 @@ static int write_bulk_setup(struct gl843_device *dev,
 	int ret;
 	uint8_t ioreg;
 	uint8_t setup[8];
-	libusb_device_handle *h = dev->usbdev;
 	const int to = 1000;	/* USB timeout [ms] */
 
 	ioreg = dev->regmap[dev->regmap_index[port]].ioreg;
@@ -357,8 +868,8 @@ static int write_bulk_setup(struct gl843_device *dev,
 	setup[6] = (size >> 16) & 0xff;
 	setup[7] = (size >> 24) & 0xff;
 
-	CHK(usb_ctrl_xfer(h, REQ_OUT, REQ_REG, VAL_SET_REG, 0, &ioreg, 1, to));
-	CHK(usb_ctrl_xfer(h, REQ_OUT, REQ_BUF, VAL_BUF, 0, setup, 8, to));
+	CHK(usb_ctrl_xfer(dev, REQ_OUT, REQ_REG, VAL_SET_REG, 0, &ioreg, 1, to));
+	CHK(usb_ctrl_xfer(dev, REQ_OUT, REQ_BUF, VAL_BUF, 0, setup, 8, to));
 	return 0;
 chk_failed:
 	return ret;
@@ -370,128 +881,386 @@ chk_failed:
  */
 int write_afe(struct gl843_device *dev, int reg, int val)
 {
-	int ret;
-	int fe_busy = 1;
-	int timeout = 10;	/* Arbitrary choice */
+	struct afe_ent e = { reg, val };
+	return write_afe_regs(dev, &e, 1);
+}
+
+/* Write AFE registers.
+ *
+ * FEWRA and FEWRDATA are sent together in one control transfer, with
+ * FEWRDATA last since writing it starts the serial write to the AFE.
+ * The reset register is always written, and forgets the shadow values.
+ */
+int write_afe_regs(struct gl843_device *dev,
+		   const struct afe_ent *regs, size_t n)
+{
+	int ret = 0;
+	int timeout;
+	int nsame = 0;
+	size_t i, k, len;
+	uint8_t buf[6];
+	const struct regmap_ent *wra =
+		dev->regmap + dev->regmap_index[GL843_FEWRA];
+	const struct regmap_ent *wrd =
+		dev->regmap + dev->regmap_index[GL843_FEWRDATA];
+	enum usb_site prev = enter_site(dev, USB_SITE_WRITE_AFE);
+
+	for (i = 0; i < n; i++) {
+		int reg = regs[i].reg;
+		int val = regs[i].val;
+
+		if (reg < 0 || reg >= GL843_AFE_REGS) {
+			DBG(DBG_error0, "BUG: bad AFE register %d\n", reg);
+			ret = LIBUSB_ERROR_INVALID_PARAM;
+			goto chk_failed;
+		}
+		if (reg != GL843_AFE_RESET
+			&& (dev->afe_known >> reg & 1) && dev->afe[reg] == val) {
+			nsame++;
+			continue;
+		}
 
-	DBG(DBG_io, "reg = 0x%x, value = 0x%x (%d)\n", reg, val, val);
+		/* Reading FEBUSY clears afe_pending when the AFE is idle */
+		timeout = 10;	/* Arbitrary choice */
+		while (dev->afe_pending && timeout) {
+			CHK(read_reg(dev, GL843_FEBUSY));
+			timeout--;
+		}
+		if (dev->afe_pending) {
+			DBG(DBG_error, "Cannot write config register %d in the "
+				"analog frontend (AFE): The AFE is busy.\n", reg);
+			ret = LIBUSB_ERROR_BUSY;
+			goto chk_failed;
+		}
 
-	while (fe_busy && timeout) {
-		fe_busy = read_reg(dev, GL843_FEBUSY);
-		CHK(fe_busy);
-		timeout--;
-	}
-	if (timeout == 0) {
-		DBG(DBG_error, "Cannot write config register %d in the "
-			"analog frontend (AFE): The AFE is busy.\n", reg);
-		return LIBUSB_ERROR_BUSY;
+		DBG(DBG_io, "reg = 0x%x, value = 0x%x (%d)\n", reg, val, val);
+
+		/* FEWRA, then the FEWRDATA IO registers in regmap order */
+		buf[0] = wra->ioreg;
+		buf[1] = (dev->ioregs[buf[0]].val & ~wra->mask) | reg;
+		len = 1;
+		for (k = 0; wrd[k].devreg == GL843_FEWRDATA && len < 3; k++) {
+			int shift = wrd[k].shift;
+			int mask = wrd[k].mask;
+
+			buf[2*len] = wrd[k].ioreg;
+			buf[2*len+1] = (dev->ioregs[wrd[k].ioreg].val & ~mask)
+				| ((shift >= 0) ? (val << shift) & mask
+						: (val >> -shift) & mask);
+			len++;
+		}
+		dev->afe_known &= ~(1ULL << reg);
+		CHK(write_ioregs(dev, buf, len));
+		for (k = 0; k < len; k++)
+			dev->ioregs[buf[2*k]].val = buf[2*k+1];
+
+		if (reg == GL843_AFE_RESET) {
+			/* All registers are back to their defaults */
+			dev->afe_known = 0;
+		} else {
+			dev->afe[reg] = val;
+			dev->afe_known |= 1ULL << reg;
+		}
+		dev->afe_pending = 1;
 	}
-
-	CHK(write_reg(dev, GL843_FEWRA, reg));
-	CHK(write_reg(dev, GL843_FEWRDATA, val));
+	if (nsame > 0)
+		DBG(DBG_io, "%d AFE registers unchanged.\n", nsame);
 chk_failed:
+	leave_site(dev, prev);
 	return ret;
 }
 
+/* 64-bit FNV-1a hash of a motor or gamma table */
+static uint64_t hash_table(const uint8_t *data, size_t n)
+{
+	size_t i;
+	uint64_t h = 14695981039346656037ULL;
+
+	for (i = 0; i < n; i++)
+		h = (h ^ data[i]) * 1099511628211ULL;
+	/* 0 means "unknown content" in the cache. */
+	return h ? h : 1;
+}
+
+/* Forget what is in the motor table slots. */
+static void invalidate_motor_tables(struct gl843_device *dev)
+{
+	memset(dev->mtrtbl_hash, 0, sizeof(dev->mtrtbl_hash));
+}
+
 /* Send a stepping motor acceleration table to the scanner
  * table: table number, 1 - 5.
  * tbl: acceleration table buffer
  * len: buffer length in bytes
+ *
+ * The upload is skipped if the slot already holds the same table.
  */
 int send_motor_accel(struct gl843_device *dev,
-		     int table, uint16_t *tbl, size_t len)
+		     int table, const uint16_t *tbl, size_t len)
 {
 	int ret, outlen;
+	uint64_t hash;
+	uint16_t *swapped = NULL;
+	uint8_t *data = (uint8_t *) tbl;
+	struct reg_snapshot *rec = dev->rec;
+	enum usb_site prev = dev->usb_site;
+	enum scan_phase phase = dev->timing.phase;
+
+	if (table < 1 || table > GL843_MTRTBL_SLOTS) {
+		DBG(DBG_error0, "BUG: bad motor table number %d\n", table);
+		return LIBUSB_ERROR_INVALID_PARAM;
+	}
+
+	/* Record the table, but not the MTRTBL/GMMADDR juggling below. */
+	if (rec) {
+		CHK(record_motor_table(rec, table, tbl, len));
+		dev->rec = NULL;
+	}
+
+	hash = hash_table((const uint8_t *) tbl, len * 2);
+	if (dev->mtrtbl_hash[table-1] == hash) {
+		DBG(DBG_io, "motor table %d is unchanged.\n", table);
+		ret = 0;
+		goto chk_failed;
+	}
+	dev->mtrtbl_hash[table-1] = 0;
+	enter_site(dev, USB_SITE_SEND_MOTOR_ACCEL);
+	set_scan_phase(&dev->timing, SCAN_PHASE_MOTOR_TABLES);
 
 	DBG(DBG_io, "sending motor table %d, (%zu entries)\n", table, len);
 
-	if (host_is_big_endian())
-		swap_buffer_endianness(tbl, tbl, len);
+	/* The scanner is little endian */
+	if (host_is_big_endian()) {
+		CHK_MEM(swapped = malloc(len * 2));
+		swap_buffer_endianness((uint16_t *) tbl, swapped, len);
+		data = (uint8_t *) swapped;
+	}
 
 	set_reg(dev, GL843_MTRTBL, 1);
 	set_reg(dev, GL843_GMMADDR, (table-1) * 2048);
 	CHK(flush_regs(dev));
 	CHK(write_bulk_setup(dev, GL843__GMMWRDATA_, len*2, BULK_OUT));
-	CHK(usb_bulk_xfer(dev->usbdev, 2,
-		(uint8_t *) tbl, len*2, &outlen, 1000));
+	CHK(usb_bulk_xfer(dev, 2, data, len*2, &outlen, 1000));
 	set_reg(dev, GL843_MTRTBL, 0);
 	set_reg(dev, GL843_GMMADDR, 0);
 	CHK(flush_regs(dev));
+	dev->mtrtbl_hash[table-1] = hash;
 chk_failed:
-	/* Restore endianness in buffer */
-	if (host_is_big_endian())
-		swap_buffer_endianness(tbl, tbl, len);
+	set_scan_phase(&dev->timing, phase);
+	leave_site(dev, prev);
+	dev->rec = rec;
+	free(swapped);
 	return ret;
+chk_mem_failed:
+	ret = LIBUSB_ERROR_NO_MEM;
+	goto chk_failed;
 }
 
-/* Send a gamma correction table to the scanner.
- * table: table number, 1, 2 or 3. (One for each color component)
- * tbl: gamma table buffer
- * len: buffer length in bytes
+/* Send the gamma correction tables to the scanner.
+ * tbl: red, green and blue tables, one after the other
+ * len: number of entries per table
+ *
+ * The entries are 16-bit little endian, and the three tables are
+ * contiguous from address 0 in the gamma RAM. This is the layout the
+ * genesys GL843 backend uses (3 x 256 entries in one transfer).
+ * The upload is skipped if the tables are already there.
  */
-int send_gamma_table(struct gl843_device *dev,
-		     int table, uint8_t *tbl, size_t len)
+int send_gamma_tables(struct gl843_device *dev, const uint16_t *tbl, size_t len)
 {
 	int ret, outlen;
+	uint64_t hash;
+	uint16_t *swapped = NULL;
+	uint8_t *data = (uint8_t *) tbl;
+	enum usb_site prev;
+
+	hash = hash_table(data, 6 * len);
+	if (dev->gamma_hash == hash) {
+		DBG(DBG_io, "gamma tables are unchanged.\n");
+		return 0;
+	}
+	dev->gamma_hash = 0;
+	prev = enter_site(dev, USB_SITE_SEND_GAMMA);
 
-	DBG(DBG_io, "sending gamma table %d, (%zu entries)\n", table, len);
+	DBG(DBG_io, "sending gamma tables, (3 x %zu entries)\n", len);
+
+	/* The scanner is little endian */
+	if (host_is_big_endian()) {
+		CHK_MEM(swapped = malloc(len * 6));
+		swap_buffer_endianness((uint16_t *) tbl, swapped, len * 3);
+		data = (uint8_t *) swapped;
+	}
 
-	set_reg(dev, GL843_MTRTBL, 1);
-	set_reg(dev, GL843_GMMADDR, (table-1) * 256);
-	CHK(flush_regs(dev));
-	CHK(write_bulk_setup(dev, GL843__GMMWRDATA_, len, BULK_OUT));
-	CHK(usb_bulk_xfer(dev->usbdev, 2, tbl, len, &outlen, 1000));
 	set_reg(dev, GL843_MTRTBL, 0);
 	set_reg(dev, GL843_GMMADDR, 0);
 	CHK(flush_regs(dev));
+	CHK(write_bulk_setup(dev, GL843__GMMWRDATA_, 6 * len, BULK_OUT));
+	CHK(usb_bulk_xfer(dev, 2, data, 6 * len, &outlen, 1000));
+	dev->gamma_hash = hash;
 chk_failed:
+	leave_site(dev, prev);
+	free(swapped);
 	return ret;
+chk_mem_failed:
+	ret = LIBUSB_ERROR_NO_MEM;
+	goto chk_failed;
 }
 
 /* Send shading data to the scanner.
- * buf: shading data buffer
+ * buf: shading data buffer, already padded to 512 byte blocks
  * len: length in bytes
  */
 int send_shading(struct gl843_device *dev, uint16_t *buf, size_t len, int addr)
 {
-	const int BLKSIZE = 512;
-	int ret, n, outlen;
-	uint8_t p[BLKSIZE];
+	int ret, outlen;
+	enum usb_site prev;
+
+	if (len % SHADING_BLOCK) {
+		DBG(DBG_error0, "BUG: shading data is not padded (%zu bytes)\n",
+			len);
+		return LIBUSB_ERROR_INVALID_PARAM;
+	}
 
-	/* Send 42 pixels (42 * 12 = 504 bytes) at a time, padded to 512 bytes.
-	 * The scanner ignores the last 8 bytes in every 512 byte block,
-	 * probably because they are less than a full pixel.
-	 */
-	n = len + (len / 504 + 1) * 8; /* Actual number of bytes to send */
+	DBG(DBG_io, "sending %zu bytes shading data.\n", len);
 
+	prev = enter_site(dev, USB_SITE_SEND_SHADING);
 	CHK(write_reg(dev, GL843_RAMADDR, addr));
-	CHK(write_bulk_setup(dev, GL843__RAMWRDATA_, n, BULK_OUT));
+	CHK(write_bulk_setup(dev, GL843__RAMWRDATA_, len, BULK_OUT));
+	CHK(usb_bulk_xfer(dev, 2, (uint8_t *) buf, len, &outlen, 10000));
+	ret = 0;
+chk_failed:
+	leave_site(dev, prev);
+	return ret;
+}
 
-	DBG(DBG_io, "sending %zu + %zu bytes data + padding.\n", len, n - len);
+/* Get the polling interval for the scanner buffer [µs] */
+static unsigned int poll_interval(struct gl843_device *dev)
+{
+	/* Poll about once per scanned line, but not so often that
+	 * the polling itself hogs the bus, nor so seldom that the
+	 * scanner buffer fills up and the head has to backtrack. */
+	if (dev->line_time == 0)
+		return 1000;
+	return min(max(dev->line_time, 1000), 100000);
+}
 
-	for (; n > 0; n -= BLKSIZE) {
-		memcpy(p, buf, (len >= BLKSIZE) ? BLKSIZE : len);
-		CHK(usb_bulk_xfer(dev->usbdev, 2,
-			p, 512, &outlen, 10000));
-		buf += 504/2;
-		len -= 504;
+/* Count a backtrack. The scanner stops and backs up when its buffer
+ * is full, so a poll that finds less than a line of free space is one
+ * backtrack, until the buffer has room again. */
+static void check_buffer_full(struct gl843_device *dev,
+			      size_t avail,
+			      size_t line_bytes)
+{
+	int full;
+
+	if (dev->bufsize == 0)
+		return;
+	full = avail + line_bytes > dev->bufsize;
+	if (full && !dev->buf_full) {
+		__atomic_add_fetch(&dev->timing.backtracks, 1, __ATOMIC_RELAXED);
+		DBG(DBG_io, "scanner buffer is full.\n");
 	}
-	ret = 0;
+	dev->buf_full = full;
+}
+
+/* Wait until the scanner has buffered at least one full line.
+ *
+ * line_bytes: bytes per line
+ * max_bytes:  max bytes the caller can take
+ * timeout:    timeout in milliseconds
+ *
+ * Returns the number of buffered bytes, rounded down to a whole number
+ * of lines and limited to max_bytes (but never less than one line),
+ * or a libusb error code.
+ */
+static int wait_for_lines(struct gl843_device *dev,
+			  size_t line_bytes,
+			  size_t max_bytes,
+			  unsigned int timeout)
+{
+	int ret;
+	size_t avail;
+	unsigned int waited = 0; /* [µs] */
+	unsigned int dt = poll_interval(dev);
+	enum usb_site prev = enter_site(dev, USB_SITE_WAIT_FOR_PIXELS);
+
+	while (1) {
+		/* Note: the register map scales VALIDWORD to bytes. */
+		CHK(read_regs(dev, GL843_VALIDWORD, -1));
+		avail = get_reg(dev, GL843_VALIDWORD);
+		check_buffer_full(dev, avail, line_bytes);
+		avail = avail - avail % line_bytes;
+		if (avail > 0)
+			break;
+		if (waited / 1000 >= timeout) {
+			ret = LIBUSB_ERROR_TIMEOUT;
+			goto chk_failed;
+		}
+		usleep(dt);
+		waited += dt;
+	}
+
+	if (max_bytes >= line_bytes && avail > max_bytes)
+		avail = max_bytes - max_bytes % line_bytes;
+
+	DBG(DBG_io, "%zu bytes (%zu lines) buffered.\n",
+		avail, avail / line_bytes);
+	ret = avail;
 chk_failed:
+	leave_site(dev, prev);
 	return ret;
 }
 
-/* TODO: add timeout parameter */
-int wait_for_pixels(struct gl843_device *dev)
+/* Wait until the scanner has data to send */
+int wait_for_pixels(struct gl843_device *dev, unsigned int timeout)
 {
-	int ret = 1;
-	while (ret > 0) {
-		ret = read_reg(dev, GL843_BUFEMPTY);
-		usleep(1000);
+	int ret;
+	unsigned int waited = 0; /* [µs] */
+	unsigned int dt = poll_interval(dev);
+	enum usb_site prev = enter_site(dev, USB_SITE_WAIT_FOR_PIXELS);
+
+	while (1) {
+		CHK(read_regs(dev, GL843_VALIDWORD, -1));
+		if (get_reg(dev, GL843_VALIDWORD) > 0)
+			break;
+		if (__atomic_load_n(&dev->cancel, __ATOMIC_RELAXED)) {
+			ret = LIBUSB_ERROR_INTERRUPTED;
+			goto chk_failed;
+		}
+		if (waited / 1000 >= timeout) {
+			DBG(DBG_error, "No pixel data after %u ms.\n", timeout);
+			ret = LIBUSB_ERROR_TIMEOUT;
+			goto chk_failed;
+		}
+		usleep(dt);
+		waited += dt;
 	}
+	ret = 0;
+chk_failed:
+	leave_site(dev, prev);
 	return ret;
 }
 
+/* Run received pixels through the pixel converter, if any.
+ * Returns the number of bytes of converted pixels in buf.
+ */
+static int convert_pixels(struct gl843_device *dev,
+			  uint8_t *buf,
+			  int len,
+			  unsigned int bpp)
+{
+	int n;
+
+	if (!dev->pconv)
+		return len;
+
+	n = 8*len / bpp;
+	if (len % (bpp / 8)) {
+		DBG(DBG_warn, "Warning: outlen is not a full number of pixels\n");
+	}
+	n = dev->pconv->convert(dev->pconv, buf, n);
+	return n * bpp / 8;
+}
+
 /* Receive pixels from the scanner.
  * buf: destination buffer
  * len: bytes to read.
@@ -508,27 +1277,22 @@ static int recv_pixels(struct gl843_device *dev,
 		       unsigned int timeout)
 {
 	int ret, outlen;
+	enum usb_site prev = enter_site(dev, USB_SITE_RECV_PIXELS);
 
 	CHK(write_reg(dev, GL843_RAMADDR, 0));
 	CHK(write_bulk_setup(dev, GL843__RAMRDDATA_, len, BULK_IN));
-	CHK(usb_bulk_xfer(dev->usbdev, 0x81, buf, len, &outlen, timeout));
+	CHK(usb_bulk_xfer(dev, 0x81, buf, len, &outlen, timeout));
 	DBG(DBG_io, "requesting %zu bytes, got %d.\n", len, outlen);
 
-	if (dev->pconv) {
-		int n = 8*outlen / bpp;
-		if (outlen % (bpp / 8)) {
-			DBG(DBG_warn, "Warning: outlen is not a full number of pixels\n");
-		}
-		n = dev->pconv->convert(dev->pconv, buf, n);
-		outlen = n * bpp / 8;
-	}
-	ret = outlen;
+	ret = convert_pixels(dev, buf, outlen, bpp);
 chk_failed:
+	leave_site(dev, prev);
 	return ret;
 }
 
 int reset_scanner(struct gl843_device *dev)
 {
+	invalidate_motor_tables(dev);
 	return write_reg(dev, GL843_SCANRESET, 1);
 }
 
@@ -552,14 +1316,230 @@ chk_failed:
  */
 uint8_t *init_line_buffer(struct gl843_device *dev, size_t len)
 {
-	dev->lbuf = realloc(dev->lbuf, len);
-	if (dev->lbuf) {
-		dev->lbuf_capacity = len;
+	if (dev->lbuf && dev->lbuf_capacity == len) {
 		dev->lbuf_size = 0;
+		return dev->lbuf;
 	}
+	free_xfer_buf(dev, dev->lbuf, dev->lbuf_capacity, dev->lbuf_devmem);
+	dev->lbuf_capacity = 0;
+	dev->lbuf_size = 0;
+	dev->lbuf = alloc_xfer_buf(dev, len, &dev->lbuf_devmem);
+	if (dev->lbuf)
+		dev->lbuf_capacity = len;
 	return dev->lbuf;
 }
 
+/* Pixel stream transfer callback */
+static void LIBUSB_CALL pixel_urb_done(struct libusb_transfer *xfer)
+{
+	struct pixel_urb *urb = xfer->user_data;
+	urb->done = 1;
+}
+
+/* Queue the next chunk of the stream in urb, if there is anything left. */
+static int submit_pixel_urb(struct gl843_device *dev, struct pixel_urb *urb)
+{
+	int ret;
+	size_t n;
+	struct pixel_stream *st = dev->stream;
+
+	urb->len = 0;
+	urb->pos = 0;
+	urb->done = 0;
+	if (st->to_submit == 0)
+		return 0;
+
+	n = (st->to_submit < st->chunk) ? st->to_submit : st->chunk;
+	libusb_fill_bulk_transfer(urb->xfer, dev->usbdev, 0x81, urb->buf, n,
+		pixel_urb_done, urb, st->timeout);
+	CHK(libusb_submit_transfer(urb->xfer));
+	urb->inflight = 1;
+	urb->t_submit = now_us();
+	st->to_submit -= n;
+
+	/* Nothing was read while no transfer was in flight. If that lasted
+	 * long enough for the scanner to fill its buffer, it backtracked. */
+	if (st->t_dry && dev->bufsize && dev->line_time
+			&& (urb->t_submit - st->t_dry) * dev->lbuf_capacity
+			>= (uint64_t) dev->bufsize * dev->line_time) {
+		__atomic_add_fetch(&dev->timing.backtracks, 1, __ATOMIC_RELAXED);
+		DBG(DBG_io, "pixel stream stalled, scanner buffer is full.\n");
+	}
+	st->t_dry = 0;
+	ret = 0;
+chk_failed:
+	return ret;
+}
+
+/* Wait for a transfer in the stream to complete */
+static int wait_pixel_urb(struct gl843_device *dev, struct pixel_urb *urb)
+{
+	int ret, i;
+	struct pixel_stream *st = dev->stream;
+
+	while (!urb->done) {
+		ret = libusb_handle_events_completed(dev->usbctx, &urb->done);
+		if (ret < 0 && ret != LIBUSB_ERROR_INTERRUPTED)
+			return ret;
+	}
+	urb->inflight = 0;
+	count_xfer(dev, USB_SITE_RECV_PIXELS, urb->xfer->actual_length, 0,
+		urb->xfer->status != LIBUSB_TRANSFER_COMPLETED,
+		now_us() - urb->t_submit);
+
+	for (i = 0; i < st->nurbs && !st->urb[i].inflight; i++)
+		;
+	if (i == st->nurbs && st->to_submit > 0)
+		st->t_dry = now_us();
+
+	switch (urb->xfer->status) {
+	case LIBUSB_TRANSFER_COMPLETED:
+		return 0;
+	case LIBUSB_TRANSFER_TIMED_OUT:
+		return LIBUSB_ERROR_TIMEOUT;
+	case LIBUSB_TRANSFER_NO_DEVICE:
+		return LIBUSB_ERROR_NO_DEVICE;
+	case LIBUSB_TRANSFER_OVERFLOW:
+		return LIBUSB_ERROR_OVERFLOW;
+	case LIBUSB_TRANSFER_STALL:
+		return LIBUSB_ERROR_PIPE;
+	default:
+		return LIBUSB_ERROR_IO;
+	}
+}
+
+int start_pixel_stream(struct gl843_device *dev,
+		       size_t total,
+		       int nurbs,
+		       unsigned int bpp,
+		       unsigned int timeout)
+{
+	int ret, i;
+	size_t chunk;
+	struct pixel_stream *st;
+	enum usb_site prev;
+
+	if (dev->lbuf_capacity == 0) {
+		DBG(DBG_error0, "BUG: line buffer not initialized.\n");
+		return LIBUSB_ERROR_INVALID_PARAM;
+	}
+
+	stop_pixel_stream(dev);
+
+	/* Asynchronous transfers need a real USB device. Other transports
+	 * fall back to synchronous reads in read_pixels(). */
+	if (dev->xport)
+		return 0;
+
+	/* Transfer whole lines, about 64 kB at a time. Tiny transfers
+	 * at low resolutions would just add per-URB overhead. */
+	chunk = dev->lbuf_capacity * max(1, 65536 / dev->lbuf_capacity);
+
+	CHK_MEM(st = calloc(sizeof(*st) + nurbs * sizeof(st->urb[0]), 1));
+	dev->stream = st;
+	st->nurbs = nurbs;
+	st->head = 0;
+	st->chunk = chunk;
+	st->to_submit = total;
+	st->bpp = bpp;
+	st->timeout = timeout;
+
+	for (i = 0; i < nurbs; i++) {
+		CHK_MEM(st->urb[i].xfer = libusb_alloc_transfer(0));
+		CHK_MEM(st->urb[i].buf = alloc_xfer_buf(dev, chunk,
+			&st->urb[i].devmem));
+	}
+
+	DBG(DBG_io, "streaming %zu bytes, %d x %zu byte transfers.\n",
+		total, nurbs, chunk);
+
+	CHK(wait_for_pixels(dev, timeout));
+	prev = enter_site(dev, USB_SITE_RECV_PIXELS);
+	ret = write_reg(dev, GL843_RAMADDR, 0);
+	if (ret >= 0)
+		ret = write_bulk_setup(dev, GL843__RAMRDDATA_, total, BULK_IN);
+	leave_site(dev, prev);
+	CHK(ret);
+
+	for (i = 0; i < nurbs; i++)
+		CHK(submit_pixel_urb(dev, &st->urb[i]));
+
+	return 0;
+
+chk_mem_failed:
+	ret = LIBUSB_ERROR_NO_MEM;
+chk_failed:
+	stop_pixel_stream(dev);
+	return ret;
+}
+
+void stop_pixel_stream(struct gl843_device *dev)
+{
+	int i;
+	struct pixel_stream *st = dev->stream;
+
+	if (!st)
+		return;
+
+	for (i = 0; i < st->nurbs; i++) {
+		if (st->urb[i].inflight)
+			libusb_cancel_transfer(st->urb[i].xfer);
+	}
+	for (i = 0; i < st->nurbs; i++) {
+		if (st->urb[i].inflight)
+			wait_pixel_urb(dev, &st->urb[i]);
+		libusb_free_transfer(st->urb[i].xfer);
+		free_xfer_buf(dev, st->urb[i].buf, st->chunk,
+			st->urb[i].devmem);
+	}
+	free(st);
+	dev->stream = NULL;
+}
+
+/* read_pixels() for an active pixel stream */
+static int read_stream_pixels(struct gl843_device *dev,
+			      uint8_t *dst,
+			      size_t len)
+{
+	int ret;
+	size_t n;
+	struct pixel_stream *st = dev->stream;
+	struct pixel_urb *urb;
+
+	while (len > 0) {
+		urb = &st->urb[st->head];
+
+		if (urb->pos == urb->len) {
+			if (!urb->inflight) {
+				DBG(DBG_error, "read past end of pixel stream.\n");
+				return LIBUSB_ERROR_OVERFLOW;
+			}
+			CHK(wait_pixel_urb(dev, urb));
+			DBG(DBG_io, "requested %d bytes, got %d.\n",
+				urb->xfer->length, urb->xfer->actual_length);
+			urb->len = convert_pixels(dev, urb->buf,
+				urb->xfer->actual_length, st->bpp);
+			urb->pos = 0;
+		}
+
+		n = urb->len - urb->pos;
+		n = (len <= n) ? len : n;
+		memcpy(dst, urb->buf + urb->pos, n);
+		dst += n;
+		len -= n;
+		urb->pos += n;
+
+		/* Drained. Recycle the transfer and move on. */
+		if (urb->pos == urb->len) {
+			CHK(submit_pixel_urb(dev, urb));
+			st->head = (st->head + 1) % st->nurbs;
+		}
+	}
+	ret = 0;
+chk_failed:
+	return ret;
+}
+
 /* Receive pixels from the scanner.
  * buf: destination buffer
  * len: bytes to read
@@ -578,6 +1558,9 @@ int read_pixels(struct gl843_device *dev,
 
 	p = dst;
 
+	if (dev->stream)
+		return read_stream_pixels(dev, dst, len);
+
 	if (dev->lbuf == NULL || dev->lbuf_capacity == 0) {
 		DBG(DBG_error0, "BUG: line buffer not initialized.\n");
 		return LIBUSB_ERROR_INVALID_PARAM;
@@ -606,14 +1589,15 @@ int read_pixels(struct gl843_device *dev,
 			n = dev->lbuf_capacity;
 
 			if (len >= dev->lbuf_capacity) {
-				/* Read directly to caller buffer */
-				CHK(wait_for_pixels(dev));
-				CHK(m = recv_pixels(dev, p, n, bpp, timeout));
+				/* Read directly to caller buffer, as many
+				 * whole lines as the scanner has ready. */
+				CHK(m = wait_for_lines(dev, n, len, timeout));
+				CHK(m = recv_pixels(dev, p, m, bpp, timeout));
 				p += m;
 				len -= m;
 			} else {
 				/* Read into line buffer */
-				CHK(wait_for_pixels(dev));
+				CHK(wait_for_lines(dev, n, n, timeout));
 				CHK(m = recv_pixels(dev, dev->lbuf, n, bpp, timeout));
 				dev->lbuf_size = m;
 			}
@@ -18,22 +18,182 @@
 #include <libusb-1.0/libusb.h>
 #include "regs.h"
 #include "convert.h"
+#include "timing.h"
+
+/* GL843 USB protocol */
+
+#define REQ_IN		0xc0
+#define REQ_OUT		0x40
+#define REQ_REG		0x0c
+#define REQ_BUF		0x04
+#define VAL_BUF		0x82
+#define VAL_SET_REG	0x83
+#define VAL_READ_REG	0x84
+
+#define BULK_IN		0
+#define BULK_OUT	1
+
+/* Default number of bulk-in transfers to keep in flight when streaming */
+#define PIXEL_STREAM_URBS 4
+
+/* Max number of IO registers flush_regs() sends in one control transfer */
+#define MAX_REG_BURST 32
+
+/* Read-only status registers, 0x40 - 0x4F. See read_status_snapshot(). */
+#define GL843_STATUS_IOREG 0x40
+#define GL843_STATUS_IOREG_COUNT 16
+
+/* Number of motor acceleration table slots */
+#define GL843_MTRTBL_SLOTS 5
+
+/* Number of registers in the analog frontend (FEWRA is 6 bits) */
+#define GL843_AFE_REGS 64
+
+/* AFE software reset register. Writing it resets all other registers. */
+#define GL843_AFE_RESET 4
+
+/* AFE register and value. See write_afe_regs(). */
+struct afe_ent
+{
+	int reg;
+	int val;
+};
+
+/* Driver functions that USB transfers are counted under.
+ * See get_usb_stats(). */
+enum usb_site
+{
+	USB_SITE_OTHER,
+	USB_SITE_FLUSH_REGS,
+	USB_SITE_READ_REGS,
+	USB_SITE_WRITE_AFE,
+	USB_SITE_SEND_MOTOR_ACCEL,
+	USB_SITE_SEND_GAMMA,
+	USB_SITE_SEND_SHADING,
+	USB_SITE_RECV_PIXELS,
+	USB_SITE_WAIT_FOR_PIXELS,
+	USB_SITE_COUNT
+};
+
+/* Number of latency histogram buckets. Bucket i counts transfers that
+ * took 2^i to 2^(i+1) - 1 µs, the last bucket also longer ones. */
+#define USB_HIST_BUCKETS 24
+
+/* USB transfer statistics for one call site */
+struct usb_stats
+{
+	uint64_t xfers;		/* Transfers */
+	uint64_t bytes;		/* Bytes transferred */
+	uint64_t retries;	/* Retries after LIBUSB_ERROR_INTERRUPTED */
+	uint64_t errors;	/* Failed transfers */
+	uint64_t usec;		/* Total time [µs] */
+	uint64_t hist[USB_HIST_BUCKETS];	/* Latency histogram */
+};
+
+/* Recorded register and motor table writes. See begin_reg_snapshot(). */
+struct reg_snapshot
+{
+	uint8_t touched[GL843_MAX_IOREG + 1];	/* Bits that were set */
+	uint8_t val[GL843_MAX_IOREG + 1];	/* Final values of those bits */
+	size_t mtrtbl_len[GL843_MTRTBL_SLOTS];	/* Entries, 0 = not sent */
+	uint16_t *mtrtbl[GL843_MTRTBL_SLOTS];	/* Motor table contents */
+};
+
+/* One bulk-in transfer in a pixel stream */
+struct pixel_urb
+{
+	struct libusb_transfer *xfer;
+	uint8_t *buf;		/* Transfer buffer, stream->chunk bytes */
+	int devmem;		/* buf is USB device memory */
+	int inflight;		/* Submitted and not yet completed */
+	int done;		/* Completed, set by the transfer callback */
+	size_t len;		/* Bytes of converted data in buf */
+	size_t pos;		/* Bytes already copied to the caller */
+	uint64_t t_submit;	/* When submitted [µs] */
+};
+
+/* Asynchronous bulk-in pixel stream. See start_pixel_stream(). */
+struct pixel_stream
+{
+	int nurbs;		/* Number of transfers in the ring */
+	int head;		/* Next transfer to drain */
+	size_t chunk;		/* Bytes per transfer, a whole number of lines */
+	size_t to_submit;	/* Bytes not yet requested from the scanner */
+	unsigned int bpp;	/* Bits per pixel */
+	unsigned int timeout;	/* USB timeout [ms] */
+	uint64_t t_dry;		/* When the last transfer in flight finished
+				 * [µs], 0 = transfers are in flight */
+	struct pixel_urb urb[0];
+};
+
+/* Non-USB transport to the scanner, e.g the emulator in emu.c.
+ * ctrl_xfer() and bulk_xfer() work like libusb_control_transfer() and
+ * libusb_bulk_transfer().
+ */
+struct gl843_transport
+{
+	const char *name;
+	int (*ctrl_xfer)(struct gl843_transport *t,
+			 uint8_t bmRequestType,
+			 uint8_t bRequest,
+			 uint16_t wValue,
+			 uint16_t wIndex,
+			 unsigned char *data,
+			 uint16_t wLength,
+			 unsigned int timeout);
+	int (*bulk_xfer)(struct gl843_transport *t,
+			 unsigned char endpoint,
+			 unsigned char *data,
+			 int length,
+			 int *transferred,
+			 unsigned int timeout);
+	void (*destroy)(struct gl843_transport *t);
+};
+
+struct setup_snapshot;	/* See setup_scan() in cs4400f.c */
 
 struct gl843_device
 {
+	libusb_context *usbctx;
 	libusb_device_handle *usbdev;
+	struct gl843_transport *xport;	/* Used instead of usbdev if set */
 
 	uint8_t *lbuf;		/* line buffer */
 	size_t lbuf_size;	/* bytes in line buffer */
 	size_t lbuf_capacity;	/* bytes allocated */
+	int lbuf_devmem;	/* lbuf is USB device memory */
+	int no_devmem;		/* 1 = device memory is unsupported */
 
 	struct pixel_converter *pconv;	/* pixel converter */
+	struct pixel_stream *stream;	/* Active pixel stream, or NULL */
 
 	unsigned int max_ioreg;	/* Last IO register address */
 	int min_devreg;	/* Smallest devreg enum */
 	int max_devreg;	/* Largest devreg enum, not counting end marker */
 	int min_dirty;	/* First dirty IO register */
 	int max_dirty;	/* Last dirty IO register */
+	unsigned long flush_saved; /* Control transfers saved by flush_regs() */
+	int burst_read;	/* 1 = read consecutive IO registers in one transfer */
+	int burst_write;	/* Max IO registers written per transfer,
+				 * 1 or MAX_REG_BURST */
+	unsigned int line_time;	/* Expected time per scanned line [µs],
+				 * 0 = unknown. Sets the buffer polling rate. */
+	size_t bufsize;		/* Scanner image buffer [bytes], 0 = unknown */
+	int buf_full;		/* 1 = the last poll found the buffer full */
+	uint64_t mtrtbl_hash[GL843_MTRTBL_SLOTS]; /* Hash of the table in
+						   * each slot, 0 = unknown */
+	uint8_t afe[GL843_AFE_REGS];	/* Shadow AFE registers */
+	uint64_t afe_known;	/* Bit n set = afe[n] is what the AFE holds */
+	int afe_pending;	/* 1 = the last AFE write may not be done yet */
+	enum usb_site usb_site;	/* Where transfers are counted now */
+	struct usb_stats usb_stats[USB_SITE_COUNT];	/* Updated atomically */
+	uint64_t gamma_hash;	/* Hash of the gamma tables, 0 = unknown.
+				 * SCANRESET leaves the gamma RAM alone. */
+	struct reg_snapshot *rec;	/* Snapshot being recorded, or NULL */
+	struct setup_snapshot *setup_cache;	/* See setup_scan() */
+	int cancel;	/* 1 = stop calibrating or waiting for pixels,
+			 * set from another thread */
+	struct scan_timing timing;	/* Phase times of the current scan */
 
 	const struct regmap_ent *regmap;
 	const char **devreg_names;
@@ -41,12 +201,31 @@ struct gl843_device
 	struct ioregister ioregs[0];	/* Shadow registers */
 };
 
-/* Constructor */
-struct gl843_device *create_gl843dev(libusb_device_handle *h);
+/* Constructor
+ * ctx: libusb context the device was opened in (NULL = default context)
+ * h:   open device handle, or NULL if the caller sets dev->xport.
+ *      The device takes ownership of the transport.
+ */
+struct gl843_device *create_gl843dev(libusb_context *ctx,
+	libusb_device_handle *h);
 
 /* Destructor */
 void destroy_gl843dev(struct gl843_device *dev);
 
+/* Name of a call site, e.g "flush_regs" */
+const char *usb_site_name(enum usb_site site);
+
+/* Get the USB transfer statistics for a call site. Transfers are
+ * counted under the outermost of the functions in enum usb_site, so
+ * e.g the registers written by send_motor_accel() are not counted
+ * under flush_regs(). Can be called while another thread uses dev.
+ */
+void get_usb_stats(struct gl843_device *dev, enum usb_site site,
+		   struct usb_stats *st);
+
+/* Print the USB transfer statistics (debug level 2) */
+void dump_usb_stats(struct gl843_device *dev);
+
 /* Range checking of IO register addresses (for debugging) */
 #define IOREG(addr) chk_ioreg((addr), __func__, __LINE__)
 int chk_ioreg(int addr, const char *func, int line);
@@ -69,7 +248,8 @@ void set_regs(struct gl843_device *dev, struct regset_ent *regset, size_t len);
  * The caller must mark the end of the list with -1.
  *
  * Note: The registers are read from the scanner ordered from low to high
- * IO register address. Therefore, you should avoid touching registers that
+ * IO register address, and runs of consecutive IO registers are read
+ * in a single batch. Therefore, you should avoid touching registers that
  * will change the scanner's internal state when read, unless you know
  * what you're doing. Access such registers with read_reg() instead.
  */
@@ -78,7 +258,59 @@ int read_regs(struct gl843_device *dev, ...);
 /* Read a single scanner register. */
 int read_reg(struct gl843_device *dev, enum gl843_reg reg);
 
-/* Send all dirty shadow registers to the scanner */
+/* Read the status registers (IO registers 0x40 - 0x4F) into the
+ * register cache in one batch. Fetch the values with get_reg() afterwards,
+ * e.g get_reg(dev, GL843_HOMESNR) or get_reg(dev, GL843_FEDCNT).
+ */
+int read_status_snapshot(struct gl843_device *dev);
+
+/* Check that writing several IO registers in one transfer works.
+ * Writes a test pattern to the exposure registers in one transfer, reads
+ * it back one register at a time, and sets dev->burst_write to 1 if it
+ * differs. The registers are restored afterwards. Call once, before
+ * probe_burst_read() and before scanning.
+ */
+int probe_burst_write(struct gl843_device *dev);
+
+/* Check that reading several IO registers in one transfer works, i.e
+ * that the scanner auto-increments the register address. Compares a
+ * burst read of a test pattern in the exposure registers with single
+ * reads, and clears dev->burst_read if they differ. The exposure
+ * registers are restored afterwards. Call once, before scanning.
+ */
+int probe_burst_read(struct gl843_device *dev);
+
+/* Start recording register and motor table writes into a new snapshot.
+ * Every IO register set with set_reg() and friends, and every table sent
+ * with send_motor_accel(), is remembered until end_reg_snapshot().
+ * Returns 0 or LIBUSB_ERROR_NO_MEM.
+ */
+int begin_reg_snapshot(struct gl843_device *dev);
+
+/* Stop recording and return the snapshot, with the final values of the
+ * recorded registers. Free it with free_reg_snapshot().
+ */
+struct reg_snapshot *end_reg_snapshot(struct gl843_device *dev);
+
+void free_reg_snapshot(struct reg_snapshot *snap);
+
+/* Load a recorded snapshot into the shadow registers and send it.
+ * Only the recorded bits are changed; other bits in the same IO register
+ * keep their current values. Only the registers and motor tables that
+ * differ from what the scanner already holds are transferred.
+ */
+int replay_reg_snapshot(struct gl843_device *dev,
+			const struct reg_snapshot *snap);
+
+/* Send all dirty shadow registers to the scanner.
+ *
+ * Dirty registers whose value is already in the device (see devval in
+ * struct ioregister) are not sent again. The others are sent as a stream
+ * of address/value pairs, up to dev->burst_write registers per control
+ * transfer. The number of
+ * transfers saved compared to one register per transfer is accumulated
+ * in dev->flush_saved.
+ */
 int flush_regs(struct gl843_device *dev);
 
 /* Write a single scanner register */
@@ -90,34 +322,69 @@ int write_regs(struct gl843_device *dev, struct regset_ent *regset, size_t len);
 /* Write a configuration register in the analog front end (the A/D-converter) */
 int write_afe(struct gl843_device *dev, int reg, int val);
 
+/* Write several AFE registers, in order.
+ *
+ * Values the AFE is known to hold already are skipped. The busy flag is
+ * only polled if no status read has shown that the last write is done.
+ */
+int write_afe_regs(struct gl843_device *dev,
+		   const struct afe_ent *regs, size_t n);
+
 /* Send motor acceleration table.
  *
  * table: table number, 1 to 5
  * tbl:   data
  * len:   number of entries (typically 1020)
+ *
+ * The device remembers a hash of the table in each slot, and skips
+ * uploading tables that are already there. reset_scanner() clears
+ * this cache.
  */
-int send_motor_accel(struct gl843_device *dev, int table, uint16_t *tbl,
-	size_t len);
+int send_motor_accel(struct gl843_device *dev, int table,
+	const uint16_t *tbl, size_t len);
 
-/* Send gamma correction table.
+/* Send the gamma correction tables, unless they are already there.
  *
- * table: table number, 1 to 3 (R,G,B)
- * tbl:   data
- * len:   number of entries (typically 256)
+ * tbl:   red, green and blue tables, len 16-bit entries each
+ * len:   number of entries per table (256)
  */
-int send_gamma_table(struct gl843_device *dev, int table, uint8_t *tbl,
+int send_gamma_tables(struct gl843_device *dev, const uint16_t *tbl,
 	size_t len);
 
+/* Shading RAM layout: 42 pixels of offset/gain pairs per 512-byte
+ * block. The scanner ignores the last 8 bytes in every block,
+ * probably because they are less than a full pixel. */
+#define SHADING_BLOCK 512			/* Block size [bytes] */
+#define SHADING_BLOCK_PIXELS 42			/* Pixels per block */
+#define SHADING_SIZE(width) \
+	(((width) + SHADING_BLOCK_PIXELS - 1) / SHADING_BLOCK_PIXELS \
+		* SHADING_BLOCK)		/* Bytes for width pixels */
+
 /* Send shading correction
  *
- * buf: shading buffer
- * len: buffer size in bytes
+ * buf: shading buffer, in the block layout above, little endian
+ * len: buffer size in bytes, a multiple of SHADING_BLOCK
+ *
+ * Not used yet: shading calibration is disabled (see calc_shading() in
+ * scan.c), so neither the layout nor the single transfer has been tried
+ * on a scanner.
  */
 int send_shading(struct gl843_device *dev, uint16_t *buf, size_t len, int addr);
 
+/* Reset the scanner (SCANRESET). Always use this instead of
+ * writing SCANRESET directly, so the driver state is reset too. */
 int reset_scanner(struct gl843_device *dev);
 
-int wait_for_pixels(struct gl843_device *dev);
+/* Wait until the scanner has pixel data to send.
+ * The buffer fill level (VALIDWORD) is polled about once per expected
+ * line period, see dev->line_time.
+ *
+ * timeout: [ms]
+ *
+ * Returns 0, LIBUSB_ERROR_TIMEOUT if no data came within timeout ms,
+ * or LIBUSB_ERROR_INTERRUPTED if dev->cancel was set.
+ */
+int wait_for_pixels(struct gl843_device *dev, unsigned int timeout);
 
 int start_scan(struct gl843_device *dev);
 
@@ -127,11 +394,34 @@ int start_scan(struct gl843_device *dev);
  */
 uint8_t *init_line_buffer(struct gl843_device *dev, size_t len);
 
+/* Start streaming pixels from the scanner.
+ *
+ * Requests all 'total' bytes of the scan with a single bulk setup packet,
+ * then keeps 'nurbs' bulk-in transfers of one line buffer (or a whole
+ * number of line buffers, see init_line_buffer()) in flight, so the USB bus
+ * is never idle between chunks. read_pixels() drains the stream until
+ * stop_pixel_stream() is called. Does nothing when dev->xport is set;
+ * read_pixels() then reads synchronously.
+ *
+ * total:   bytes to receive, i.e the whole scan
+ * nurbs:   number of transfers to keep in flight
+ * bpp:     bits per pixel
+ * timeout: USB timeout per transfer, and for the first data, [ms]
+ */
+int start_pixel_stream(struct gl843_device *dev, size_t total, int nurbs,
+	unsigned int bpp, unsigned int timeout);
+
+/* Cancel pending transfers and free the pixel stream, if any. */
+void stop_pixel_stream(struct gl843_device *dev);
+
 /* Receive pixels from the scanner.
  * buf: destination buffer
  * len: bytes to read
  * bpp: bits per pixel
  * timeout: USB timeout in milliseconds
+ *
+ * Without a pixel stream, each bulk transfer is sized to the number of
+ * whole lines buffered in the scanner (VALIDWORD).
  */
 int read_pixels(struct gl843_device *dev, uint8_t *dst, size_t len,
 	unsigned int bpp, unsigned int timeout);
@@ -17,7 +17,10 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <string.h>
+#include <ctype.h>
 #include <math.h>
+#include <time.h>
+#include <pthread.h>
 #include <sane/sane.h>
 #include <sane/saneopts.h>
 
@@ -27,6 +30,12 @@
 #include "util.h"
 #include "low.h"
 #include "cs4400f.h"
+#include "convert.h"
+#include "emu.h"
+#include "replay.h"
+#include "reader.h"
+#include "calcache.h"
+#include "timing.h"
 #include "main.h"
 #include "scan.h"
 
@@ -483,7 +492,9 @@ static void free_sane_usb_dev(SANE_USB_Device *s)
 	if (!s)
 		return;
 
-	libusb_unref_device(s->usbdev);
+	if (s->usbdev)
+		libusb_unref_device(s->usbdev);
+	free(s->replay);
 	free((void*)s->sane_dev.name);
 	memset(s, 0, sizeof(*s));
 	free(s);
@@ -512,6 +523,32 @@ chk_mem_failed:
 	return NULL;
 }
 
+/* Emulated scanner, see emu.c, or a replayed capture if replay
+ * is set, see replay.c. It has no USB device. */
+static SANE_USB_Device *mk_sane_emu_dev(const Scanner_Model *model,
+					const char *replay)
+{
+	int ret;
+	SANE_USB_Device *d;
+
+	CHK_MEM(d = calloc(sizeof(*d), 1));
+	CHK(asprintf((char **) &d->sane_dev.name, "%s:%s", model->name,
+		replay ? "replay" : "emulator"));
+	if (replay)
+		CHK_MEM(d->replay = strdup(replay));
+
+	d->sane_dev.vendor = model->vendor;
+	d->sane_dev.model = model->model;
+	d->sane_dev.type = model->type;
+	d->usbdev = NULL;
+	return d;
+
+chk_failed:
+chk_mem_failed:
+	free_sane_usb_dev(d);
+	return NULL;
+}
+
 static void free_sane_usb_devs(SANE_USB_Device **devs)
 {
 	SANE_USB_Device **d;
@@ -560,6 +597,7 @@ void sane_exit()
 		g_libusb_ctx = NULL;
 	}
 	free_sane_usb_devs(g_scanners);
+	free_accel_profiles();
 }
 
 SANE_Status sane_get_devices(const SANE_Device ***device_list,
@@ -606,6 +644,28 @@ SANE_Status sane_get_devices(const SANE_Device ***device_list,
 		CHK_MEM(g_scanners[n] = mk_sane_usb_dev(m, usbdevs[i]));
 		n++;
 	}
+
+	/* Add an emulated scanner if GL843_EMULATOR is set */
+
+	if (getenv("GL843_EMULATOR")) {
+		SANE_USB_Device **tmp;
+		CHK_MEM(tmp = realloc(g_scanners, (n+2)*sizeof(*tmp)));
+		g_scanners = tmp;
+		CHK_MEM(g_scanners[n] = mk_sane_emu_dev(&g_known_models[0],
+			NULL));
+		n++;
+	}
+
+	/* Add a replayed scanner if GL843_REPLAY names a dumpscanner log */
+
+	if (getenv("GL843_REPLAY")) {
+		SANE_USB_Device **tmp;
+		CHK_MEM(tmp = realloc(g_scanners, (n+2)*sizeof(*tmp)));
+		g_scanners = tmp;
+		CHK_MEM(g_scanners[n] = mk_sane_emu_dev(&g_known_models[0],
+			getenv("GL843_REPLAY")));
+		n++;
+	}
 	g_scanners[n] = NULL; /* Add list terminator */
 
 	if (device_list)
@@ -625,30 +685,253 @@ chk_failed:
 	return SANE_STATUS_IO_ERROR;
 }
 
+/* White calibration position for the current source [mm] */
+static float get_cal_y_pos(CS4400F_Scanner *s)
+{
+	if (s->source == LAMP_PLATEN)
+		return SANE_UNFIX(s->y_calpos);
+	else
+		return SANE_UNFIX(s->y_calpos_ta);
+}
+
+/* Warm up and calibrate in the background, so it is done or partly
+ * done when sane_start() is called. Nothing else may use s->hw until
+ * finish_warmup() has been called. The thread only reads the settings
+ * in s->warmup, not the options. */
+static void *warmup_thread(void *arg)
+{
+	int ret;
+	CS4400F_Scanner *s = arg;
+	enum scan_phase phase;
+
+	CHK(reset_scanner(s->hw));
+	CHK(set_lamp(s->hw, s->warmup.source, s->warmup.lamp_timeout));
+	phase = set_scan_phase(&s->hw->timing, SCAN_PHASE_HOME_WAIT);
+	while (!read_reg(s->hw, GL843_HOMESNR)
+			&& !__atomic_load_n(&s->hw->cancel, __ATOMIC_RELAXED))
+		usleep(10000);
+	set_scan_phase(&s->hw->timing, phase);
+	CHK(warm_up_scanner(s->hw, s->warmup.source, s->warmup.lamp_timeout,
+		s->warmup.cal_y_pos, s->calcache, s->warmup.lamp_warm));
+	ret = 0;
+chk_failed:
+	s->warmup_status = ret;
+	return NULL;
+}
+
+static void start_warmup(CS4400F_Scanner *s)
+{
+	if (s->warmup_running || !s->need_warmup)
+		return;
+	s->hw->cancel = 0;
+	s->warmup.source = s->source;
+	s->warmup.lamp_timeout = s->lamp_timeout;
+	s->warmup.cal_y_pos = get_cal_y_pos(s);
+	s->warmup.lamp_warm = s->lamp_warm;
+	if (pthread_create(&s->warmup_thread, NULL, warmup_thread, s) != 0) {
+		DBG(DBG_warn, "Can't start warm-up thread. "
+			"Will warm up in sane_start().\n");
+		return;
+	}
+	s->warmup_running = SANE_TRUE;
+}
+
+/* Wait for the warm-up thread, or stop it if cancel is set */
+static void finish_warmup(CS4400F_Scanner *s, int cancel)
+{
+	if (!s->warmup_running)
+		return;
+	if (cancel)
+		__atomic_store_n(&s->hw->cancel, 1, __ATOMIC_RELAXED);
+	pthread_join(s->warmup_thread, NULL);
+	s->warmup_running = SANE_FALSE;
+	s->hw->cancel = 0;
+
+	if (cancel) {
+		DBG(DBG_info, "warm-up cancelled.\n");
+	} else if (s->warmup_status < 0) {
+		DBG(DBG_warn, "Warm-up failed: %s. Trying again.\n",
+			sanei_libusb_strerror(s->warmup_status));
+	} else {
+		s->need_warmup = SANE_FALSE;
+		s->lamp_warm = SANE_TRUE;
+	}
+}
+
+/* Stop timing the scan, append it to the scan report if enabled,
+ * and start over for the next one. See timing.c. */
+static void finish_scan_timing(CS4400F_Scanner *s, const char *status)
+{
+	const char *path = get_scan_report_path();
+
+	set_scan_phase(&s->hw->timing, SCAN_PHASE_NONE);
+	if (path)
+		write_scan_report(path, &s->hw->timing, &s->setup, status);
+	reset_scan_timing(&s->hw->timing);
+}
+
+/* Gamma tables for the current mode, one per color component */
+static void get_gamma_tables(CS4400F_Scanner *s, const SANE_Word *g[3])
+{
+	if (s->mode == SANE_FRAME_RGB) {
+		g[0] = s->red_gamma;
+		g[1] = s->green_gamma;
+		g[2] = s->blue_gamma;
+	} else {
+		g[0] = g[1] = g[2] = s->gray_gamma;
+	}
+}
+
+/* Send the custom gamma tables to the scanner, for 8-bit and
+ * lineart scans. */
+static int send_gamma(CS4400F_Scanner *s)
+{
+	int ret, c, i;
+	const int len = s->gamma_len;
+	const SANE_Word *g[3];
+	uint16_t *tbl = NULL;
+
+	CHK_MEM(tbl = malloc(3 * len * sizeof(*tbl)));
+	get_gamma_tables(s, g);
+	for (c = 0; c < 3; c++) {
+		for (i = 0; i < len; i++)
+			tbl[c * len + i] = g[c][i];
+	}
+	CHK(send_gamma_tables(s->hw, tbl, len));
+chk_failed:
+	free(tbl);
+	return ret;
+chk_mem_failed:
+	ret = LIBUSB_ERROR_NO_MEM;
+	goto chk_failed;
+}
+
 static void destroy_scanner(CS4400F_Scanner *s)
 {
 	if (!s)
 		return;
+	finish_warmup(s, 1);
+	stop_pixel_reader(s->reader);
+	if (s->calcache) {
+		/* Approximate the lamp time with the time the device
+		 * was open */
+		add_lamp_time(s->calcache, time(NULL) - s->open_time);
+		close_cal_cache(s->calcache);
+	}
 	if (s->hw) {
-		libusb_close(s->hw->usbdev);
+		/* Close after destroy_gl843dev(), which may need the
+		 * handle to cancel transfers and free device memory. */
+		libusb_device_handle *h = s->hw->usbdev;
+		dump_usb_stats(s->hw);
+		free_setup_cache(s->hw);
 		destroy_gl843dev(s->hw);
+		if (h)
+			libusb_close(h);
 	}
 	memset(s, 0, sizeof(*s));
 	free(s);
 }
 
-static SANE_Status create_scanner(libusb_device *usbdev, CS4400F_Scanner **scanner)
+/* Name of the calibration cache for a scanner. Calibrations belong to
+ * one unit, so USB scanners are told apart by their serial number, or,
+ * if they have none, by the USB port they are plugged into. Bus:address
+ * is not used since it changes every time the scanner is plugged in.
+ * Returns a malloc'ed string, or NULL if out of memory.
+ */
+static char *get_cal_cache_name(SANE_USB_Device *dev, libusb_device_handle *h)
+{
+	int i, n = 0;
+	char *name, *id = NULL;
+	unsigned char serial[64];
+	uint8_t ports[8];
+	struct libusb_device_descriptor desc;
+
+	name = strdup(dev->sane_dev.name);
+	if (!name)
+		return NULL;
+	if (!dev->usbdev) {
+		*strchrnul(name, ':') = '-';
+		return name;
+	}
+	*strchrnul(name, ':') = '\0';	/* Drop bus:address */
+
+	if (libusb_get_device_descriptor(dev->usbdev, &desc) == 0
+			&& desc.iSerialNumber != 0) {
+		n = libusb_get_string_descriptor_ascii(h, desc.iSerialNumber,
+			serial, sizeof(serial));
+	}
+	if (n > 0) {
+		/* It becomes part of a file name */
+		for (i = 0; i < n; i++) {
+			if (!isalnum(serial[i]))
+				serial[i] = '_';
+		}
+		if (asprintf(&id, "%s-%.*s", name, n, serial) < 0)
+			id = NULL;
+	} else {
+		DBG(DBG_info, "The scanner has no serial number. Keeping "
+			"its calibrations per USB port.\n");
+		n = libusb_get_port_numbers(dev->usbdev, ports, sizeof(ports));
+		if (asprintf(&id, "%s-%d", name,
+				libusb_get_bus_number(dev->usbdev)) < 0)
+			id = NULL;
+		for (i = 0; id && i < n; i++) {
+			char *t = id;
+			if (asprintf(&id, "%s%c%d", t, i ? '.' : '-',
+					ports[i]) < 0)
+				id = NULL;
+			free(t);
+		}
+	}
+	free(name);
+	return id;
+}
+
+static SANE_Status create_scanner(SANE_USB_Device *dev,
+				  CS4400F_Scanner **scanner)
 {
 	int ret;
-	libusb_device_handle *h;
+	libusb_device_handle *h = NULL;
 	CS4400F_Scanner *s = NULL;
+	const char *line_time;
+	char *name;
 
-	CHK(libusb_open(usbdev, &h));
-	CHK(libusb_set_configuration(h, 1));
-	CHK(libusb_claim_interface(h, 0));
+	if (dev->usbdev) {
+		CHK(libusb_open(dev->usbdev, &h));
+		CHK(libusb_set_configuration(h, 1));
+		CHK(libusb_claim_interface(h, 0));
+	}
 	CHK_MEM(s = create_CS4400F());
-	CHK_MEM(s->hw = create_gl843dev(h));
+	CHK_MEM(s->hw = create_gl843dev(g_libusb_ctx, h));
+	if (dev->replay) {
+		s->hw->xport = create_gl843_replay(dev->replay);
+		if (!s->hw->xport)
+			goto chk_failed;
+	} else if (!dev->usbdev) {
+		/* Emulated scanner. GL843_EMULATOR_LINE_TIME sets the
+		 * line time in microseconds, 0 or unset = realistic. */
+		line_time = getenv("GL843_EMULATOR_LINE_TIME");
+		CHK_MEM(s->hw->xport = create_gl843_emulator(
+			line_time ? atoi(line_time) : 0));
+	}
+	if (!dev->replay) {
+		/* Replays must see the same USB traffic as the capture,
+		 * so they always calibrate. */
+		CHK_MEM(name = get_cal_cache_name(dev, h));
+		s->calcache = open_cal_cache(name);
+		free(name);
+	}
 	CHK(setup_static(s->hw));
+	CHK(probe_burst_write(s->hw));
+	CHK(probe_burst_read(s->hw));
+
+	/* Even if the lamp is on, another session may have turned it on
+	 * moments ago. Only trust lamp_warm after this handle has warmed it
+	 * up; until then, the cached calibration is applied after
+	 * warm_up_lamp(), which is quick if the lamp is already warm. */
+	s->lamp_warm = SANE_FALSE;
+	s->open_time = time(NULL);
+
 	/* Begin warming up the lamp before the user configures the scan.
 	 * This can save time later. */
 	CHK(set_lamp(s->hw, s->source, s->lamp_timeout));
@@ -695,7 +978,8 @@ SANE_Status sane_open(SANE_String_Const devicename,
 		return SANE_STATUS_INVAL; /* No device found */
 	}
 
-	CHK_SANE(create_scanner(dev->usbdev, &s));
+	CHK_SANE(create_scanner(dev, &s));
+	start_warmup(s);
 
 	*handle = s;
 	return SANE_STATUS_GOOD;
@@ -840,9 +1124,15 @@ SANE_Status sane_control_option(SANE_Handle handle,
 			break;
 		case OPT_SOURCE:
 			i = find_constraint_string(value, s->source_names);
-			s->need_warmup |= (s->source != s->sources[i+1]);
+			if (s->source != s->sources[i+1]) {
+				/* Calibrate for the new source instead */
+				finish_warmup(s, 1);
+				s->need_warmup = SANE_TRUE;
+				s->lamp_warm = SANE_FALSE;
+			}
 			s->need_shading |= s->need_warmup;
 			s->source = s->sources[i+1];
+			start_warmup(s);
 			flags |= SANE_INFO_RELOAD_PARAMS;
 			break;
 		case OPT_BIT_DEPTH:
@@ -876,11 +1166,6 @@ SANE_Status sane_control_option(SANE_Handle handle,
 
 			s->use_gamma = val->w;
 
-			if (s->use_gamma && s->depth == 16) {
-				s->depth = 8;
-				flags |= SANE_INFO_RELOAD_PARAMS;
-			}
-
 			if (s->use_gamma && s->mode == SANE_FRAME_RGB) {
 				/* Enable color gamma, disable gray gamma */
 				disable_option(s, OPT_GAMMA_VECTOR);
@@ -995,12 +1280,13 @@ SANE_Status sane_start(SANE_Handle handle)
 	ss->bwhys = SANE_UNFIX(s->bw_hysteresis) * 255 / 100;
 
 	ss->use_backtracking = 1; /* TODO: Make user controllable */
+	ss->use_gamma = s->use_gamma;
 
-	if (s->source == LAMP_PLATEN) {
-		cal_y_pos = SANE_UNFIX(s->y_calpos);
-	} else {
-		cal_y_pos = SANE_UNFIX(s->y_calpos_ta);
-	}
+	cal_y_pos = get_cal_y_pos(s);
+
+	/* Wait for the warm-up started in sane_open(), if any */
+
+	finish_warmup(s, 0);
 
 	/* See if the lamp was turned off */
 
@@ -1009,30 +1295,43 @@ SANE_Status sane_start(SANE_Handle handle)
 	if (ret == 0) {  /* Lamp is off */
 		DBG(DBG_msg, "The lamp was turned off, will perform warm-up.\n");
 		s->need_warmup = SANE_TRUE;
+		s->lamp_warm = SANE_FALSE;
 	}
 
 	/* Ensure the head is home. */
 
+	set_scan_phase(&s->hw->timing, SCAN_PHASE_HOME_WAIT);
 	CHK(reset_scanner(s->hw));
 	CHK(set_lamp(s->hw, s->source, s->lamp_timeout));
 	while(!read_reg(s->hw, GL843_HOMESNR))
 		usleep(10000);
+	set_scan_phase(&s->hw->timing, SCAN_PHASE_NONE);
 
 	/* Warm up */
 
 	if (s->need_warmup) {
-		CHK(warm_up_scanner(s->hw, s->source, s->lamp_timeout, cal_y_pos));
+		CHK(warm_up_scanner(s->hw, s->source, s->lamp_timeout,
+			cal_y_pos, s->calcache, s->lamp_warm));
 		s->need_warmup = SANE_FALSE;
+		s->lamp_warm = SANE_TRUE;
 	}
 
 	/* TODO: Set up shading correction */
 
+	set_scan_phase(&s->hw->timing, SCAN_PHASE_SHADING);
 	if (s->need_shading) {
 		s->need_shading = SANE_FALSE;
 	}
 
 	/* TODO: Set up shading correction for current resolution and width */
-	/* TODO: Gamma correction */
+
+	/* Custom gamma correction. The scanner only does it for 8-bit and
+	 * lineart scans, so 16-bit scans are corrected in software.
+	 * Without custom gamma, the scanner's gamma is turned off. */
+
+	set_scan_phase(&s->hw->timing, SCAN_PHASE_REG_SETUP);
+	if (s->use_gamma && s->depth < 16)
+		CHK(send_gamma(s));
 
 	s->bytes_left = p.bytes_per_line * p.lines;
 
@@ -1046,14 +1345,31 @@ SANE_Status sane_start(SANE_Handle handle)
 
 	CHK(setup_common(s->hw, ss));
 	s->hw->pconv = setup_pixel_converter(ss);
-	CHK(setup_horizontal(s->hw, ss));
-	CHK(setup_vertical(s->hw, ss, 0));
+	if (s->use_gamma && s->depth == 16 && s->hw->pconv) {
+		const SANE_Word *g[3];
+		get_gamma_tables(s, g);
+		CHK_MEM(s->hw->pconv->lut = create_gamma_lut(g,
+			s->hw->pconv->ncomp, s->gamma_len));
+	}
+	CHK(setup_scan(s->hw, ss, 0));
+	set_scan_phase(&s->hw->timing, SCAN_PHASE_FIRST_PIXEL);
 	CHK(start_scan(s->hw));
+	CHK(start_pixel_stream(s->hw, p.bytes_per_line * (ss->height + ss->overscan),
+		PIXEL_STREAM_URBS, ss->fmt, 10000));
+	s->reader = start_pixel_reader(s->hw,
+		p.bytes_per_line * (ss->height + ss->overscan), s->bytes_left,
+		p.bytes_per_line, ss->fmt, 10000);
+	if (!s->reader)
+		goto chk_mem_failed;
+	s->non_blocking = SANE_FALSE;
+	/* The reader switches to SCAN_PHASE_STREAMING, see timing.c */
 
 	return SANE_STATUS_GOOD;
 chk_failed:
+	finish_scan_timing(s, "failed");
 	return SANE_STATUS_IO_ERROR;
 chk_mem_failed:
+	finish_scan_timing(s, "failed");
 	return SANE_STATUS_NO_MEM;
 }
 
@@ -1074,12 +1390,19 @@ SANE_Status sane_read(SANE_Handle handle,
 	DBG(DBG_info, "%d bytes left %d bytes requested.\n",
 		s->bytes_left, max_length);
 
+	if (!s->reader)
+		return SANE_STATUS_CANCELLED;
+
 	len = s->bytes_left > max_length ? max_length : s->bytes_left;
-	CHK(read_pixels(s->hw, data, len, s->setup.fmt, 10000));
+	CHK(len = pixel_reader_read(s->reader, data, len, s->non_blocking));
 
 	s->bytes_left -= len;
 	*length = len;
 
+	/* The head goes home by itself after the last line (AGOHOME) */
+	if (s->bytes_left == 0)
+		set_scan_phase(&s->hw->timing, SCAN_PHASE_HEAD_RETURN);
+
 	return SANE_STATUS_GOOD;
 chk_failed:
 	return SANE_STATUS_IO_ERROR;
@@ -1089,24 +1412,52 @@ void sane_cancel(SANE_Handle handle)
 {
 	int ret;
 	CS4400F_Scanner *s = (CS4400F_Scanner *) handle;
+	int scanning = (s->reader != NULL);
+
+	/* sane_cancel() may come before sane_start() */
+	finish_warmup(s, 1);
+	stop_pixel_reader(s->reader);
+	s->reader = NULL;
+	stop_pixel_stream(s->hw);
 	destroy_pixel_converter(s->hw->pconv);
 	s->hw->pconv = NULL;
+	if (scanning)
+		set_scan_phase(&s->hw->timing, SCAN_PHASE_HEAD_RETURN);
 	CHK(reset_scanner(s->hw));
 	CHK(set_lamp(s->hw, s->source, s->lamp_timeout));
+
+	/* Time the whole head return when reporting. Otherwise
+	 * sane_start() waits for it. */
+	if (scanning && get_scan_report_path()) {
+		while (!read_reg(s->hw, GL843_HOMESNR))
+			usleep(10000);
+	}
 chk_failed:
+	if (scanning) {
+		finish_scan_timing(s, (ret < 0) ? "failed"
+			: (s->bytes_left > 0) ? "cancelled" : "complete");
+	}
 	return;
 }
 
 SANE_Status sane_set_io_mode(SANE_Handle handle, SANE_Bool non_blocking)
 {
-	if (non_blocking == SANE_FALSE)
-		return SANE_STATUS_GOOD;
-	return SANE_STATUS_UNSUPPORTED;
+	CS4400F_Scanner *s = (CS4400F_Scanner *) handle;
+
+	if (!s->reader)
+		return SANE_STATUS_INVAL;	/* Not scanning */
+	s->non_blocking = non_blocking;
+	return SANE_STATUS_GOOD;
 }
 
 SANE_Status sane_get_select_fd(SANE_Handle handle, SANE_Int *fd)
 {
-	return SANE_STATUS_UNSUPPORTED;
+	CS4400F_Scanner *s = (CS4400F_Scanner *) handle;
+
+	if (!s->reader)
+		return SANE_STATUS_INVAL;	/* Not scanning */
+	*fd = pixel_reader_fd(s->reader);
+	return SANE_STATUS_GOOD;
 }
 
 
@@ -72,6 +72,7 @@ typedef struct
 {
 	SANE_Device sane_dev;
 	libusb_device *usbdev;
+	char *replay;	/* dumpscanner log to replay, see replay.c */
 
 } SANE_USB_Device;
 
@@ -84,6 +85,22 @@ typedef struct
 	SANE_Bool need_shading;
 	SANE_Bool is_scanning;
 
+	struct cal_cache *calcache; /* Saved calibrations, see calcache.c */
+	SANE_Bool lamp_warm;	/* The lamp has been on since warm-up */
+	time_t open_time;	/* When the lamp was turned on [s] */
+
+	pthread_t warmup_thread; /* Warms up while options are set */
+	SANE_Bool warmup_running;
+	int warmup_status;	/* Result of the warm-up thread */
+	/* Settings for the warm-up thread. Copied when it starts, since
+	 * the options can change while it runs. */
+	struct {
+		enum gl843_lamp source;
+		int lamp_timeout;	/* [minutes] */
+		float cal_y_pos;	/* [mm] */
+		SANE_Bool lamp_warm;
+	} warmup;
+
 	SANE_Option_Descriptor opt[OPT_NUM_OPTIONS];
 
 	/* Lamp settings */
@@ -131,6 +148,8 @@ typedef struct
 
 	struct scan_setup setup; /* Scanner setup for current image format */
 	int bytes_left;		/* Bytes left to read by the SANE frontend */
+	struct pixel_reader *reader; /* Reads pixels during a scan */
+	SANE_Bool non_blocking;	/* sane_read() doesn't wait for pixels */
 
 	/* Gamma correction tables */
 
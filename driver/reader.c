@@ -0,0 +1,538 @@
+/* Background pixel reader
+ *
+ * Copyright (C) 2010 Andreas Robinson <andr345 at gmail dot com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+/* Scans are read in a three-stage pipeline, so that receiving,
+ * converting and delivering pixels overlap:
+ *
+ * 1. The receive thread reads raw pixels from the scanner into chunks
+ *    from the raw pool.
+ * 2. The convert thread runs the raw chunks through the pixel converter
+ *    (byte order, color order and line distance correction), into
+ *    chunks from the output pool, and returns the raw chunks.
+ * 3. sane_read() copies the converted chunks to the frontend and
+ *    returns them.
+ *
+ * A chunk is a whole number of lines. Chunks move between the stages in
+ * lock-free single-producer, single-consumer queues. A NULL chunk marks
+ * the end of the data. Semaphores count the chunks in the queues, so
+ * that a stage can sleep while it has nothing to do.
+ *
+ * For the last queue, the count is instead the number of bytes in a
+ * pipe, one per chunk. The read end of the pipe is therefore readable
+ * when sane_read() has data to return, which is what
+ * sane_get_select_fd() needs.
+ *
+ * Each stage records how long it waited for input and for free
+ * chunks, and how full the queues were. They are printed when the
+ * reader stops, to show which stage limits the speed.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <libusb-1.0/libusb.h>
+#include <sane/sane.h>
+
+#include "low.h"
+#include "convert.h"
+#include "util.h"
+#include "sanei.h"
+#include "reader.h"
+
+struct chunk
+{
+	uint8_t *buf;
+	size_t len;		/* Bytes of pixels in buf */
+};
+
+/* Lock-free single-producer, single-consumer queue of chunks */
+struct spsc_queue
+{
+	struct chunk **slot;
+	unsigned int mask;	/* Number of slots - 1 */
+	unsigned int head;	/* Next slot to pop, written by the consumer */
+	unsigned int tail;	/* Next slot to push, written by the producer */
+};
+
+/* Chunks owned by one stage. They go to the next stage in full,
+ * and come back in free. */
+struct chunk_pool
+{
+	struct chunk *chunks;
+	int n;			/* Number of chunks */
+	size_t size;		/* Bytes per chunk */
+	struct spsc_queue full;
+	struct spsc_queue free;
+	sem_t nfull;		/* Chunks in full (raw pool only) */
+	sem_t nfree;		/* Chunks in free */
+
+	unsigned long pushes;	/* Chunks pushed to full */
+	unsigned long occ_sum;	/* Sum of chunks in full, after each push */
+	unsigned int occ_max;	/* Max chunks in full */
+};
+
+struct stage_stats
+{
+	unsigned long chunks;	/* Chunks produced */
+	uint64_t bytes;		/* Bytes produced */
+	double wait_in;		/* Time spent waiting for input [ms] */
+	double wait_out;	/* Time spent waiting for a free chunk [ms] */
+};
+
+struct pixel_reader
+{
+	struct gl843_device *dev;
+	struct pixel_converter *pconv;	/* Taken from dev while running */
+	size_t in_total;	/* Bytes to receive */
+	size_t out_total;	/* Bytes to deliver */
+	size_t line_bytes;	/* Bytes per line */
+	unsigned int bpp;	/* Bits per pixel */
+	unsigned int timeout;	/* USB timeout [ms] */
+
+	struct chunk_pool raw;	/* Receive -> convert */
+	struct chunk_pool out;	/* Convert -> deliver */
+	int fd[2];		/* Pipe, see above */
+
+	pthread_t receiver;
+	pthread_t converter;
+	int nthreads;		/* Threads started */
+	int stop;		/* 1 = the threads should stop */
+	int status;		/* Error code from read_pixels() */
+
+	/* sane_read() side */
+
+	struct chunk *cur;	/* Chunk being delivered */
+	size_t pos;		/* Bytes delivered from cur */
+	size_t taken;		/* Bytes delivered in total */
+	int eof;		/* Got the end marker */
+
+	struct stage_stats st_recv;
+	struct stage_stats st_conv;
+	struct stage_stats st_deliver;
+};
+
+static int init_queue(struct spsc_queue *q, int n)
+{
+	unsigned int size = 1;
+
+	while (size < (unsigned int) n)
+		size <<= 1;
+	q->slot = calloc(size, sizeof(q->slot[0]));
+	q->mask = size - 1;
+	q->head = 0;
+	q->tail = 0;
+	return q->slot ? 0 : LIBUSB_ERROR_NO_MEM;
+}
+
+/* Never fails; the queues have room for every chunk and the end marker */
+static void spsc_push(struct spsc_queue *q, struct chunk *c)
+{
+	unsigned int t = q->tail;
+
+	q->slot[t & q->mask] = c;
+	__atomic_store_n(&q->tail, t + 1, __ATOMIC_RELEASE);
+}
+
+/* Call only when the queue has an entry, i.e after a semaphore wait */
+static struct chunk *spsc_pop(struct spsc_queue *q)
+{
+	unsigned int h = q->head;
+	struct chunk *c;
+
+	if (h == __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE)) {
+		DBG(DBG_error0, "BUG: queue is empty.\n");
+		return NULL;
+	}
+	c = q->slot[h & q->mask];
+	__atomic_store_n(&q->head, h + 1, __ATOMIC_RELEASE);
+	return c;
+}
+
+/* Push a chunk to the next stage and update the statistics */
+static void push_full(struct chunk_pool *pool, struct chunk *c)
+{
+	unsigned int occ;
+
+	spsc_push(&pool->full, c);
+	occ = pool->full.tail - __atomic_load_n(&pool->full.head,
+		__ATOMIC_ACQUIRE);
+	pool->pushes++;
+	pool->occ_sum += occ;
+	if (occ > pool->occ_max)
+		pool->occ_max = occ;
+}
+
+static int init_pool(struct chunk_pool *pool, int n, size_t size)
+{
+	int i;
+
+	sem_init(&pool->nfull, 0, 0);
+	sem_init(&pool->nfree, 0, n);
+	pool->n = n;
+	pool->size = size;
+	CHK_MEM(pool->chunks = calloc(n, sizeof(pool->chunks[0])));
+	if (init_queue(&pool->full, n + 1) < 0)
+		goto chk_mem_failed;
+	if (init_queue(&pool->free, n + 1) < 0)
+		goto chk_mem_failed;
+	for (i = 0; i < n; i++) {
+		CHK_MEM(pool->chunks[i].buf = malloc(size));
+		spsc_push(&pool->free, &pool->chunks[i]);
+	}
+	return 0;
+
+chk_mem_failed:
+	return LIBUSB_ERROR_NO_MEM;
+}
+
+/* Also for pools that init_pool() failed on, or never saw */
+static void free_pool(struct chunk_pool *pool)
+{
+	int i;
+
+	if (pool->n == 0)
+		return;
+	if (pool->chunks) {
+		for (i = 0; i < pool->n; i++)
+			free(pool->chunks[i].buf);
+	}
+	free(pool->chunks);
+	free(pool->full.slot);
+	free(pool->free.slot);
+	sem_destroy(&pool->nfull);
+	sem_destroy(&pool->nfree);
+}
+
+static int stopping(struct pixel_reader *r)
+{
+	return __atomic_load_n(&r->stop, __ATOMIC_ACQUIRE);
+}
+
+/* Wait for a semaphore and add the time waited to *ms.
+ * Returns 0 if the reader is stopping, else 1. */
+static int wait_sem(struct pixel_reader *r, sem_t *sem, double *ms)
+{
+	struct dbg_timer t;
+
+	if (sem_trywait(sem) < 0) {
+		init_timer(&t, CLOCK_MONOTONIC);
+		while (sem_wait(sem) < 0 && errno == EINTR)
+			;
+		*ms += get_timer(&t);
+	}
+	return !stopping(r);
+}
+
+/* Stage 1: Receive raw pixels */
+static void *receive_thread(void *arg)
+{
+	int ret;
+	size_t done = 0, n, m;
+	struct pixel_reader *r = arg;
+	struct chunk_pool *raw = &r->raw;
+	struct chunk *c;
+
+	while (done < r->in_total) {
+		if (!wait_sem(r, &raw->nfree, &r->st_recv.wait_out))
+			return NULL;
+		c = spsc_pop(&raw->free);
+
+		n = r->in_total - done;
+		if (n > raw->size)
+			n = raw->size;
+
+		/* Read the first line by itself, to time it */
+		m = 0;
+		ret = 0;
+		if (done == 0) {
+			m = min(n, r->line_bytes);
+			ret = read_pixels(r->dev, c->buf, m, r->bpp, r->timeout);
+			if (ret >= 0)
+				mark_first_pixel(&r->dev->timing);
+		}
+		if (ret >= 0 && m < n) {
+			ret = read_pixels(r->dev, c->buf + m, n - m, r->bpp,
+				r->timeout);
+		}
+		if (ret < 0) {
+			DBG(DBG_error, "reading failed: %s\n",
+				sanei_libusb_strerror(ret));
+			__atomic_store_n(&r->status, ret, __ATOMIC_RELEASE);
+			break;
+		}
+		c->len = n;
+		done += n;
+		r->st_recv.chunks++;
+		r->st_recv.bytes += n;
+		push_full(raw, c);
+		sem_post(&raw->nfull);
+	}
+
+	spsc_push(&raw->full, NULL);
+	sem_post(&raw->nfull);
+	return NULL;
+}
+
+/* Stage 2: Convert raw pixels */
+static void *convert_thread(void *arg)
+{
+	size_t n, done = 0;
+	struct pixel_reader *r = arg;
+	struct chunk_pool *raw = &r->raw;
+	struct chunk_pool *out = &r->out;
+	struct chunk *in, *c = NULL;
+	uint8_t b = 0;
+
+	while (1) {
+		if (!wait_sem(r, &raw->nfull, &r->st_conv.wait_in))
+			return NULL;
+		in = spsc_pop(&raw->full);
+		if (!in)
+			break;	/* End of data */
+
+		/* Data past out_total is overscan. Drop it. */
+		if (done < r->out_total) {
+			if (!c) {
+				if (!wait_sem(r, &out->nfree,
+						&r->st_conv.wait_out))
+					return NULL;
+				c = spsc_pop(&out->free);
+			}
+
+			if (r->pconv) {
+				n = r->pconv->convert_to(r->pconv, c->buf,
+					in->buf, 8 * in->len / r->bpp);
+				n = n * r->bpp / 8;
+			} else {
+				memcpy(c->buf, in->buf, in->len);
+				n = in->len;
+			}
+			if (n > r->out_total - done)
+				n = r->out_total - done;
+
+			/* The converter returns nothing until the line
+			 * distance has passed. Keep the chunk until then. */
+			if (n > 0) {
+				c->len = n;
+				done += n;
+				r->st_conv.chunks++;
+				r->st_conv.bytes += n;
+				push_full(out, c);
+				if (write(r->fd[1], &b, 1) != 1)
+					DBG(DBG_error, "pipe write failed\n");
+				c = NULL;
+			}
+		}
+
+		spsc_push(&raw->free, in);
+		sem_post(&raw->nfree);
+	}
+
+	spsc_push(&out->full, NULL);
+	if (write(r->fd[1], &b, 1) != 1)
+		DBG(DBG_error, "pipe write failed\n");
+	return NULL;
+}
+
+static void print_stats(struct pixel_reader *r)
+{
+	DBG(DBG_msg, "receive: %lu chunks, %llu bytes, "
+		"waited %.0f ms for free chunks\n",
+		r->st_recv.chunks, (unsigned long long) r->st_recv.bytes,
+		r->st_recv.wait_out);
+	DBG(DBG_msg, "convert: %lu chunks, %llu bytes, "
+		"waited %.0f ms for input, %.0f ms for free chunks\n",
+		r->st_conv.chunks, (unsigned long long) r->st_conv.bytes,
+		r->st_conv.wait_in, r->st_conv.wait_out);
+	DBG(DBG_msg, "deliver: %lu chunks, %llu bytes, "
+		"waited %.0f ms for input\n",
+		r->st_deliver.chunks, (unsigned long long) r->st_deliver.bytes,
+		r->st_deliver.wait_in);
+	DBG(DBG_msg, "raw queue: %.1f of %d chunks on average, max %u\n",
+		r->raw.pushes ? (double) r->raw.occ_sum / r->raw.pushes : 0.0,
+		r->raw.n, r->raw.occ_max);
+	DBG(DBG_msg, "output queue: %.1f of %d chunks on average, max %u\n",
+		r->out.pushes ? (double) r->out.occ_sum / r->out.pushes : 0.0,
+		r->out.n, r->out.occ_max);
+}
+
+struct pixel_reader *start_pixel_reader(struct gl843_device *dev,
+					size_t in_total,
+					size_t out_total,
+					size_t line_bytes,
+					unsigned int bpp,
+					unsigned int timeout)
+{
+	struct pixel_reader *r;
+	size_t size;
+	int n;
+
+	CHK_MEM(r = calloc(sizeof(*r), 1));
+	r->fd[0] = r->fd[1] = -1;
+	r->dev = dev;
+	r->in_total = in_total;
+	r->out_total = out_total;
+	r->line_bytes = line_bytes;
+	r->bpp = bpp;
+	r->timeout = timeout;
+
+	/* Whole lines, about PIXEL_READER_CHUNK bytes per chunk */
+	size = line_bytes * max(1, PIXEL_READER_CHUNK / line_bytes);
+	n = max(4, PIXEL_READER_POOL / size);
+	if (init_pool(&r->raw, n, size) < 0)
+		goto chk_mem_failed;
+	if (init_pool(&r->out, n, size) < 0)
+		goto chk_mem_failed;
+
+	if (pipe(r->fd) < 0)
+		goto chk_mem_failed;
+	fcntl(r->fd[0], F_SETFL, O_NONBLOCK);
+
+	/* The converter runs in the convert thread */
+	r->pconv = dev->pconv;
+	dev->pconv = NULL;
+
+	if (pthread_create(&r->receiver, NULL, receive_thread, r) != 0)
+		goto chk_mem_failed;
+	r->nthreads++;
+	if (pthread_create(&r->converter, NULL, convert_thread, r) != 0)
+		goto chk_mem_failed;
+	r->nthreads++;
+
+	DBG(DBG_info, "%d + %d chunks of %zu bytes\n", n, n, size);
+	return r;
+
+chk_mem_failed:
+	DBG(DBG_error0, "Can't start the pixel reader.\n");
+	stop_pixel_reader(r);
+	return NULL;
+}
+
+void stop_pixel_reader(struct pixel_reader *r)
+{
+	if (!r)
+		return;
+
+	if (r->nthreads > 0) {
+		__atomic_store_n(&r->stop, 1, __ATOMIC_RELEASE);
+		sem_post(&r->raw.nfree);
+		sem_post(&r->raw.nfull);
+		sem_post(&r->out.nfree);
+		pthread_join(r->receiver, NULL);
+		if (r->nthreads > 1)
+			pthread_join(r->converter, NULL);
+		print_stats(r);
+	}
+	if (r->pconv)
+		r->dev->pconv = r->pconv;
+
+	if (r->fd[0] >= 0) {
+		close(r->fd[0]);
+		close(r->fd[1]);
+	}
+	free_pool(&r->raw);
+	free_pool(&r->out);
+	free(r);
+}
+
+/* Wait until the pipe is readable. Returns 0 if nonblock is set and
+ * it isn't, else 1. */
+static int wait_output(struct pixel_reader *r, int nonblock)
+{
+	struct pollfd pfd = { r->fd[0], POLLIN, 0 };
+	struct dbg_timer t;
+
+	if (poll(&pfd, 1, 0) > 0)
+		return 1;
+	if (nonblock)
+		return 0;
+	init_timer(&t, CLOCK_MONOTONIC);
+	while (poll(&pfd, 1, -1) < 0 && errno == EINTR)
+		;
+	r->st_deliver.wait_in += get_timer(&t);
+	return 1;
+}
+
+/* Stage 3: Deliver converted pixels */
+int pixel_reader_read(struct pixel_reader *r,
+		      uint8_t *dst,
+		      size_t len,
+		      int nonblock)
+{
+	int ret;
+	size_t n, copied = 0;
+	uint8_t b;
+
+	while (copied < len) {
+		if (!r->cur) {
+			if (r->eof)
+				break;
+			/* Only wait if nothing was copied yet */
+			if (!wait_output(r, nonblock || copied > 0))
+				break;
+			if (read(r->fd[0], &b, 1) != 1)
+				break;
+			r->cur = spsc_pop(&r->out.full);
+			r->pos = 0;
+			if (!r->cur) {
+				r->eof = 1;
+				/* Ended early. Keep the pipe readable so that a
+				 * frontend in select() comes back for the error. */
+				if (r->taken + copied < r->out_total
+				    && write(r->fd[1], &b, 1) != 1)
+					DBG(DBG_error, "pipe write failed\n");
+				break;
+			}
+		}
+
+		n = r->cur->len - r->pos;
+		if (n > len - copied)
+			n = len - copied;
+		memcpy(dst + copied, r->cur->buf + r->pos, n);
+		copied += n;
+		r->pos += n;
+
+		if (r->pos == r->cur->len) {
+			r->st_deliver.chunks++;
+			r->st_deliver.bytes += r->cur->len;
+			spsc_push(&r->out.free, r->cur);
+			sem_post(&r->out.nfree);
+			r->cur = NULL;
+		}
+	}
+
+	r->taken += copied;
+	ret = __atomic_load_n(&r->status, __ATOMIC_ACQUIRE);
+	if (copied == 0 && r->eof && ret < 0)
+		return ret;
+	/* Bytes are still owed. Returning 0 would make the caller spin. */
+	if (copied == 0 && r->eof && r->taken < r->out_total) {
+		DBG(DBG_error, "The pixel stream ended %zu bytes early.\n",
+			r->out_total - r->taken);
+		return LIBUSB_ERROR_IO;
+	}
+	return copied;
+}
+
+int pixel_reader_fd(struct pixel_reader *r)
+{
+	return r->fd[0];
+}
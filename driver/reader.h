@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2010 Andreas Robinson <andr345 at gmail dot com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#ifndef _READER_H_
+#define _READER_H_
+
+#include "low.h"
+
+#define PIXEL_READER_CHUNK 65536	/* Approximate chunk size [bytes] */
+#define PIXEL_READER_POOL (4 << 20)	/* Buffer pool per stage [bytes] */
+
+struct pixel_reader;
+
+/* Start threads that receive pixels with read_pixels() and convert
+ * them with dev->pconv. See reader.c. The device must not be used by
+ * anything else until the reader is stopped.
+ *
+ * in_total:   Bytes to receive from the scanner.
+ * out_total:  Bytes to deliver. Converted pixels after these are dropped.
+ * line_bytes: Bytes per line.
+ * bpp:        Bits per pixel.
+ * timeout:    USB timeout [ms].
+ *
+ * Returns NULL if out of memory or the threads can't be started.
+ */
+struct pixel_reader *start_pixel_reader(struct gl843_device *dev,
+					size_t in_total,
+					size_t out_total,
+					size_t line_bytes,
+					unsigned int bpp,
+					unsigned int timeout);
+
+/* Stop the threads, print statistics and free the reader.
+ * The converter is given back to the device. */
+void stop_pixel_reader(struct pixel_reader *r);
+
+/* Take converted pixels.
+ *
+ * len:      Max bytes to take.
+ * nonblock: 0 = wait until there is at least one byte,
+ *           1 = return 0 if there is nothing to take.
+ *
+ * Returns the number of bytes taken, 0 after all bytes have been
+ * taken, or a libusb error code if reading failed. If the stream ends
+ * before all out_total bytes were delivered, the next call returns
+ * LIBUSB_ERROR_IO in either mode, and pixel_reader_fd() stays readable
+ * until then.
+ */
+int pixel_reader_read(struct pixel_reader *r,
+		      uint8_t *dst,
+		      size_t len,
+		      int nonblock);
+
+/* File descriptor that is readable when pixel_reader_read() has
+ * something to return. Only select() or poll() it, don't read it. */
+int pixel_reader_fd(struct pixel_reader *r);
+
+#endif /* _READER_H_ */
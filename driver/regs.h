@@ -49,6 +49,7 @@ struct ioregister
 	int inuse;	/* Defined/declared bits bitmask */
 	int dirty;	/* Dirty bits bitmask */
 	int val;	/* Current value in the I/O register */
+	int devval;	/* Value known to be in the device, -1 = unknown */
 };
 
 /* Enumeration of GL843 device and IO registers. */
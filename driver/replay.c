@@ -0,0 +1,497 @@
+/* Replay of dumpscanner captures
+ *
+ * Copyright (C) 2010 Andreas Robinson <andr345 at gmail dot com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+/* A transport that plays back a session captured by tools/dumpscanner,
+ * typically the Windows driver scanning something, as if it were the
+ * scanner:
+ *
+ * - Register reads return the values read in the capture, per register
+ *   and in order. When the captured values run out, the last value is
+ *   repeated. Registers that were never read return what the host
+ *   wrote to them.
+ * - Bulk reads return the captured bulk data, as one stream, regardless
+ *   of how the capture or the driver splits it into transfers.
+ *   Reads past the end of the capture return zeros.
+ * - VALIDWORD and BUFEMPTY describe the captured bulk data left, so
+ *   the driver never waits for data.
+ * - Writes are accepted and counted, but otherwise ignored.
+ *
+ * Nothing is timed, so the driver runs as fast as it can. When the
+ * transport is destroyed it prints the number of transactions in the
+ * capture and the number the driver made.
+ *
+ * The log format is a sequence of records, an 8-byte header followed by
+ * optional data. The header is: Timestamp [ms] (32 bits, big endian),
+ * command (SCAN_*), data present flag, data length (16 bits, big endian).
+ * dumpscanner splits data of 64 KiB or more into several records with
+ * the same command. Older versions wrote all the data after a truncated
+ * length, which desynchronizes the log; such logs are rejected at the
+ * first bad record.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <libusb-1.0/libusb.h>
+#include <sane/sane.h>
+
+#include "low.h"
+#include "util.h"
+#include "replay.h"
+
+/* Commands in the log, see tools/dumpscanner.c */
+#define SCAN_UNDEF 'x'
+#define SCAN_RD_REG 'r'
+#define SCAN_WR_REG 'w'
+#define SCAN_SEL_REG 's'
+#define SCAN_WR_BYTES 'd'
+#define SCAN_RD_BULK 'R'
+#define SCAN_WR_BULK 'W'
+#define SCAN_RD_ACK 'a'
+#define SCAN_WR_ACK 'b'
+#define SCAN_RD_BULK_ACK 'A'
+#define SCAN_WR_BULK_ACK 'B'
+
+#define REPLAY_BUF_SIZE	(4 << 20)	/* Scanned image buffer [bytes] */
+
+/* Captured values of one IO register */
+struct reg_queue
+{
+	uint8_t *val;
+	size_t len;		/* Number of values */
+	size_t pos;		/* Next value to return */
+	size_t capacity;	/* Number of values allocated */
+};
+
+/* Captured bulk data, pointing into the log */
+struct bulk_chunk
+{
+	const uint8_t *data;
+	size_t len;
+};
+
+/* USB transaction counts */
+struct xfer_count
+{
+	unsigned long sel;	/* Register selects */
+	unsigned long wr_req;	/* Register write requests */
+	unsigned long wr_reg;	/* Registers written */
+	unsigned long rd_req;	/* Register read requests */
+	unsigned long rd_reg;	/* Registers read */
+	unsigned long setup;	/* Bulk setup packets */
+	unsigned long bulk_in;	/* Bulk reads */
+	unsigned long bulk_out;	/* Bulk writes */
+	uint64_t bytes_in;	/* Bytes read in bulk */
+	uint64_t bytes_out;	/* Bytes written in bulk */
+};
+
+struct gl843_replay
+{
+	struct gl843_transport xport;	/* Must be first */
+
+	uint8_t *log;		/* Memory mapped log file */
+	size_t log_size;
+	uint32_t duration;	/* Length of the capture [ms] */
+	unsigned long unknown;	/* URBs dumpscanner didn't recognize */
+
+	uint8_t reg[GL843_MAX_IOREG + 1];	/* Last value read or written */
+	struct reg_queue rq[GL843_MAX_IOREG + 1];
+	int sel;		/* Selected IO register */
+
+	struct bulk_chunk *in;	/* Captured bulk data */
+	size_t n_in;		/* Number of chunks */
+	size_t in_capacity;	/* Number of chunks allocated */
+	size_t cur;		/* Current chunk */
+	size_t off;		/* Bytes read from the current chunk */
+	uint64_t in_left;	/* Captured bytes not yet read */
+	uint64_t padded;	/* Bytes read past the end of the capture */
+
+	struct xfer_count cap;	/* Transactions in the capture */
+	struct xfer_count drv;	/* Transactions made by the driver */
+};
+
+static int push_reg(struct reg_queue *q, uint8_t val)
+{
+	uint8_t *tmp;
+
+	if (q->len == q->capacity) {
+		q->capacity = q->capacity ? 2 * q->capacity : 64;
+		tmp = realloc(q->val, q->capacity);
+		if (!tmp)
+			return LIBUSB_ERROR_NO_MEM;
+		q->val = tmp;
+	}
+	q->val[q->len++] = val;
+	return 0;
+}
+
+static int push_chunk(struct gl843_replay *r, const uint8_t *data, size_t len)
+{
+	struct bulk_chunk *tmp;
+
+	if (r->n_in == r->in_capacity) {
+		r->in_capacity = r->in_capacity ? 2 * r->in_capacity : 256;
+		tmp = realloc(r->in, r->in_capacity * sizeof(*tmp));
+		if (!tmp)
+			return LIBUSB_ERROR_NO_MEM;
+		r->in = tmp;
+	}
+	r->in[r->n_in].data = data;
+	r->in[r->n_in].len = len;
+	r->n_in++;
+	r->in_left += len;
+	return 0;
+}
+
+/* Is cmd one of the SCAN_* commands? */
+static int valid_cmd(int cmd)
+{
+	switch (cmd) {
+	case SCAN_UNDEF:
+	case SCAN_RD_REG:
+	case SCAN_WR_REG:
+	case SCAN_SEL_REG:
+	case SCAN_WR_BYTES:
+	case SCAN_RD_BULK:
+	case SCAN_WR_BULK:
+	case SCAN_RD_ACK:
+	case SCAN_WR_ACK:
+	case SCAN_RD_BULK_ACK:
+	case SCAN_WR_BULK_ACK:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+/* Index the register values and bulk data in the log */
+static int parse_log(struct gl843_replay *r)
+{
+	int ret;
+	const uint8_t *p = r->log;
+	const uint8_t *end = r->log + r->log_size;
+	const uint8_t *data;
+	uint32_t ts, t0 = 0;
+	size_t len;
+	int cmd, prev = SCAN_UNDEF;
+	int sel = 0;
+	int first = 1;
+
+	while (end - p >= 8) {
+		ts = (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+		cmd = p[4];
+		len = (p[6] << 8) | p[7];
+		data = NULL;
+		if (!valid_cmd(cmd) || p[5] > 1) {
+			DBG(DBG_error, "replay: bad record at offset %zu. The log "
+				"is corrupt, or from an older dumpscanner that "
+				"didn't split transfers of 64 KiB or more.\n",
+				(size_t) (p - r->log));
+			ret = LIBUSB_ERROR_IO;
+			goto chk_failed;
+		}
+		p += 8;
+		if (p[-3]) {
+			if ((size_t) (end - p) < len) {
+				DBG(DBG_warn, "log is truncated\n");
+				break;
+			}
+			data = p;
+			p += len;
+		}
+		if (first) {
+			t0 = ts;
+			first = 0;
+		}
+		r->duration = ts - t0;
+
+		switch (cmd) {
+		case SCAN_SEL_REG:
+			r->cap.sel++;
+			if (data && len >= 1)
+				sel = data[0];
+			break;
+		case SCAN_WR_REG:
+			r->cap.wr_req++;
+			r->cap.wr_reg++;
+			break;
+		case SCAN_RD_REG:
+			r->cap.rd_req++;
+			r->cap.rd_reg++;
+			break;
+		case SCAN_RD_ACK:
+			/* The value of a register read */
+			if (prev == SCAN_RD_REG && data && len >= 1
+					&& sel <= GL843_MAX_IOREG)
+				CHK(push_reg(&r->rq[sel], data[0]));
+			break;
+		case SCAN_WR_BYTES:
+			r->cap.setup++;
+			break;
+		case SCAN_RD_BULK:
+			r->cap.bulk_in++;
+			break;
+		case SCAN_RD_BULK_ACK:
+			if (data && len > 0)
+				CHK(push_chunk(r, data, len));
+			r->cap.bytes_in += len;
+			break;
+		case SCAN_WR_BULK:
+			/* Large transfers are split over several records */
+			if (prev != SCAN_WR_BULK)
+				r->cap.bulk_out++;
+			r->cap.bytes_out += len;
+			break;
+		case SCAN_UNDEF:
+			r->unknown++;
+			break;
+		}
+		prev = cmd;
+	}
+	ret = 0;
+chk_failed:
+	return ret;
+}
+
+static void set_reg24(struct gl843_replay *r, int a, unsigned int val)
+{
+	r->reg[a] = (val >> 16) & 0xff;
+	r->reg[a+1] = (val >> 8) & 0xff;
+	r->reg[a+2] = val & 0xff;
+}
+
+static uint8_t read_ioreg(struct gl843_replay *r, int a)
+{
+	struct reg_queue *q = &r->rq[a];
+	uint64_t valid;
+
+	if (q->pos < q->len)
+		r->reg[a] = q->val[q->pos++];
+
+	switch (a) {
+	case 0x41:	/* BUFEMPTY */
+		r->reg[a] = (r->reg[a] & ~0x40) | (r->in_left ? 0 : 0x40);
+		break;
+	case 0x42:	/* VALIDWORD */
+	case 0x43:
+	case 0x44:
+		valid = (r->in_left < REPLAY_BUF_SIZE)
+			? r->in_left : REPLAY_BUF_SIZE;
+		set_reg24(r, 0x42, valid / 2);
+		break;
+	}
+	return r->reg[a];
+}
+
+static void read_bulk(struct gl843_replay *r, uint8_t *data, size_t len)
+{
+	size_t k;
+
+	while (len > 0 && r->cur < r->n_in) {
+		struct bulk_chunk *c = &r->in[r->cur];
+		k = (len < c->len - r->off) ? len : c->len - r->off;
+		memcpy(data, c->data + r->off, k);
+		data += k;
+		len -= k;
+		r->off += k;
+		r->in_left -= k;
+		if (r->off == c->len) {
+			r->cur++;
+			r->off = 0;
+		}
+	}
+	if (len > 0) {
+		if (r->padded == 0)
+			DBG(DBG_warn, "replay: read past the end of the "
+				"capture, returning zeros\n");
+		memset(data, 0, len);
+		r->padded += len;
+	}
+}
+
+static int replay_ctrl_xfer(struct gl843_transport *t,
+			    uint8_t bmRequestType,
+			    uint8_t bRequest,
+			    uint16_t wValue,
+			    uint16_t wIndex,
+			    unsigned char *data,
+			    uint16_t wLength,
+			    unsigned int timeout)
+{
+	int i;
+	struct gl843_replay *r = (struct gl843_replay *) t;
+
+	if (bmRequestType == REQ_OUT && bRequest == REQ_REG
+			&& wValue == VAL_SET_REG && wLength == 1) {
+		/* Select register */
+		r->drv.sel++;
+		r->sel = data[0];
+
+	} else if (bmRequestType == REQ_OUT && bRequest == REQ_BUF
+			&& wValue == VAL_SET_REG) {
+		/* Address/value pairs */
+		r->drv.wr_req++;
+		for (i = 0; i + 1 < wLength; i += 2) {
+			if (data[i] > GL843_MAX_IOREG)
+				return LIBUSB_ERROR_INVALID_PARAM;
+			r->reg[data[i]] = data[i+1];
+			r->drv.wr_reg++;
+		}
+
+	} else if (bmRequestType == REQ_IN && bRequest == REQ_REG
+			&& wValue == VAL_READ_REG) {
+		/* Read, starting at the selected register */
+		r->drv.rd_req++;
+		for (i = 0; i < wLength; i++) {
+			if (r->sel + i > GL843_MAX_IOREG)
+				return LIBUSB_ERROR_INVALID_PARAM;
+			data[i] = read_ioreg(r, r->sel + i);
+			r->drv.rd_reg++;
+		}
+
+	} else if (bmRequestType == REQ_OUT && bRequest == REQ_BUF
+			&& wValue == VAL_BUF && wLength == 8) {
+		/* Bulk setup packet */
+		r->drv.setup++;
+
+	} else {
+		DBG(DBG_error, "replay: unknown control request "
+			"0x%02x 0x%02x 0x%04x\n", bmRequestType, bRequest, wValue);
+		return LIBUSB_ERROR_PIPE;
+	}
+	return wLength;
+}
+
+static int replay_bulk_xfer(struct gl843_transport *t,
+			    unsigned char endpoint,
+			    unsigned char *data,
+			    int length,
+			    int *transferred,
+			    unsigned int timeout)
+{
+	struct gl843_replay *r = (struct gl843_replay *) t;
+
+	if (endpoint == 0x81) {
+		read_bulk(r, data, length);
+		r->drv.bulk_in++;
+		r->drv.bytes_in += length;
+	} else {
+		r->drv.bulk_out++;
+		r->drv.bytes_out += length;
+	}
+	*transferred = length;
+	return 0;
+}
+
+static void print_counts(struct gl843_replay *r)
+{
+	struct xfer_count *c = &r->cap, *d = &r->drv;
+
+	DBG(DBG_msg, "replay: capture length %u.%03u s, "
+		"%lu unrecognized URBs\n",
+		r->duration / 1000, r->duration % 1000, r->unknown);
+	DBG(DBG_msg, "replay: %-24s %10s %10s\n", "", "capture", "driver");
+	DBG(DBG_msg, "replay: %-24s %10lu %10lu\n", "register selects",
+		c->sel, d->sel);
+	DBG(DBG_msg, "replay: %-24s %10lu %10lu\n", "register write requests",
+		c->wr_req, d->wr_req);
+	DBG(DBG_msg, "replay: %-24s %10lu %10lu\n", "registers written",
+		c->wr_reg, d->wr_reg);
+	DBG(DBG_msg, "replay: %-24s %10lu %10lu\n", "register read requests",
+		c->rd_req, d->rd_req);
+	DBG(DBG_msg, "replay: %-24s %10lu %10lu\n", "registers read",
+		c->rd_reg, d->rd_reg);
+	DBG(DBG_msg, "replay: %-24s %10lu %10lu\n", "bulk setups",
+		c->setup, d->setup);
+	DBG(DBG_msg, "replay: %-24s %10lu %10lu\n", "bulk reads",
+		c->bulk_in, d->bulk_in);
+	DBG(DBG_msg, "replay: %-24s %10llu %10llu\n", "bytes read",
+		(unsigned long long) c->bytes_in,
+		(unsigned long long) d->bytes_in);
+	DBG(DBG_msg, "replay: %-24s %10lu %10lu\n", "bulk writes",
+		c->bulk_out, d->bulk_out);
+	DBG(DBG_msg, "replay: %-24s %10llu %10llu\n", "bytes written",
+		(unsigned long long) c->bytes_out,
+		(unsigned long long) d->bytes_out);
+	if (r->padded) {
+		DBG(DBG_warn, "replay: %llu bytes read past the end "
+			"of the capture\n", (unsigned long long) r->padded);
+	}
+}
+
+static void replay_destroy(struct gl843_transport *t)
+{
+	int i;
+	struct gl843_replay *r = (struct gl843_replay *) t;
+
+	if (!r)
+		return;
+	if (r->log) {
+		print_counts(r);
+		munmap(r->log, r->log_size);
+	}
+	for (i = 0; i <= GL843_MAX_IOREG; i++)
+		free(r->rq[i].val);
+	free(r->in);
+	free(r);
+}
+
+struct gl843_transport *create_gl843_replay(const char *filename)
+{
+	int ret, fd = -1;
+	struct stat st;
+	struct gl843_replay *r;
+	void *p;
+
+	CHK_MEM(r = calloc(sizeof(*r), 1));
+
+	r->xport.name = "replay";
+	r->xport.ctrl_xfer = replay_ctrl_xfer;
+	r->xport.bulk_xfer = replay_bulk_xfer;
+	r->xport.destroy = replay_destroy;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) < 0 || st.st_size == 0) {
+		DBG(DBG_error, "Can't read %s\n", filename);
+		goto chk_failed;
+	}
+	p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (p == MAP_FAILED) {
+		DBG(DBG_error, "Can't map %s\n", filename);
+		goto chk_failed;
+	}
+	r->log = p;
+	r->log_size = st.st_size;
+	close(fd);
+	fd = -1;
+
+	CHK(parse_log(r));
+
+	DBG(DBG_msg, "Replaying %s: %zu bytes, %llu bytes of bulk data\n",
+		filename, r->log_size, (unsigned long long) r->in_left);
+	return &r->xport;
+
+chk_mem_failed:
+chk_failed:
+	if (fd >= 0)
+		close(fd);
+	replay_destroy((struct gl843_transport *) r);
+	return NULL;
+}
@@ -0,0 +1,29 @@
+/*
+ * Copyright (C) 2010 Andreas Robinson <andr345 at gmail dot com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#ifndef _REPLAY_H_
+#define _REPLAY_H_
+
+#include "low.h"
+
+/* Create a transport that replays a capture made by tools/dumpscanner.
+ * Assign it to dev->xport.
+ *
+ * filename: dumpscanner log file.
+ *
+ * Returns NULL if the file can't be read or is out of memory.
+ */
+struct gl843_transport *create_gl843_replay(const char *filename);
+
+#endif /* _REPLAY_H_ */
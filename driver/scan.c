@@ -18,6 +18,7 @@
 #include <errno.h>
 #include <math.h>
 #include <string.h>
+#include <unistd.h>
 #include <sane/sane.h>
 
 #define CHK_DEBUG
@@ -26,6 +27,12 @@
 #include "cs4400f.h"
 #include "util.h"
 #include "scan.h"
+#include "calcache.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86_KERNELS
+#include <immintrin.h>
+#endif
 
 static struct gl843_image *create_image(int width, int height,
 					enum gl843_pixformat fmt)
@@ -103,9 +110,11 @@ static int wait_until_home(struct gl843_device *dev)
 {
 	int ret = 0;
 	while (ret == 0) {
-		ret = read_reg(dev, GL843_HOMESNR);
+		CHK(read_status_snapshot(dev));
+		ret = get_reg(dev, GL843_HOMESNR);
 		usleep(10000);
 	}
+chk_failed:
 	return ret;
 }
 
@@ -114,9 +123,48 @@ static int wait_motor(struct gl843_device *dev)
 {
 	int ret = 1;
 	while (ret > 0) {
-		ret = read_reg(dev, GL843_MOTORENB);
+		CHK(read_status_snapshot(dev));
+		ret = get_reg(dev, GL843_MOTORENB);
 		usleep(10000);
 	}
+chk_failed:
+	return ret;
+}
+
+/* Start a scan of height lines of stride bytes */
+static int begin_scan_lines(struct gl843_device *dev,
+			    int stride,
+			    int height,
+			    int bpp,
+			    int timeout)
+{
+	int ret;
+
+	CHK_MEM(init_line_buffer(dev, stride));
+	CHK(write_reg(dev, GL843_LINCNT, height));
+	CHK(write_reg(dev, GL843_SCAN, 1));
+	CHK(write_reg(dev, GL843_MOVE, 255));
+
+	CHK(start_pixel_stream(dev, (size_t) stride * height,
+		PIXEL_STREAM_URBS, bpp, timeout));
+	ret = 0;
+chk_failed:
+	return ret;
+chk_mem_failed:
+	ret = LIBUSB_ERROR_NO_MEM;
+	goto chk_failed;
+}
+
+/* Finish a scan started with begin_scan_lines().
+ * The caller stops the pixel stream. */
+static int end_scan_lines(struct gl843_device *dev)
+{
+	int ret;
+
+	CHK(write_reg(dev, GL843_SCAN, 0));
+	CHK(write_reg(dev, GL843_CLRLNCNT, 1));
+	ret = 0;
+chk_failed:
 	return ret;
 }
 
@@ -134,12 +182,8 @@ static int scan_img(struct gl843_device *dev,
 		return 0;
 	}
 
-	CHK_MEM(init_line_buffer(dev, img->stride));
-	CHK(write_reg(dev, GL843_LINCNT, img->height));
-	CHK(write_reg(dev, GL843_SCAN, 1));
-	CHK(write_reg(dev, GL843_MOVE, 255));
-
-	CHK(wait_for_pixels(dev));
+	CHK(begin_scan_lines(dev, img->stride, img->height, img->bpp,
+		timeout));
 
 	buf = img->data;
 	for (i = 0; i < img->height; i++) {
@@ -148,14 +192,11 @@ static int scan_img(struct gl843_device *dev,
 		buf += img->stride;
 	}
 
-	CHK(write_reg(dev, GL843_SCAN, 0));
-	CHK(write_reg(dev, GL843_CLRLNCNT, 1));
+	CHK(end_scan_lines(dev));
 	ret = 0;
 chk_failed:
+	stop_pixel_stream(dev);
 	return ret;
-chk_mem_failed:
-	ret = LIBUSB_ERROR_NO_MEM;
-	goto chk_failed;
 }
 
 /* Color-index-to-name, for debugging purposes */
@@ -179,79 +220,345 @@ struct img_stat
 	float avg[3];
 };
 
-/* Calculate R, G and B component minimum, maximum and average. */
-static void get_image_stats(struct gl843_image *img,
-			    struct img_stat *stat)
+/* Statistics kernels. There is a scalar set, and SIMD sets that are
+ * selected at runtime like the converter kernels in convert.c. They all
+ * give the same results.
+ */
+struct stat_kernels
 {
-	int n, m;
-	int i, j;
+	const char *name;
 
-	if (img->bpp != 48) {
-		DBG(DBG_error, "img->bpp != 48 (PXFMT_RGB16)\n");
-		return;
+	/* Update the R, G and B min, max and sum with n RGB16 pixels */
+	void (*rgb_stats)(const uint16_t *src, size_t n,
+			  int *min, int *max, uint64_t *sum);
+
+	/* Add n 16-bit values to n 32-bit column sums. Only shading
+	 * calibration needs these, and it is disabled for now. */
+	void (*add_columns)(uint32_t *sum, const uint16_t *src, size_t n);
+};
+
+static void rgb_stats_c(const uint16_t *src, size_t n,
+			int *min, int *max, uint64_t *sum)
+{
+	size_t x;
+	int i;
+
+	for (x = 0; x < n; x++) {
+		for (i = 0; i < 3; i++) {
+			int c = *src++;
+			min[i] = (c < min[i]) ? c : min[i];
+			max[i] = (c > max[i]) ? c : max[i];
+			sum[i] += c;
+		}
 	}
+}
 
-	/* Byte count. Ignoring the last line; it can have bad pixels. */
-	n = img->stride * (img->height-1);
-	/* Pixel count. */
-	m = img->width * (img->height-1);
+static void add_columns_c(uint32_t *sum, const uint16_t *src, size_t n)
+{
+	size_t i;
 
-	for (i = 0; i < 3; i++) {
-		stat->min[i] = 65535;
-		stat->max[i] = 0;
-		stat->avg[i] = 0;
+	for (i = 0; i < n; i++)
+		sum[i] += src[i];
+}
+
+static const struct stat_kernels stat_kernels_c = {
+	"scalar", rgb_stats_c, add_columns_c
+};
+
+#ifdef HAVE_X86_KERNELS
+
+/* The vector kernels load three vectors at a time, so every lane
+ * always holds the same component. Lane sums are 32-bit and are
+ * flushed to sum[] every STAT_BLOCK loads, before they can overflow.
+ */
+#define STAT_BLOCK 4096
+
+/* Fold lane j of vector k into component (k * lanes + j) % 3 */
+static void fold_lanes(int lanes,
+		       const uint16_t *lmin, const uint16_t *lmax,
+		       const uint32_t *lsum,
+		       int *min, int *max, uint64_t *sum)
+{
+	int j, c;
+
+	for (j = 0; j < 3 * lanes; j++) {
+		c = j % 3;
+		if (lmin)
+			min[c] = (lmin[j] < min[c]) ? lmin[j] : min[c];
+		if (lmax)
+			max[c] = (lmax[j] > max[c]) ? lmax[j] : max[c];
+		if (lsum)
+			sum[c] += lsum[j];
 	}
-	for (j = 0; j < n; j += 6) {
-		uint16_t *p = (uint16_t *)(img->data + j);
-		for (i = 0; i < 3; i++) {
-			int c = *p++;
-			stat->min[i] = (c < stat->min[i]) ? c : stat->min[i];
-			stat->max[i] = (c > stat->max[i]) ? c : stat->max[i];
-			stat->avg[i] += c;
+}
+
+/* SSE2 has no unsigned 16-bit min and max, so the values are biased
+ * by 0x8000 and compared as signed. */
+__attribute__ ((target("sse2")))
+static void rgb_stats_sse2(const uint16_t *src, size_t n,
+			   int *min, int *max, uint64_t *sum)
+{
+	size_t i, end, len = n * 3;
+	int k;
+	const __m128i bias = _mm_set1_epi16((short) 0x8000);
+	const __m128i zero = _mm_setzero_si128();
+	__m128i v, vmin[3], vmax[3], vsum[3][2];
+	uint16_t lmin[24], lmax[24];
+	uint32_t lsum[24];
+
+	for (k = 0; k < 3; k++) {
+		vmin[k] = _mm_set1_epi16(0x7fff);
+		vmax[k] = _mm_set1_epi16((short) 0x8000);
+	}
+	for (i = 0; i + 24 <= len; ) {
+		for (k = 0; k < 3; k++)
+			vsum[k][0] = vsum[k][1] = zero;
+		end = i + 24 * STAT_BLOCK;
+		for (; i + 24 <= len && i < end; i += 24) {
+			for (k = 0; k < 3; k++) {
+				v = _mm_loadu_si128((const __m128i *) (src + i + 8*k));
+				vsum[k][0] = _mm_add_epi32(vsum[k][0],
+					_mm_unpacklo_epi16(v, zero));
+				vsum[k][1] = _mm_add_epi32(vsum[k][1],
+					_mm_unpackhi_epi16(v, zero));
+				v = _mm_xor_si128(v, bias);
+				vmin[k] = _mm_min_epi16(vmin[k], v);
+				vmax[k] = _mm_max_epi16(vmax[k], v);
+			}
+		}
+		for (k = 0; k < 3; k++) {
+			_mm_storeu_si128((__m128i *) (lsum + 8*k), vsum[k][0]);
+			_mm_storeu_si128((__m128i *) (lsum + 8*k + 4), vsum[k][1]);
+		}
+		fold_lanes(8, NULL, NULL, lsum, min, max, sum);
+	}
+	for (k = 0; k < 3; k++) {
+		_mm_storeu_si128((__m128i *) (lmin + 8*k),
+			_mm_xor_si128(vmin[k], bias));
+		_mm_storeu_si128((__m128i *) (lmax + 8*k),
+			_mm_xor_si128(vmax[k], bias));
+	}
+	if (i > 0)
+		fold_lanes(8, lmin, lmax, NULL, min, max, sum);
+	rgb_stats_c(src + i, (len - i) / 3, min, max, sum);
+}
+
+__attribute__ ((target("sse2")))
+static void add_columns_sse2(uint32_t *sum, const uint16_t *src, size_t n)
+{
+	size_t i;
+	const __m128i zero = _mm_setzero_si128();
+	__m128i v, lo, hi;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		v = _mm_loadu_si128((const __m128i *) (src + i));
+		lo = _mm_loadu_si128((const __m128i *) (sum + i));
+		hi = _mm_loadu_si128((const __m128i *) (sum + i + 4));
+		_mm_storeu_si128((__m128i *) (sum + i),
+			_mm_add_epi32(lo, _mm_unpacklo_epi16(v, zero)));
+		_mm_storeu_si128((__m128i *) (sum + i + 4),
+			_mm_add_epi32(hi, _mm_unpackhi_epi16(v, zero)));
+	}
+	add_columns_c(sum + i, src + i, n - i);
+}
+
+__attribute__ ((target("avx2")))
+static void rgb_stats_avx2(const uint16_t *src, size_t n,
+			   int *min, int *max, uint64_t *sum)
+{
+	size_t i, end, len = n * 3;
+	int k;
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i v, vmin[3], vmax[3], vsum[3][2];
+	uint16_t lmin[48], lmax[48];
+	uint32_t lsum[48];
+
+	for (k = 0; k < 3; k++) {
+		vmin[k] = _mm256_set1_epi16((short) 0xffff);
+		vmax[k] = zero;
+	}
+	for (i = 0; i + 48 <= len; ) {
+		for (k = 0; k < 3; k++)
+			vsum[k][0] = vsum[k][1] = zero;
+		end = i + 48 * STAT_BLOCK;
+		for (; i + 48 <= len && i < end; i += 48) {
+			for (k = 0; k < 3; k++) {
+				v = _mm256_loadu_si256((const __m256i *) (src + i + 16*k));
+				vsum[k][0] = _mm256_add_epi32(vsum[k][0],
+					_mm256_cvtepu16_epi32(
+						_mm256_castsi256_si128(v)));
+				vsum[k][1] = _mm256_add_epi32(vsum[k][1],
+					_mm256_cvtepu16_epi32(
+						_mm256_extracti128_si256(v, 1)));
+				vmin[k] = _mm256_min_epu16(vmin[k], v);
+				vmax[k] = _mm256_max_epu16(vmax[k], v);
+			}
+		}
+		for (k = 0; k < 3; k++) {
+			_mm256_storeu_si256((__m256i *) (lsum + 16*k),
+				vsum[k][0]);
+			_mm256_storeu_si256((__m256i *) (lsum + 16*k + 8),
+				vsum[k][1]);
 		}
+		fold_lanes(16, NULL, NULL, lsum, min, max, sum);
+	}
+	for (k = 0; k < 3; k++) {
+		_mm256_storeu_si256((__m256i *) (lmin + 16*k), vmin[k]);
+		_mm256_storeu_si256((__m256i *) (lmax + 16*k), vmax[k]);
+	}
+	if (i > 0)
+		fold_lanes(16, lmin, lmax, NULL, min, max, sum);
+	rgb_stats_c(src + i, (len - i) / 3, min, max, sum);
+}
+
+__attribute__ ((target("avx2")))
+static void add_columns_avx2(uint32_t *sum, const uint16_t *src, size_t n)
+{
+	size_t i;
+	__m256i v;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		v = _mm256_cvtepu16_epi32(
+			_mm_loadu_si128((const __m128i *) (src + i)));
+		_mm256_storeu_si256((__m256i *) (sum + i),
+			_mm256_add_epi32(v,
+				_mm256_loadu_si256((const __m256i *) (sum + i))));
+	}
+	add_columns_c(sum + i, src + i, n - i);
+}
+
+static const struct stat_kernels stat_kernels_sse2 = {
+	"sse2", rgb_stats_sse2, add_columns_sse2
+};
+
+static const struct stat_kernels stat_kernels_avx2 = {
+	"avx2", rgb_stats_avx2, add_columns_avx2
+};
+
+#endif /* HAVE_X86_KERNELS */
+
+/* Pick the fastest kernels the CPU supports */
+static const struct stat_kernels *select_stat_kernels(void)
+{
+#ifdef HAVE_X86_KERNELS
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return &stat_kernels_avx2;
+	if (__builtin_cpu_supports("sse2"))
+		return &stat_kernels_sse2;
+#endif
+	return &stat_kernels_c;
+}
+
+static const struct stat_kernels *g_stat_kernels;
+
+/* Statistics of an RGB16 image, accumulated line by line as the pixels
+ * arrive, so the image is never stored. */
+struct img_acc
+{
+	int width;		/* Pixels per line */
+	int lines;		/* Lines added */
+	int min[3], max[3];
+	uint64_t sum[3];
+	uint32_t *col_sum;	/* Sum of each subpixel column, or NULL */
+};
+
+/* Start accumulating lines of width pixels.
+ * col_sum: width * 3 column sums, or NULL if not needed.
+ */
+static void init_img_acc(struct img_acc *acc, int width, uint32_t *col_sum)
+{
+	int i;
+
+	if (!g_stat_kernels) {
+		g_stat_kernels = select_stat_kernels();
+		DBG(DBG_info, "statistics kernels = %s\n",
+			g_stat_kernels->name);
 	}
 
+	acc->width = width;
+	acc->lines = 0;
+	for (i = 0; i < 3; i++) {
+		acc->min[i] = 65535;
+		acc->max[i] = 0;
+		acc->sum[i] = 0;
+	}
+	acc->col_sum = col_sum;
+	if (col_sum)
+		memset(col_sum, 0, width * 3 * sizeof(*col_sum));
+}
+
+/* Add one line of RGB16 pixels */
+static void add_img_line(struct img_acc *acc, const uint16_t *line)
+{
+	const struct stat_kernels *k = g_stat_kernels;
+
+	k->rgb_stats(line, acc->width, acc->min, acc->max, acc->sum);
+	if (acc->col_sum)
+		k->add_columns(acc->col_sum, line, acc->width * 3);
+	acc->lines++;
+}
+
+/* Get R, G and B component minimum, maximum and average. */
+static void get_img_stats(struct img_acc *acc, struct img_stat *stat)
+{
+	int i;
+	int m = acc->width * acc->lines;	/* Pixel count */
+
 	for (i = 0; i < 3; i++) {
-		stat->avg[i] = stat->avg[i] / m;
+		stat->min[i] = acc->min[i];
+		stat->max[i] = acc->max[i];
+		stat->avg[i] = m ? (float) acc->sum[i] / m : 0;
 		DBG(DBG_info, "%s (min,max,avg) = %d, %d, %.2f\n",
 			idx_name(i), stat->min[i], stat->max[i], stat->avg[i]);
 	}
 }
 
-/* Calculate average pixel intensity of every column.
- * The result is stored in the first line of the image.
- * The image height must be > 2, and fmt = PXFMT_RGB16 
+/* Scan height lines of width RGB16 pixels and accumulate them in acc.
+ * The last line is read but not used; it can have bad pixels.
+ * Only one line of pixels is kept in memory.
+ *
+ * Returns LIBUSB_ERROR_INTERRUPTED without scanning if dev->cancel is set.
  */
-static void get_vertical_average(struct gl843_image *img)
+static int scan_stats(struct gl843_device *dev,
+		      struct img_acc *acc,
+		      int height,
+		      int timeout)
 {
-	int i, y, height, avg;
-	uint16_t *p0, *p;
+	int ret, y;
+	int stride = acc->width * 6;
+	uint8_t *line = NULL;
 
-	if (img->bpp != 48) {
-		DBG(DBG_error, "img->bpp != 48 (PXFMT_RGB16)\n");
-		return;
-	}
-	if (img->height < 2) {
-		DBG(DBG_error, "img->height < 2\n");
-		return;
-	}
+	DBG(DBG_info, "scanning %d lines for calibration\n", height);
 
-	height = img->height - 1; /* Ignoring last line, may have bad pixels */
+	/* Stop here if another thread cancelled the calibration */
+	if (__atomic_load_n(&dev->cancel, __ATOMIC_RELAXED))
+		return LIBUSB_ERROR_INTERRUPTED;
 
-	for (i = 0; i < img->stride; i += 2) {
-		p0 = (uint16_t *)(img->data + i);
+	if (height < 2) {
+		DBG(DBG_error0, "BUG: height = %d. Must be >= 2.\n", height);
+		return 0;
+	}
 
-		/* Get average of all pixels in current column */
+	CHK_MEM(line = malloc(stride));
+	CHK(begin_scan_lines(dev, stride, height, 48, timeout));
 
-		avg = 0;
-		p = p0;
-		for (y = 0; y < height; y++) {
-			avg += *p;
-			p += img->stride / 2;
-		}
-		avg = avg / height;
-		*p0 = avg;
+	for (y = 0; y < height; y++) {
+		/* FIXME: Check number of bytes received. */
+		CHK(read_pixels(dev, line, stride, 48, timeout));
+		if (y < height - 1)
+			add_img_line(acc, (uint16_t *) line);
 	}
+
+	CHK(end_scan_lines(dev));
+	ret = 0;
+chk_failed:
+	stop_pixel_stream(dev);
+	free(line);
+	return ret;
+chk_mem_failed:
+	ret = LIBUSB_ERROR_NO_MEM;
+	goto chk_failed;
 }
 
 /*
@@ -277,32 +584,34 @@ static int calc_afe_blacklevel(struct gl843_device *dev,
 			       uint8_t low, uint8_t high)
 {
 	int ret, i;
-	struct gl843_image *img;
+	struct img_acc acc;
 	struct img_stat lo_stat, hi_stat;
+	struct afe_ent afe[6];
 
 	DBG(DBG_msg, "Calibrating A/D-converter black level.\n");
 
-	CHK_MEM(img = create_image(cal->width, cal->height, PXFMT_RGB16));
-
 	/* Scan with the lamp off to produce black pixels. */
 	CHK(set_lamp(dev, LAMP_OFF, 0));
 
 	/* Sample 'low' black level */
 
 	for (i = 0; i < 3; i++) {
-		CHK(write_afe_gain(dev, i, 1.0));
-		CHK(write_afe(dev, 32 + i, low));  /* Set 'low' black level */
+		afe[2*i] = (struct afe_ent) { 40 + i, afe_gain_to_val(1.0) };
+		afe[2*i+1] = (struct afe_ent) { 32 + i, low };	/* 'low' black level */
 	}
-	CHK(scan_img(dev, img, 10000));
-	get_image_stats(img, &lo_stat);
+	CHK(write_afe_regs(dev, afe, 6));
+	init_img_acc(&acc, cal->width, NULL);
+	CHK(scan_stats(dev, &acc, cal->height, 10000));
+	get_img_stats(&acc, &lo_stat);
 
 	/* Sample 'high' black level */
 
-	for (i = 0; i < 3; i++) {
-		CHK(write_afe(dev, 32 + i, high)); /* Set 'high' black level */
-	}
-	CHK(scan_img(dev, img, 10000));
-	get_image_stats(img, &hi_stat);
+	for (i = 0; i < 3; i++)
+		afe[i] = (struct afe_ent) { 32 + i, high };	/* 'high' black level */
+	CHK(write_afe_regs(dev, afe, 3));
+	init_img_acc(&acc, cal->width, NULL);
+	CHK(scan_stats(dev, &acc, cal->height, 10000));
+	get_img_stats(&acc, &hi_stat);
 
 	/* Use the line equation to find and set the best offset value */
 
@@ -313,107 +622,205 @@ static int calc_afe_blacklevel(struct gl843_device *dev,
 		c = lo_stat.avg[i] - m * low;
 		o = (int) satf(-c / m + 0.5, 0, 255);
 		cal->offset[i] = o;
-		CHK(write_afe(dev, 32 + i, o));
+		afe[i] = (struct afe_ent) { 32 + i, o };
 		DBG(DBG_info, "AFE %s offset = %d\n", idx_name(i), o);
 	}
+	CHK(write_afe_regs(dev, afe, 3));
 
 	ret = 0;
 chk_failed:
-	free(img);
 	return ret;	
-chk_mem_failed:
-	ret = LIBUSB_ERROR_NO_MEM;
-	goto chk_failed;
 }
 
-/* Get lamp-warmup progress, in percent. */
-static float get_progress(float dL_start, float dL_end, float dL_prev, float dL)
+/* Set up a calibration scan, with motor and shading correction off */
+static int setup_calibration_scan(struct gl843_device *dev,
+				  struct scan_setup *ss)
 {
-	float span, progress, prev_progress;
+	int ret;
 
-	/* Linearize and scale dL and dL_prev to the range [0.0, 100.0] */
+	CHK(setup_common(dev, ss));
+	CHK(setup_scan(dev, ss, 1));
+	CHK(select_shading(dev, SHADING_CORR_OFF));
+	CHK(write_reg(dev, GL843_AGOHOME, 0));
+	CHK(write_reg(dev, GL843_MTRPWR, 0));
+	ret = 0;
+chk_failed:
+	return ret;
+}
 
-	span = logf(dL_start) - logf(dL_end);
-	prev_progress = ((logf(dL_start) - logf(dL_prev)) / span) * 100;
-	progress = ((logf(dL_start) - logf(dL)) / span) * 100;
+/* Lamp warm-up
+ *
+ * The lamp intensity is modelled as L(t) = L_inf - A * exp(-t / tau).
+ * Then the drift left, L_inf - L(t), is tau * dL/dt, and it decays
+ * with the time constant tau.
+ *
+ * dL/dt is estimated with a linear fit of L to t, and tau with a linear
+ * fit of ln(dL/dt) to t, over the last few samples. The lamp is warm
+ * when the drift left is within what shading correction can tolerate.
+ */
 
-	/* Don't let progress go backwards ... */
-	if (prev_progress > progress)
-		progress = prev_progress;
+#define WARMUP_DPI 300		/* Sample resolution [dpi] */
+#define WARMUP_WIDTH 256	/* Sample width [pixels] */
+#define WARMUP_SAMPLES 8	/* Max samples in the fit */
+#define WARMUP_MIN_SAMPLES 4	/* Min samples before stopping */
+#define WARMUP_INTERVAL 250	/* Time between samples [ms] */
+#define WARMUP_DRIFT 0.002	/* Max drift left, relative to L */
+#define WARMUP_TAU 20000	/* tau when it can't be estimated [ms] */
+#define WARMUP_TAU_MAX 120000	/* Max tau [ms] */
+#define WARMUP_TIMEOUT 300000	/* Give up after this long [ms] */
+
+/* Estimate the drift left and the time constant from n samples of the
+ * lamp intensity L at times t [ms]. */
+static void fit_lamp_model(const double *t, const float *L, int n,
+			   double *drift, double *tau)
+{
+	int i, m;
+	double tc, Lc, stt, stL, rate;
+	double x, y, xc, yc, sxx, sxy;
+	double rx[WARMUP_SAMPLES], ry[WARMUP_SAMPLES];
+
+	/* dL/dt at the mean sample time, tc */
 
-	return satf(progress, 0, 100);
+	tc = Lc = 0;
+	for (i = 0; i < n; i++) {
+		tc += t[i] / n;
+		Lc += L[i] / n;
+	}
+	stt = stL = 0;
+	for (i = 0; i < n; i++) {
+		stt += (t[i] - tc) * (t[i] - tc);
+		stL += (t[i] - tc) * (L[i] - Lc);
+	}
+	rate = (stt > 0) ? stL / stt : 0;
+
+	/* ln|dL/dt| between samples, for the samples that move the same way
+	 * as the fitted rate; L may rise or fall towards L_inf. Drops when the
+	 * lamp is warm and the differences are mostly noise. */
+
+	m = 0;
+	xc = yc = 0;
+	for (i = 1; i < n; i++) {
+		y = (L[i] - L[i-1]) / (t[i] - t[i-1]);
+		if (rate < 0)
+			y = -y;
+		if (y <= 0)
+			continue;
+		rx[m] = (t[i] + t[i-1]) / 2;
+		ry[m] = log(y);
+		xc += rx[m];
+		yc += ry[m];
+		m++;
+	}
+	*tau = WARMUP_TAU;
+	if (m >= 3) {
+		xc /= m;
+		yc /= m;
+		sxx = sxy = 0;
+		for (i = 0; i < m; i++) {
+			x = rx[i] - xc;
+			sxx += x * x;
+			sxy += x * (ry[i] - yc);
+		}
+		if (sxx > 0 && sxy < 0)
+			*tau = satf(-sxx / sxy, WARMUP_INTERVAL, WARMUP_TAU_MAX);
+	}
+
+	/* Drift left after the last sample. Negative if L is falling. */
+	*drift = *tau * rate * exp(-(t[n-1] - tc) / *tau);
 }
 
 /* Wait until the lamp has warmed up.
+ *
+ * Samples a narrow strip in the middle of the calibration area at low
+ * resolution, then restores the calibration setup in ss.
+ *
  * Note: Don't forget to turn it on first.
  */
 static int warm_up_lamp(struct gl843_device *dev,
-			struct calibration_info *cal)
+			struct scan_setup *ss)
 {
 	int ret, i;
-	int n;			/* Number of scans */
-	struct gl843_image *img;
+	int n;			/* Number of samples */
+	struct scan_setup ws;	/* Warm-up scan setup */
+	struct img_acc acc;
 	struct img_stat s;
+	struct dbg_timer timer;
 
-	float L = 0, L_prev;	/* Lamp intensity */
-	float dL = -1, dL_prev;	/* Lamp intensity delta */
-	float dL_start = -1;	/* Inital intensity delta */
-	float dL_end = 50;	/* Target intensity delta */
+	float L[WARMUP_SAMPLES];	/* Lamp intensity */
+	double t[WARMUP_SAMPLES];	/* Sample time [ms] */
+	double drift, tau;		/* Drift left, time constant */
+	double eta, p = 0;		/* Time left [ms], progress [%] */
 
 	DBG(DBG_msg, "Warming up lamp.\n");
 
-	CHK_MEM(img = create_image(cal->width, cal->height, PXFMT_RGB16));
+	ws = *ss;
+	ws.dpi = WARMUP_DPI;
+	ws.width = WARMUP_WIDTH;
+	ws.start_x = (ss->start_x + ss->width / 2) * WARMUP_DPI / ss->dpi
+		- WARMUP_WIDTH / 2;
+	ws.height = ss->height * WARMUP_DPI / ss->dpi;
+	if (ws.height < 4)
+		ws.height = 4;
+	CHK(setup_calibration_scan(dev, &ws));
 
-	for (i = 0; i < 3; i++)
-		CHK(write_afe_gain(dev, i, min_afe_gain()));
+	CHK(write_afe_gains(dev, min_afe_gain(), min_afe_gain(),
+		min_afe_gain()));
 
+	init_timer(&timer, CLOCK_MONOTONIC);
 	n = 0;
 	while (1) {
-		/* Scan and get lamp intensity, L and intensity delta, dL.
-		 * Here, L is defined as the average of all subpixels in
-		 * the scanned image. */
-		L_prev = L;
-		CHK(scan_img(dev, img, 10000));
-		get_image_stats(img, &s);
-		L = 0;
+		/* Scan and get lamp intensity, L, defined as the average
+		 * of all subpixels in the scanned image. */
+		if (n == WARMUP_SAMPLES) {
+			memmove(L, L + 1, (n - 1) * sizeof(*L));
+			memmove(t, t + 1, (n - 1) * sizeof(*t));
+			n--;
+		}
+		t[n] = get_timer(&timer);
+		init_img_acc(&acc, ws.width, NULL);
+		CHK(scan_stats(dev, &acc, ws.height, 10000));
+		get_img_stats(&acc, &s);
+		L[n] = 0;
 		for (i = 0; i < 3; i++)
-			L += s.avg[i] / 3;
-
-		dL_prev = dL;
-		dL = abs(L - L_prev);
+			L[n] += s.avg[i] / 3;
+		n++;
 
-		if (n == 1) {
-			dL_start = dL;
-		} else if (n > 1) {
-			float p;
+		if (n >= 3) {
+			fit_lamp_model(t, L, n, &drift, &tau);
 
-			if (dL_start < dL) {
-				dL_start = dL;
-				dL_prev = dL;
-			}
+			eta = 0;
+			if (fabs(drift) > WARMUP_DRIFT * L[n-1])
+				eta = tau * log(fabs(drift) / (WARMUP_DRIFT * L[n-1]));
 
-			p = get_progress(dL_start, dL_end, dL_prev, dL);
+			/* Don't let progress go backwards ... */
+			if (t[n-1] + eta > 0)
+				p = fmax(p, 100 * t[n-1] / (t[n-1] + eta));
 
-			DBG(DBG_info, "  L = %.2f, dL = %.2f\n", L, dL);
-			DBG(DBG_msg, "  progress: %.0f%%\n", p);
+			DBG(DBG_info, "  t = %.0f ms, L = %.2f, drift = %.2f, "
+				"tau = %.0f ms\n", t[n-1], L[n-1], drift, tau);
+			DBG(DBG_msg, "  progress: %.0f%%, %.1f s left\n",
+				p, eta / 1000);
 
-			/* The lamp is warm when dL is small enough */
-			if (dL < dL_end)
+			/* The lamp is warm when the drift is small enough */
+			if (n >= WARMUP_MIN_SAMPLES && eta == 0)
 				break;
 		}
-		usleep(500000);
-		n++;
+		if (t[n-1] > WARMUP_TIMEOUT) {
+			DBG(DBG_warn, "The lamp is not stable after %d s. "
+				"Continuing anyway.\n", WARMUP_TIMEOUT / 1000);
+			break;
+		}
+		eta = t[n-1] + WARMUP_INTERVAL - get_timer(&timer);
+		if (eta > 0)
+			usleep(eta * 1000);
 	}
 
-	write_pnm_image("test.pnm", img);
+	/* Restore the calibration setup */
+	CHK(setup_calibration_scan(dev, ss));
 
 	ret = 0;
 chk_failed:
-	free(img);
 	return ret;	
-chk_mem_failed:
-	ret = LIBUSB_ERROR_NO_MEM;
-	goto chk_failed;
 }
 
 /* Calculate the AFE gain */
@@ -422,7 +829,7 @@ static int calc_afe_gain(struct gl843_device *dev,
 {
 	int ret, i;
 	float g[3];
-	struct gl843_image *img;
+	struct img_acc acc;
 	struct img_stat stat;
 	/* Target at 95% of max allows lamp brightness increase after warmup. */
 	const float target = 65535 * 0.95;
@@ -430,15 +837,13 @@ static int calc_afe_gain(struct gl843_device *dev,
 
 	DBG(DBG_msg, "Calibrating A/D-converter gain.\n");
 
-	CHK_MEM(img = create_image(cal->width, cal->height, PXFMT_RGB16));
-
 	/* Scan at minimum gain */
-	for (i = 0; i < 3; i++) {
+	for (i = 0; i < 3; i++)
 		g[i] = min_afe_gain();
-		CHK(write_afe_gain(dev, i, g[i]));
-	}
-	CHK(scan_img(dev, img, 10000));
-	get_image_stats(img, &stat);
+	CHK(write_afe_gains(dev, g[0], g[1], g[2]));
+	init_img_acc(&acc, cal->width, NULL);
+	CHK(scan_stats(dev, &acc, cal->height, 10000));
+	get_img_stats(&acc, &stat);
 
 	/* Calculate and set gain that enables full dynamic range of AFE. */
 	for (i = 0; i < 3; i++) {
@@ -449,8 +854,8 @@ static int calc_afe_gain(struct gl843_device *dev,
 		cal->gain[i] = g[i];
 		DBG(DBG_info, "%s gain = %.2f, val = %d\n",
 			idx_name(i), g[i], afe_gain_to_val(g[i]));
-		CHK(write_afe_gain(dev, i, g[i]));
 	}
+	CHK(write_afe_gains(dev, g[0], g[1], g[2]));
 
 	if (gain_overflow) {
 		DBG(DBG_warn, "Gain is too high, (R, G, B) = (%f, %f, %f). "
@@ -459,73 +864,91 @@ static int calc_afe_gain(struct gl843_device *dev,
 
 	ret = 0;
 chk_failed:
-	free(img);
 	return ret;	
-chk_mem_failed:
-	ret = LIBUSB_ERROR_NO_MEM;
-	goto chk_failed;
+}
+
+#if 0
+/* Shading calibration is not wired into warm_up_scanner() or sane_start()
+ * yet. do_warmup_scan() below was its only caller. */
+
+/* Store a 16-bit value in the scanner's (little endian) byte order */
+static inline void put_le16(uint16_t *p, int val)
+{
+	uint8_t *b = (uint8_t *) p;
+	b[0] = val & 0xff;
+	b[1] = (val >> 8) & 0xff;
 }
 
 static int calc_shading(struct gl843_device *dev,
 			struct calibration_info *cal)
 {
-	int ret, i;
-	struct gl843_image *light_img = NULL, *dark_img = NULL;
-	uint16_t *Ln, *Dn, *p, *p_end;
+	int ret, i, x, pad;
+	struct img_acc light, dark;
+	uint32_t *light_sum = NULL, *dark_sum = NULL;
+	double light_inv, dark_inv;
+	uint16_t *p;
 	const int target = 0xffff;
 	int div_by_zero = 0;
 	int gain_overflow = 0;
 
 	DBG(DBG_msg, "Calculating shading correction.\n");
 
-	CHK_MEM(light_img = create_image(cal->width, cal->height, PXFMT_RGB16));
-	CHK_MEM(dark_img = create_image(cal->width, cal->height, PXFMT_RGB16));
+	CHK_MEM(light_sum = malloc(cal->width * 3 * sizeof(*light_sum)));
+	CHK_MEM(dark_sum = malloc(cal->width * 3 * sizeof(*dark_sum)));
 
 	/* Scan light (white) pixels */
 
 	/* Assume lamp is on */
-	CHK(scan_img(dev, light_img, 10000));
-	get_vertical_average(light_img);
+	init_img_acc(&light, cal->width, light_sum);
+	CHK(scan_stats(dev, &light, cal->height, 10000));
 
 	/* Scan dark (black) pixels */
 
 	CHK(set_lamp(dev, LAMP_OFF, 0));
-	CHK(scan_img(dev, dark_img, 10000));
-	get_vertical_average(dark_img);
+	init_img_acc(&dark, cal->width, dark_sum);
+	CHK(scan_stats(dev, &dark, cal->height, 10000));
 
-	/* Calculate shading
-	 * Ref: shading & correction in GL843 datasheet. */
+	/* Calculate shading from the average of every column
+	 * Ref: shading & correction in GL843 datasheet.
+	 * The result is stored in the scanner's RAM layout, see
+	 * SHADING_SIZE(), so send_shading() can send it as it is. */
 
 	p = cal->sc;
-	p_end = p + cal->sc_len;
-	Ln = (uint16_t *) light_img->data;
-	Dn = (uint16_t *) dark_img->data;
 
-	for (i = 0; i < cal->width * 3; i++) {
-		int diff, gain;
+	/* Multiply by the reciprocal instead of dividing every column.
+	 * (sum + 0.5) / lines is at least 0.5 / lines from an integer,
+	 * so the truncated result is the same as with a division. */
+	light_inv = 1.0 / light.lines;
+	dark_inv = 1.0 / dark.lines;
+
+	for (x = 0; x < cal->width; x++) {
+		for (i = x * 3; i < x * 3 + 3; i++) {
+			int Ln, Dn, diff, gain;
+
+			Ln = (int) ((light_sum[i] + 0.5) * light_inv);
+			Dn = (int) ((dark_sum[i] + 0.5) * dark_inv);
+			diff = Ln - Dn;
+			if (diff == 0) {
+				div_by_zero = 1;
+				diff = target;
+			}
+			gain = (cal->A * target) / diff;
+			if (gain > 0xffff) {
+				gain_overflow = 1;
+				gain = 0xffff;
+			}
 
-		diff = *Ln++ - *Dn;
-		if (diff == 0) {
-			div_by_zero = 1;
-			diff = target;
+			put_le16(p++, Dn);
+			put_le16(p++, gain);
 		}
-		gain = (cal->A * target) / diff;
-		if (gain > 0xffff) {
-			gain_overflow = 1;
-			gain = 0xffff;
-		}
-
-		*p++ = *Dn++;
-		*p++ = gain;
-
-		if (p > p_end) {
-			DBG(DBG_error, "internal error: buffer overrun.");
-			break;
+		if (x % SHADING_BLOCK_PIXELS == SHADING_BLOCK_PIXELS - 1) {
+			/* Padding */
+			pad = SHADING_BLOCK - SHADING_BLOCK_PIXELS * 12;
+			memset(p, 0, pad);
+			p += pad / 2;
 		}
 	}
-
-	if (host_is_big_endian())
-		swap_buffer_endianness(cal->sc, cal->sc, cal->sc_len / 2);
+	cal->sc_valid = 1;
 
 	if (div_by_zero)
 		DBG(DBG_warn, "division by zero detected.\n");
@@ -534,13 +957,14 @@ static int calc_shading(struct gl843_device *dev,
 
 	ret = 0;
 chk_failed:
-	free(light_img);
-	free(dark_img);
+	free(light_sum);
+	free(dark_sum);
 	return ret;
 chk_mem_failed:
 	ret = LIBUSB_ERROR_NO_MEM;
 	goto chk_failed;
 }
+#endif
 
 static struct calibration_info *
 create_calinfo(enum gl843_lamp source,
@@ -551,7 +975,7 @@ create_calinfo(enum gl843_lamp source,
 		int dpi)
 {
 	struct calibration_info *cal;
-	int sc_len = width * 12;
+	int sc_len = SHADING_SIZE(width);
 
 	CHK_MEM(cal = calloc(sizeof(*cal) + sc_len, 1));
 	cal->source = source;
@@ -573,7 +997,7 @@ int test_scan(struct gl843_device *dev)
 	struct scan_setup ss = {};
 	struct gl843_image *img = NULL;
 
-	CHK(write_reg(dev, GL843_SCANRESET, 1));
+	CHK(reset_scanner(dev));
 	CHK(wait_until_home(dev));
 
 	CHK(setup_static(dev));
@@ -590,8 +1014,7 @@ int test_scan(struct gl843_device *dev)
 	CHK_MEM(img = create_image(ss.width, ss.height, ss.fmt));
 
 	CHK(setup_common(dev, &ss));
-	CHK(setup_horizontal(dev, &ss));
-	CHK(setup_vertical(dev, &ss, 0));
+	CHK(setup_scan(dev, &ss, 0));
 	CHK(set_lamp(dev, ss.source, 10));
 	CHK(write_reg(dev, GL843_MTRPWR, 1));
 	CHK(scan_img(dev, img, 10000));
@@ -607,9 +1030,36 @@ chk_failed:
 	return ret;
 }
 
+/* Write calibrated AFE offsets and gains */
+static int write_afe_calibration(struct gl843_device *dev,
+				 struct calibration_info *cal)
+{
+	int ret, i;
+	struct afe_ent afe[6];
+
+	for (i = 0; i < 3; i++) {
+		afe[2*i] = (struct afe_ent) { 32 + i, cal->offset[i] };
+		afe[2*i+1] = (struct afe_ent) { 40 + i,
+			afe_gain_to_val(cal->gain[i]) };
+	}
+	CHK(write_afe_regs(dev, afe, 6));
+	ret = 0;
+chk_failed:
+	return ret;
+}
+
 /* Warm up the scanner lamp and calibrate the AFE gain and offsets.
  *
  * cal_y_pos: calibration y position, distance from home [mm].
+ * cc:        calibration cache, or NULL.
+ * lamp_warm: the lamp has been on since the last warm-up.
+ *
+ * If cc has a valid calibration, it is used instead of calibrating.
+ * Then, the lamp is only warmed up if it isn't already warm.
+ * A new calibration is stored in cc.
+ *
+ * Another thread can set dev->cancel to stop it. It then returns
+ * LIBUSB_ERROR_INTERRUPTED, possibly with the head away from home.
  *
  * Note: it is assumed the scanner head is in the home position
  * when this function is called.
@@ -617,18 +1067,15 @@ chk_failed:
 int warm_up_scanner(struct gl843_device *dev,
 		    enum gl843_lamp source,
 		    int lamp_timeout,
-		    float cal_y_pos)
+		    float cal_y_pos,
+		    struct cal_cache *cc,
+		    int lamp_warm)
 {
 	int ret;
+	int cached;
 	struct scan_setup ss = {};
-	struct calibration_info *cal;
-
-	DBG(DBG_msg, "Starting warmup.\n");
-
-	/* Move head into position */
-
-	CHK(move_scanner_head(dev, cal_y_pos));
-	CHK(wait_motor(dev));
+	struct calibration_info *cal = NULL;
+	enum scan_phase phase = dev->timing.phase;
 
 	/* Setup scan */
 
@@ -646,27 +1093,52 @@ int warm_up_scanner(struct gl843_device *dev,
 		return -1;
 	}
 
+	set_scan_phase(&dev->timing, SCAN_PHASE_WARM_UP);
+
 	CHK_MEM(cal = create_calinfo(ss.source, cal_y_pos,
 		ss.start_x, ss.width, ss.height, ss.dpi));
 
+	cached = load_calibration(cc, cal);
+	if (cached && lamp_warm) {
+		DBG(DBG_msg, "Lamp is warm. Using cached calibration.\n");
+		CHK(write_afe_calibration(dev, cal));
+		ret = 0;
+		goto chk_failed;
+	}
+
+	DBG(DBG_msg, "Starting warmup.\n");
+
+	/* Move head into position */
+
+	CHK(move_scanner_head(dev, cal_y_pos));
+	CHK(wait_motor(dev));
+
 	CHK(setup_static(dev));
-	CHK(setup_common(dev, &ss));
-	CHK(setup_horizontal(dev, &ss));
-	CHK(setup_vertical(dev, &ss, 1));
-	CHK(select_shading(dev, SHADING_CORR_OFF));
+	CHK(setup_calibration_scan(dev, &ss));
 
-	/* Scan with motor and lamp off and calculate AFE black level */
+	if (cached) {
+		/* Warm up the lamp, then use the cached calibration */
+		CHK(set_lamp(dev, source, lamp_timeout));
+		CHK(warm_up_lamp(dev, &ss));
+		CHK(write_afe_calibration(dev, cal));
+	} else {
+		/* Scan with motor and lamp off and calculate AFE black level */
 
-	CHK(write_reg(dev, GL843_AGOHOME, 0));
-	CHK(write_reg(dev, GL843_MTRPWR, 0));
-	CHK(set_lamp(dev, LAMP_OFF, 0));
-	CHK(calc_afe_blacklevel(dev, cal, 75, 0)); /* 75 and 0 are CS4400F-specific */
+		CHK(set_lamp(dev, LAMP_OFF, 0));
+		set_scan_phase(&dev->timing, SCAN_PHASE_BLACK_LEVEL);
+		CHK(calc_afe_blacklevel(dev, cal, 75, 0)); /* 75 and 0 are CS4400F-specific */
 
-	/* Turn on the lamp, do warm up scan, and calculate AFE gain */
+		/* Turn on the lamp, do warm up scan, and calculate AFE gain */
 
-	CHK(set_lamp(dev, source, lamp_timeout));
-	CHK(warm_up_lamp(dev, cal));
-	CHK(calc_afe_gain(dev, cal));
+		set_scan_phase(&dev->timing, SCAN_PHASE_WARM_UP);
+		CHK(set_lamp(dev, source, lamp_timeout));
+		CHK(warm_up_lamp(dev, &ss));
+		set_scan_phase(&dev->timing, SCAN_PHASE_GAIN);
+		CHK(calc_afe_gain(dev, cal));
+		set_scan_phase(&dev->timing, SCAN_PHASE_WARM_UP);
+
+		store_calibration(cc, cal);
+	}
 
 	/* Move home when finished */
 
@@ -674,12 +1146,12 @@ int warm_up_scanner(struct gl843_device *dev,
 	CHK(wait_motor(dev));
 	CHK(write_reg(dev, GL843_MTRPWR, 0));
 
-	free(cal);
-
 	DBG(DBG_msg, "Done.\n");
 		
 	ret = 0;
 chk_failed:
+	set_scan_phase(&dev->timing, phase);
+	free(cal);
 	return ret;
 chk_mem_failed:
 	ret = LIBUSB_ERROR_NO_MEM;
@@ -695,7 +1167,7 @@ int do_warmup_scan(struct gl843_device *dev, float cal_y_pos)
 	struct calibration_info *cal;
 	int lamp_to = 4; // FIXME: Get user setting
 
-	CHK(write_reg(dev, GL843_SCANRESET, 1));
+	CHK(reset_scanner(dev));
 	CHK(wait_until_home(dev));
 
 	CHK(setup_static(dev));
@@ -746,7 +1218,7 @@ Old stuff
 	set_reg(dev, GL843_AGOHOME, 0);
 	CHK(flush_regs(dev));
 
-	CHK(write_afe(dev, 4, 0));
+	CHK(write_afe(dev, GL843_AFE_RESET, 0));
 	CHK(write_afe(dev, 1, 0x23));
 	CHK(write_afe(dev, 2, 0x24));
 	CHK(write_afe(dev, 3, 0x2f)); /* Can be 0x1f or 0x2f */
@@ -754,7 +1226,7 @@ Old stuff
 	CHK(set_lamp(dev, LAMP_OFF, 0));
 	CHK(calc_afe_blacklevel(dev, cal, 75, 0));
 	CHK(set_lamp(dev, ss.source, lamp_to));
-	CHK(warm_up_lamp(dev, cal));
+	CHK(warm_up_lamp(dev, &ss));
 	CHK(calc_afe_gain(dev, cal));
 	CHK(calc_shading(dev, cal));
 	CHK(set_lamp(dev, ss.source, lamp_to));
@@ -779,7 +1251,7 @@ chk_mem_failed:
 int reset_and_move_home(struct gl843_device *dev)
 {
 	int ret;
-	CHK(write_reg(dev, GL843_SCANRESET, 1));
+	CHK(reset_scanner(dev));
 	CHK(wait_until_home(dev));
 	ret = 0;
 chk_failed:
@@ -31,20 +31,25 @@ struct calibration_info
 	uint8_t offset[3];	/* AFE offset register */
 	float gain[3];		/* AFE gain */
 	size_t sc_len;		/* Number of bytes in shading correction */
-	uint16_t sc[0];		/* Shading correction */
+	int sc_valid;		/* sc has been calculated */
 
 	/* Used when calibrating */
 
 	int height;		/* Number of lines to scan */
 	uint16_t A;		/* Shading gain factor (0x2000 or 0x4000) */
+
+	uint16_t sc[0];		/* Shading correction, sc_len bytes,
+				 * in the layout send_shading() takes */
 };
 
 int setup_motor(struct gl843_device *dev, struct scan_setup *ss);
 int do_warmup_scan(struct gl843_device *dev, float y_pos);
 int reset_and_move_home(struct gl843_device *dev);
+struct cal_cache;
 int warm_up_scanner(struct gl843_device *dev, enum gl843_lamp source,
-	int lamp_timeout, float cal_y_pos);
-int wait_for_pixels(struct gl843_device *dev);
+	int lamp_timeout, float cal_y_pos, struct cal_cache *cc,
+	int lamp_warm);
+int wait_for_pixels(struct gl843_device *dev, unsigned int timeout);
 
 
 #endif /* _SCAN_H_ */
@@ -55,9 +55,9 @@ int main()
 	h = open_scanner(&ctx, 0x04a9, 0x2228);
 	if (!h)
 		return 1;
-	dev = create_gl843dev(h);
+	dev = create_gl843dev(ctx, h);
 
-	write_reg(dev, GL843_SCANRESET, 1);
+	reset_scanner(dev);
 	while(!read_reg(dev, GL843_HOMESNR))
 		usleep(10000);
 	do_base_configuration(dev);
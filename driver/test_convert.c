@@ -0,0 +1,161 @@
+/* Pixel converter test
+ *
+ * Copyright (C) 2010 Andreas Robinson <andr345 at gmail dot com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+/* Checks the SIMD converter kernels bit-exactly against the scalar ones.
+ * The kernels are static, so convert.c is included rather than linked.
+ * Run with "make check". Exits with 1 if any kernel differs. */
+
+#include <stdio.h>
+#include "convert.c"
+
+static void dump_buf(void *p, int n)
+{
+	int i, j = 0;
+	uint16_t *buf = p;
+	for (i = 0; i < n; i += 3) {
+		printf("%04x %04x %04x    ", buf[i], buf[i+1], buf[i+2]);
+		j++;
+		if (j == 5) {
+			j = 0;
+			printf("\n");
+		}
+	}
+	printf("\n");
+}
+
+/* Check a set of SIMD kernels bit-exactly against the scalar kernels,
+ * for both depths, all orderings and lengths around the vector sizes. */
+static int test_kernels(const struct convert_kernels *k)
+{
+	const int orders[6][3] = {
+		{0,1,2}, {0,2,1}, {1,0,2}, {1,2,0}, {2,0,1}, {2,1,0}
+	};
+	enum { MAXPX = 300 };
+	uint8_t a[MAXPX*6], b[MAXPX*6], src[3][MAXPX*6];
+	const uint8_t *line[3] = { src[0], src[1], src[2] };
+	struct pixel_converter pconv;
+	uint16_t *lut;
+	int bps, o, c, n, i, errors = 0;
+
+	for (c = 0; c < 3; c++)
+		for (i = 0; i < MAXPX*6; i++)
+			src[c][i] = rand();
+
+	/* A random table, with the padding entries create_gamma_lut() adds */
+	lut = malloc((3 * 65536 + 2) * sizeof(*lut));
+	if (!lut) {
+		printf("%s: out of memory\n", k->name);
+		return 1;
+	}
+	for (i = 0; i < 3 * 65536 + 2; i++)
+		lut[i] = rand();
+	for (n = 0; n < MAXPX; n++) {
+		memcpy(a, src[0], n*6);
+		memcpy(b, src[0], n*6);
+		k->lut3(a, n*3, lut);
+		lut_c(b, n*3, lut, 3);
+		if (memcmp(a, b, n*6) != 0) {
+			printf("%s: lut3 failed, %d pixels\n", k->name, n);
+			errors++;
+		}
+	}
+	free(lut);
+
+	for (n = 0; n < MAXPX; n++) {
+		k->swap16(a, src[0], n*3);
+		swap16_c(b, src[0], n*3);
+		if (memcmp(a, b, n*6) != 0) {
+			printf("%s: swap16 failed, %d pixels\n", k->name, n);
+			errors++;
+		}
+	}
+
+	for (bps = 1; bps <= 2; bps++) {
+		memset(&pconv, 0, sizeof(pconv));
+		pconv.depth = 8 * bps;
+		pconv.ncomp = 3;
+		for (n = 0; n < MAXPX; n++) {
+			k->blend3(a, line, n*3*bps, bps);
+			blend3_c(b, line, n*3*bps, bps);
+			if (memcmp(a, b, n*3*bps) != 0) {
+				printf("%s: blend3 failed, %d-bit, %d pixels\n",
+					k->name, 8*bps, n);
+				errors++;
+			}
+			for (o = 0; o < 6; o++) {
+				memcpy(pconv.order, orders[o], sizeof(orders[o]));
+				build_shuffle(&pconv);
+				memcpy(a, src[0], n*3*bps);
+				memcpy(b, src[0], n*3*bps);
+				k->reorder3(&pconv, a, n);
+				reorder_c(&pconv, b, n);
+				if (memcmp(a, b, n*3*bps) != 0) {
+					printf("%s: reorder3 failed, %d-bit, "
+						"order %d, %d pixels\n",
+						k->name, 8*bps, o, n);
+					errors++;
+				}
+			}
+		}
+	}
+	printf("%s: %d errors\n", k->name, errors);
+	return errors;
+}
+
+int main()
+{
+	const int N = 85;
+	int i,j,m;
+	uint16_t buf[N*3];
+	int shift[3] = {4, 2, 0};	/* Lines of 5 pixels */
+	int order[3] = {0, 1, 2};
+	struct pixel_converter *pconv;
+
+	memset(buf, 0xff, N*3);
+
+	for (i = 0, j = 0; i < N*3; i += 3) {
+		if (i % 15 == 0)
+			j += 0x10;
+		buf[i] = j+1;
+	}
+	for (i = 30, j = 0; i < N*3; i += 3) {
+		if (i % 15 == 0)
+			j += 0x10;
+		buf[i+1] = j+2;
+	}
+	for (i = 60, j = 0; i < N*3; i += 3) {
+		if (i % 15 == 0)
+			j += 0x10;
+		buf[i+2] = j+3;
+	}
+
+	dump_buf(buf, N*3);
+	pconv = create_pixel_converter(16, 3, 5, shift, order, 1);
+	m = pconv->convert(pconv, (uint8_t *)buf, N);
+	dump_buf(buf, m*3);
+	destroy_pixel_converter(pconv);
+
+	select_kernels();
+#ifdef HAVE_X86_KERNELS
+	if (test_kernels(&kernels_sse2) != 0)
+		return 1;
+	__builtin_cpu_init();
+	if (!__builtin_cpu_supports("avx2"))
+		printf("avx2: not supported by this CPU, not tested\n");
+	else if (test_kernels(&kernels_avx2) != 0)
+		return 1;
+#endif
+	return 0;
+}
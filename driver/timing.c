@@ -0,0 +1,147 @@
+/* Scan phase timing
+ *
+ * Copyright (C) 2010 Andreas Robinson <andr345 at gmail dot com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+/* Each scan, from sane_start() (or the warm-up before it) until the head
+ * is back home, is divided into the phases in enum scan_phase. The time
+ * in each phase is measured on CLOCK_MONOTONIC and accumulated in
+ * dev->timing. There is one current phase at a time; a function that
+ * is part of a larger phase, e.g send_motor_accel() in register setup,
+ * switches to its own phase and back, so the times don't overlap.
+ * The pixel reader thread marks when the first line arrives, which ends
+ * the first_pixel phase and starts streaming.
+ *
+ * When $GL843_TIMING_FILE is set, sane_cancel() appends one line of
+ * JSON per scan to that file, e.g
+ *
+ * {"build": 0, "time": 1286913600, "status": "complete", "dpi": 300,
+ *  "width": 2550, "height": 3508, "bpp": 24, "home_wait_ms": 0.0, ...,
+ *  "head_return_ms": 1520.3, "total_ms": 9410.7, "backtracks": 0}
+ *
+ * (Without the line breaks.) The lines are written with O_APPEND in one
+ * write(), so several processes can share the file.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sane/sane.h>
+
+#include "defs.h"
+#include "util.h"
+#include "timing.h"
+
+static const char *scan_phase_names[SCAN_PHASE_COUNT] = {
+	"none", "home_wait", "warm_up", "black_level", "gain", "shading",
+	"reg_setup", "motor_tables", "first_pixel", "streaming", "head_return"
+};
+
+const char *scan_phase_name(enum scan_phase phase)
+{
+	return (phase < SCAN_PHASE_COUNT) ? scan_phase_names[phase] : "?";
+}
+
+static uint64_t ts_to_ns(const struct timespec *ts)
+{
+	return (uint64_t) ts->tv_sec * 1000000000 + ts->tv_nsec;
+}
+
+void mark_first_pixel(struct scan_timing *t)
+{
+	struct timespec ts;
+	uint64_t zero = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	__atomic_compare_exchange_n(&t->t_first_pixel, &zero, ts_to_ns(&ts),
+		0, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+}
+
+enum scan_phase set_scan_phase(struct scan_timing *t, enum scan_phase phase)
+{
+	enum scan_phase prev = t->phase;
+	uint64_t t0, t1;
+
+	/* Streaming began when the reader got the first line */
+	t1 = __atomic_load_n(&t->t_first_pixel, __ATOMIC_ACQUIRE);
+	if (prev == SCAN_PHASE_FIRST_PIXEL && t1) {
+		t0 = ts_to_ns(&t->tmr.ts);
+		if (t1 > t0) {
+			t->ms[prev] += (t1 - t0) / 1e6;
+			t->tmr.ts.tv_sec = t1 / 1000000000;
+			t->tmr.ts.tv_nsec = t1 % 1000000000;
+		}
+		prev = SCAN_PHASE_STREAMING;
+	}
+
+	if (prev != SCAN_PHASE_NONE)
+		t->ms[prev] += get_timer(&t->tmr);
+	if (phase != SCAN_PHASE_NONE)
+		init_timer(&t->tmr, CLOCK_MONOTONIC);
+	t->phase = phase;
+	return prev;
+}
+
+void reset_scan_timing(struct scan_timing *t)
+{
+	memset(t, 0, sizeof(*t));
+}
+
+const char *get_scan_report_path(void)
+{
+	const char *s = getenv("GL843_TIMING_FILE");
+	return (s && *s) ? s : NULL;
+}
+
+int write_scan_report(const char *path,
+		      const struct scan_timing *t,
+		      const struct scan_setup *ss,
+		      const char *status)
+{
+	int fd, i, n;
+	double total = 0;
+	char buf[1024];
+
+	n = snprintf(buf, sizeof(buf), "{\"build\": %d, \"time\": %lld, "
+		"\"status\": \"%s\", \"dpi\": %d, \"width\": %d, "
+		"\"height\": %d, \"bpp\": %d",
+		DRIVER_BUILD, (long long) time(NULL), status, ss->dpi,
+		ss->width, ss->height, (int) ss->fmt);
+	for (i = SCAN_PHASE_NONE + 1; i < SCAN_PHASE_COUNT; i++) {
+		n += snprintf(buf + n, sizeof(buf) - n, ", \"%s_ms\": %.1f",
+			scan_phase_names[i], t->ms[i]);
+		total += t->ms[i];
+	}
+	n += snprintf(buf + n, sizeof(buf) - n,
+		", \"total_ms\": %.1f, \"backtracks\": %u}\n",
+		total, t->backtracks);
+	if (n >= (int) sizeof(buf)) {
+		DBG(DBG_error0, "BUG: scan report is too long.\n");
+		return -1;
+	}
+
+	fd = open(path, O_WRONLY | O_APPEND | O_CREAT, 0644);
+	if (fd < 0 || write(fd, buf, n) != n) {
+		DBG(DBG_warn, "Can't write the scan report to %s.\n", path);
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+	close(fd);
+	DBG(DBG_info, "scan report: %s", buf);
+	return 0;
+}
@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2010 Andreas Robinson <andr345 at gmail dot com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#ifndef _TIMING_H_
+#define _TIMING_H_
+
+#include <stdint.h>
+#include "util.h"
+
+/* Phases of a scan, timed separately. See timing.c. */
+enum scan_phase
+{
+	SCAN_PHASE_NONE,	/* Not timed */
+	SCAN_PHASE_HOME_WAIT,	/* Waiting for the head to get home */
+	SCAN_PHASE_WARM_UP,	/* Lamp warm-up and calibration moves */
+	SCAN_PHASE_BLACK_LEVEL,	/* AFE offset calibration */
+	SCAN_PHASE_GAIN,	/* AFE gain calibration */
+	SCAN_PHASE_SHADING,	/* Shading correction setup */
+	SCAN_PHASE_REG_SETUP,	/* Register, gamma and converter setup */
+	SCAN_PHASE_MOTOR_TABLES,	/* Motor table upload */
+	SCAN_PHASE_FIRST_PIXEL,	/* Motor start to the first line received */
+	SCAN_PHASE_STREAMING,	/* First line received to the last delivered */
+	SCAN_PHASE_HEAD_RETURN,	/* End of scan to head at home */
+	SCAN_PHASE_COUNT
+};
+
+struct scan_timing
+{
+	struct dbg_timer tmr;	/* Time in the current phase */
+	enum scan_phase phase;	/* Current phase */
+	double ms[SCAN_PHASE_COUNT];	/* Accumulated time per phase [ms] */
+	unsigned int backtracks;	/* Buffer-full stops. Updated atomically */
+	uint64_t t_first_pixel;	/* When the first line arrived [ns],
+				 * 0 = not yet. Set atomically. */
+};
+
+/* Name of a phase, e.g "home_wait" */
+const char *scan_phase_name(enum scan_phase phase);
+
+/* Switch to another phase. Time is counted against the current phase
+ * until the next switch. Returns the previous phase, so that a function
+ * can put it back when it is done. */
+enum scan_phase set_scan_phase(struct scan_timing *t, enum scan_phase phase);
+
+/* Note that the first line of the scan has arrived. Called from the
+ * pixel reader thread. The first_pixel phase ends at this time, and
+ * streaming begins, on the next set_scan_phase(). */
+void mark_first_pixel(struct scan_timing *t);
+
+/* Clear all phase times and counts, and stop timing. */
+void reset_scan_timing(struct scan_timing *t);
+
+/* Get the scan report file name from $GL843_TIMING_FILE.
+ * Returns NULL if scans should not be reported. */
+const char *get_scan_report_path(void);
+
+struct scan_setup;
+
+/* Append the timing of a finished scan as one line of JSON to path.
+ *
+ * ss:     The scan settings, for reference.
+ * status: "complete", "cancelled" or "failed".
+ *
+ * Returns 0, or -1 if the file can't be written.
+ */
+int write_scan_report(const char *path,
+		      const struct scan_timing *t,
+		      const struct scan_setup *ss,
+		      const char *status);
+
+#endif /* _TIMING_H_ */
@@ -293,22 +293,31 @@ int process_urb(struct usbmon_packet *hdr, unsigned char *data, FILE *file)
 		fprintf(stderr, "\n");
 	}
 
-	/* Write the parsed scanner command to disk */
-
-	char scan_cmd[] = {
-		(ts >> 24) & 0xff, (ts >> 16) & 0xff,
-		(ts >> 8) & 0xff, ts & 0xff, cmd, (buf != NULL) ? 1 : 0,
-		(blen & 0xff00) >> 8, (blen & 0xff) };
-	int r;
-
-	r = fwrite(scan_cmd, 1, sizeof(scan_cmd), file);
-	if (r != sizeof(scan_cmd))
-		goto file_error;
-	if (blen > 0 && buf != NULL) {
-		r = fwrite(buf, 1, blen, file);
-		if (r != blen)
+	/* Write the parsed scanner command to disk. The length is 16 bits,
+	 * so data of 64 KiB or more is split into several records with the
+	 * same command. Records without data just get a clamped length. */
+
+	do {
+		int n = (blen > 0xffff) ? 0xffff : blen;
+		char scan_cmd[] = {
+			(ts >> 24) & 0xff, (ts >> 16) & 0xff,
+			(ts >> 8) & 0xff, ts & 0xff, cmd, (buf != NULL) ? 1 : 0,
+			(n & 0xff00) >> 8, (n & 0xff) };
+		int r;
+
+		r = fwrite(scan_cmd, 1, sizeof(scan_cmd), file);
+		if (r != sizeof(scan_cmd))
 			goto file_error;
-	}
+		if (buf == NULL)
+			break;
+		if (n > 0) {
+			r = fwrite(buf, 1, n, file);
+			if (r != n)
+				goto file_error;
+		}
+		buf += n;
+		blen -= n;
+	} while (blen > 0);
 	return 1;
 file_error:
 	fprintf(stderr, "Error writing logfile: %s\n", strerror(errno));
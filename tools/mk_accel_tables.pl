@@ -0,0 +1,70 @@
+#!/usr/bin/perl
+#
+# Generate precomputed stepping motor acceleration curves for
+# build_accel_profile() in driver/cs4400f.c.
+#
+# Usage: ./mk_accel_tables.pl > ../driver/accel.h
+
+use strict;
+
+my $MTRTBL_SIZE = 1020;
+
+# (c_start, exp) pairs. The first five are used by Canon's Windows driver,
+# the rest by setup_vertical() and move_scanner_head().
+my @curves = (
+	[24576, 1.5],
+	[28597, 1.5],
+	[14298, 2.0],
+	[11234, 2.0],
+	[5617, 2.0],
+	[12000, 1.5],
+	[5600, 2.0],
+);
+
+# Must give the same result as the floating-point code in
+# build_accel_profile(). Note that it calculates 1/exp in single precision.
+sub curve {
+	my ($c_start, $exp) = @_;
+	my $K = $c_start ** $exp;
+	my $inv = unpack("f", pack("f", 1 / $exp));
+	my @a = ($c_start, $c_start);
+	for (my $i = 2; $i < $MTRTBL_SIZE; $i++) {
+		push(@a, int(($K / $i) ** $inv));
+	}
+	return @a;
+}
+
+print <<END;
+/* Precomputed stepping motor acceleration curves.
+ * This file is auto generated by tools/mk_accel_tables.pl.
+ */
+#ifndef _ACCEL_H_
+#define _ACCEL_H_
+
+/* Unclamped acceleration curve, see build_accel_profile() */
+struct accel_curve
+{
+	uint16_t c_start;	/* Start speed [counter ticks/step] */
+	float exp;		/* Power function exponent */
+	uint16_t a[MTRTBL_SIZE];
+};
+
+static const struct accel_curve accel_curves[] = {
+END
+
+foreach my $c (@curves) {
+	my ($c_start, $exp) = @$c;
+	my @a = curve($c_start, $exp);
+	printf("\t{ %d, %.1f, {", $c_start, $exp);
+	for (my $i = 0; $i < @a; $i++) {
+		print(($i % 10 == 0) ? "\n\t\t" : " ");
+		print("$a[$i],");
+	}
+	print("\n\t} },\n");
+}
+
+print <<END;
+};
+
+#endif /* _ACCEL_H_ */
+END